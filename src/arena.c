@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2016  bind-dyndb-ldap authors; see COPYING for license
+ */
+
+#include <isc/mem.h>
+#include <isc/result.h>
+#include <isc/util.h>
+
+#include "arena.h"
+#include "util.h"
+
+/* Default chunk size. Bigger allocations get dedicated chunks. */
+#define ARENA_CHUNK_SIZE	4096
+
+/* All allocations are aligned to the size of the largest basic type. */
+#define ARENA_ALIGNMENT		sizeof(long double)
+#define ARENA_ALIGN(size)	\
+	(((size) + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1))
+
+typedef struct arena_chunk arena_chunk_t;
+struct arena_chunk {
+	size_t			size;	/* usable bytes after the header */
+	size_t			used;
+	LINK(arena_chunk_t)	link;
+};
+#define ARENA_CHUNK_HDR		ARENA_ALIGN(sizeof(arena_chunk_t))
+
+struct arena {
+	isc_mem_t		*mctx;
+	/* Allocations are served from the head chunk. */
+	LIST(arena_chunk_t)	chunks;
+};
+
+static void ATTR_NONNULLS
+arena_chunk_free(arena_t *arena, arena_chunk_t *chunk)
+{
+	UNLINK(arena->chunks, chunk, link);
+	isc_mem_put(arena->mctx, chunk, ARENA_CHUNK_HDR + chunk->size);
+}
+
+isc_result_t
+arena_create(isc_mem_t *mctx, arena_t **arenap)
+{
+	isc_result_t result;
+	arena_t *arena = NULL;
+
+	REQUIRE(arenap != NULL && *arenap == NULL);
+
+	CHECKED_MEM_GET_PTR(mctx, arena);
+	ZERO_PTR(arena);
+	isc_mem_attach(mctx, &arena->mctx);
+	INIT_LIST(arena->chunks);
+
+	*arenap = arena;
+	return ISC_R_SUCCESS;
+
+cleanup:
+	return result;
+}
+
+void
+arena_destroy(arena_t **arenap)
+{
+	arena_t *arena;
+	arena_chunk_t *chunk;
+
+	REQUIRE(arenap != NULL);
+
+	arena = *arenap;
+	if (arena == NULL)
+		return;
+
+	while ((chunk = HEAD(arena->chunks)) != NULL)
+		arena_chunk_free(arena, chunk);
+	MEM_PUT_AND_DETACH(arena);
+
+	*arenap = NULL;
+}
+
+/**
+ * Allocate size bytes from the arena. Memory is valid until the next
+ * arena_reset() or arena_destroy() call.
+ */
+isc_result_t
+arena_get(arena_t *arena, size_t size, void **ptrp)
+{
+	isc_result_t result;
+	arena_chunk_t *chunk;
+	size_t chunk_size;
+
+	REQUIRE(ptrp != NULL && *ptrp == NULL);
+
+	size = ARENA_ALIGN(size);
+	chunk = HEAD(arena->chunks);
+	if (chunk == NULL || chunk->size - chunk->used < size) {
+		chunk_size = ISC_MAX(size, ARENA_CHUNK_SIZE);
+		chunk = NULL;
+		CHECKED_MEM_GET(arena->mctx, chunk,
+				ARENA_CHUNK_HDR + chunk_size);
+		chunk->size = chunk_size;
+		chunk->used = 0;
+		INIT_LINK(chunk, link);
+		PREPEND(arena->chunks, chunk, link);
+	}
+
+	*ptrp = (char *)chunk + ARENA_CHUNK_HDR + chunk->used;
+	chunk->used += size;
+	return ISC_R_SUCCESS;
+
+cleanup:
+	return result;
+}
+
+/**
+ * Release all allocations at once. One chunk of default size is kept
+ * so an arena reused for similar objects does not allocate again.
+ */
+void
+arena_reset(arena_t *arena)
+{
+	arena_chunk_t *chunk;
+	arena_chunk_t *next;
+	arena_chunk_t *keep = NULL;
+
+	for (chunk = HEAD(arena->chunks); chunk != NULL; chunk = next) {
+		next = NEXT(chunk, link);
+		if (keep == NULL && chunk->size == ARENA_CHUNK_SIZE) {
+			keep = chunk;
+			keep->used = 0;
+		} else {
+			arena_chunk_free(arena, chunk);
+		}
+	}
+}
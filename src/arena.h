@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) 2016  bind-dyndb-ldap authors; see COPYING for license
+ */
+
+#ifndef _LD_ARENA_H_
+#define _LD_ARENA_H_
+
+#include <isc/mem.h>
+
+#include "util.h"
+
+/*
+ * Arena is a bump allocator for short-lived objects which are all released
+ * at once, e.g. rdata parsed from one LDAP entry. Individual allocations
+ * cannot be freed. Arena is not thread-safe, it has to be used only by
+ * a single task at a time.
+ */
+typedef struct arena	arena_t;
+
+isc_result_t
+arena_create(isc_mem_t *mctx, arena_t **arenap) ATTR_NONNULLS ATTR_CHECKRESULT;
+
+void
+arena_destroy(arena_t **arenap) ATTR_NONNULLS;
+
+isc_result_t
+arena_get(arena_t *arena, size_t size, void **ptrp) ATTR_NONNULLS ATTR_CHECKRESULT;
+
+void
+arena_reset(arena_t *arena) ATTR_NONNULLS;
+
+#endif /* !_LD_ARENA_H_ */
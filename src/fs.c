@@ -12,6 +12,7 @@
 #include <isc/file.h>
 #include <isc/errno.h>
 #include <isc/result.h>
+#include <isc/stdio.h>
 #include <isc/string.h>
 #include <isc/util.h>
 
@@ -114,3 +115,86 @@ fs_file_remove(const char *file_name) {
 
 	return result;
 }
+
+/**
+ * Replace content of the file with given data. Data are written into
+ * temporary file '<file_name>.tmp' first and then renamed over the original
+ * so readers will never see partially written file.
+ */
+isc_result_t
+fs_file_write(const char *file_name, const void *data, size_t len) {
+	isc_result_t result;
+	char tmp_name[PATH_MAX + 1];
+	FILE *fp = NULL;
+	isc_boolean_t tmp_created = ISC_FALSE;
+
+	CHECK(isc_string_printf(tmp_name, sizeof(tmp_name), "%s.tmp",
+				file_name));
+	CHECK(isc_stdio_open(tmp_name, "w", &fp));
+	tmp_created = ISC_TRUE;
+	if (len > 0)
+		CHECK(isc_stdio_write(data, 1, len, fp, NULL));
+	CHECK(isc_stdio_flush(fp));
+	CHECK(isc_stdio_sync(fp));
+	result = isc_stdio_close(fp);
+	fp = NULL;
+	if (result != ISC_R_SUCCESS)
+		goto cleanup;
+	CHECK(isc_file_rename(tmp_name, file_name));
+	tmp_created = ISC_FALSE;
+
+cleanup:
+	if (fp != NULL)
+		(void)isc_stdio_close(fp);
+	if (tmp_created == ISC_TRUE)
+		(void)isc_file_remove(tmp_name);
+	if (result != ISC_R_SUCCESS)
+		log_error_r("unable to write file '%s'", file_name);
+
+	return result;
+}
+
+/**
+ * Read content of the file into pre-allocated buffer.
+ *
+ * @param[out] lenp Number of bytes read into buffer.
+ *
+ * @retval ISC_R_SUCCESS      Whole file was read.
+ * @retval ISC_R_FILENOTFOUND File does not exist.
+ * @retval ISC_R_NOSPACE      File is bigger than the buffer.
+ */
+isc_result_t
+fs_file_read(const char *file_name, void *buf, size_t size, size_t *lenp) {
+	isc_result_t result;
+	FILE *fp = NULL;
+	size_t len = 0;
+	char c;
+
+	result = isc_stdio_open(file_name, "r", &fp);
+	if (result == ISC_R_FILENOTFOUND)
+		return result;
+	else if (result != ISC_R_SUCCESS)
+		goto cleanup;
+
+	result = isc_stdio_read(buf, 1, size, fp, &len);
+	if (result == ISC_R_SUCCESS) {
+		/* buffer is full, there must not be any data left */
+		result = isc_stdio_read(&c, 1, 1, fp, NULL);
+		if (result == ISC_R_SUCCESS)
+			result = ISC_R_NOSPACE;
+	}
+	if (result == ISC_R_EOF)
+		result = ISC_R_SUCCESS;
+	else if (result != ISC_R_SUCCESS)
+		goto cleanup;
+
+	*lenp = len;
+
+cleanup:
+	if (fp != NULL)
+		(void)isc_stdio_close(fp);
+	if (result != ISC_R_SUCCESS)
+		log_error_r("unable to read file '%s'", file_name);
+
+	return result;
+}
@@ -13,4 +13,10 @@ fs_dirs_create(const char *path);
 isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
 fs_file_remove(const char *file_name);
 
+isc_result_t ATTR_NONNULL(1) ATTR_CHECKRESULT
+fs_file_write(const char *file_name, const void *data, size_t len);
+
+isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+fs_file_read(const char *file_name, void *buf, size_t size, size_t *lenp);
+
 #endif /* FS_H_ */
@@ -427,19 +427,19 @@ fwd_parse_ldap(ldap_entry_t *entry, settings_set_t *set) {
 				  ldap_entry_logname(entry), value->value);
 			CLEANUP_WITH(ISC_R_UNEXPECTEDTOKEN);
 		}
+		result = setting_update_from_ldap_entry("forward_policy", set,
+							"idnsForwardPolicy",
+							entry);
+	} else if (result == ISC_R_SUCCESS || result == ISC_R_NOTFOUND) {
+		/* Set the default directly, un-setting the policy first
+		 * would publish two new versions on every parse. */
+		log_debug(2, "defaulting to forward policy 'first' for "
+			  "%s", ldap_entry_logname(entry));
+		result = setting_set("forward_policy", set, "first");
 	}
-	result = setting_update_from_ldap_entry("forward_policy", set,
-						"idnsForwardPolicy",
-						entry);
 	first = result;
 	if (result != ISC_R_SUCCESS && result != ISC_R_IGNORE)
 		goto cleanup;
-	result = setting_find("forward_policy", set, ISC_FALSE, ISC_TRUE, NULL);
-	if (result == ISC_R_NOTFOUND) {
-		log_debug(2, "defaulting to forward policy 'first' for "
-			  "%s", ldap_entry_logname(entry));
-		CHECK(setting_set("forward_policy", set, "first"));
-	}
 
 	/* forwarders */
 	result = ldap_entry_getvalues(entry, "idnsForwarders", &values);
@@ -11,11 +11,13 @@
 #include <dns/name.h>
 #include <dns/rdata.h>
 #include <dns/result.h>
+#include <dns/ttl.h>
 #include <dns/types.h>
 
 #define LDAP_DEPRECATED 1
 #include <ldap.h>
 
+#include <arpa/inet.h>
 #include <errno.h>
 #include <strings.h>
 #include <ctype.h>
@@ -26,58 +28,167 @@
 #include "util.h"
 #include "zone_register.h"
 
+/* Characters which end plain run of RDN value in dn_scan_rdn(). Everything
+ * except escapes and RDN separator means fallback to ldap_str2dn(). */
+#define DN_VALUE_SPECIALS	",\\+;\"<>=#"
+/* Characters which can be escaped as \c, see RFC 4514 section 2.4. */
+#define DN_VALUE_ESCAPABLE	" \"#+,;<=>\\"
+
+static int
+dn_hexval(const char c) {
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	else if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	else if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
 /**
- * Convert LDAP DN to absolute DNS names.
+ * Scan one RDN "attr=value" at the beginning of DN and append unescaped value
+ * to the buffer. Runs of plain characters are found by strcspn() which is
+ * vectorized in the C library.
  *
- * @param[in]  dn     LDAP DN with one or two idnsName components at the
- *                    beginning.
- * @param[out] target Absolute DNS name derived from the first two idnsNames.
- * @param[out] origin Absolute DNS name derived from the last idnsName
- *                    component of DN, i.e. zone. Can be NULL.
- * @param[out] iszone ISC_TRUE if DN points to zone object, ISC_FALSE otherwise.
+ * Only single-valued RDNs with string values are handled: multi-valued RDNs,
+ * BER-encoded or quoted values, leading or trailing spaces and other unusual
+ * constructs have to be handled by ldap_str2dn().
  *
- * @code
- * Examples:
- * dn = "idnsName=foo.bar, idnsName=example.org., cn=dns, dc=example, dc=org"
- * target = "foo.bar.example.org."
- * origin = "example.org."
+ * @param[in,out] dnp   DN string, it will point to the next RDN on success.
+ * @param[out]    attr  Attribute type, points to the DN string.
+ * @param[out]    value Unescaped attribute value is appended to this buffer.
  *
- * dn = "idnsname=89, idnsname=4.34.10.in-addr.arpa, cn=dns, dc=example, dc=org"
- * target = "89.4.34.10.in-addr.arpa."
- * origin = "4.34.10.in-addr.arpa."
+ * @retval ISC_R_NOTIMPLEMENTED RDN has to be parsed by ldap_str2dn().
+ */
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+dn_scan_rdn(const char **dnp, isc_textregion_t *attr, isc_buffer_t *value) {
+	const char *p = *dnp;
+	size_t len;
+	int hi, lo;
+	unsigned char c;
+	isc_boolean_t trailing_space = ISC_FALSE;
+
+	attr->base = (char *)p;
+	while (isalnum((unsigned char)*p) || *p == '-' || *p == '.')
+		p++;
+	attr->length = p - attr->base;
+	if (attr->length == 0 || *p != '=')
+		return ISC_R_NOTIMPLEMENTED;
+	p++;
+	if (*p == ' ' || *p == '#' || *p == '"')
+		return ISC_R_NOTIMPLEMENTED;
+
+	while (ISC_TRUE) {
+		len = strcspn(p, DN_VALUE_SPECIALS);
+		if (len > isc_buffer_availablelength(value))
+			return ISC_R_NOTIMPLEMENTED;
+		isc_buffer_putmem(value, (const unsigned char *)p, len);
+		p += len;
+		if (len > 0)
+			trailing_space = ISC_TF(p[-1] == ' ');
+		if (*p != '\\')
+			break;
+
+		if ((hi = dn_hexval(p[1])) >= 0 && (lo = dn_hexval(p[2])) >= 0) {
+			c = (hi << 4) | lo;
+			p += 3;
+		} else if (p[1] != '\0'
+			   && strchr(DN_VALUE_ESCAPABLE, p[1]) != NULL) {
+			c = p[1];
+			p += 2;
+		} else {
+			return ISC_R_NOTIMPLEMENTED;
+		}
+		if (isc_buffer_availablelength(value) < 1)
+			return ISC_R_NOTIMPLEMENTED;
+		isc_buffer_putuint8(value, c);
+		trailing_space = ISC_FALSE;
+	}
+	if ((*p != ',' && *p != '\0') || trailing_space == ISC_TRUE
+	    || isc_buffer_usedlength(value) == 0)
+		return ISC_R_NOTIMPLEMENTED;
+
+	if (*p == ',') {
+		p++;
+		while (*p == ' ')
+			p++;
+		if (*p == '\0')
+			return ISC_R_NOTIMPLEMENTED;
+	}
+
+	*dnp = p;
+	return ISC_R_SUCCESS;
+}
+
+static isc_boolean_t
+dn_attr_isidnsname(const isc_textregion_t *attr) {
+	return ISC_TF(strncasecmp("idnsName", attr->base, attr->length) == 0);
+}
+
+/**
+ * Find values of the leading idnsName RDNs without ldap_str2dn().
+ * RDNs behind the first non-idnsName RDN are not even looked at.
  *
- * dn = "idnsname=third.test., idnsname=test., cn=dns, dc=example, dc=org"
- * target = "third.test."
- * origin = "test."
- * @endcode
+ * @param[out] name_buf   Unescaped value of the first RDN.
+ * @param[out] origin_buf Unescaped value of the second RDN.
+ * @param[out] idxp       Number of leading idnsName RDNs, at most 2.
+ *
+ * @retval ISC_R_NOTIMPLEMENTED DN has to be parsed by ldap_str2dn().
  */
-isc_result_t
-dn_to_dnsname(isc_mem_t *mctx, const char *dn_str, dns_name_t *target,
-	      dns_name_t *otarget, isc_boolean_t *iszone)
-{
-	LDAPDN dn = NULL;
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+dn_scan_idnsnames(const char *dn, isc_buffer_t *name_buf,
+		  isc_buffer_t *origin_buf, int *idxp) {
+	isc_result_t result;
+	isc_textregion_t attr;
+	unsigned char skip_base[DNS_NAME_MAXTEXT];
+	isc_buffer_t skip_buf;
+	int idx = 0;
+
+	isc_buffer_init(&skip_buf, skip_base, sizeof(skip_base));
+
+	CHECK(dn_scan_rdn(&dn, &attr, name_buf));
+	if (dn_attr_isidnsname(&attr) == ISC_FALSE)
+		CLEANUP_WITH(ISC_R_NOTIMPLEMENTED);
+	idx = 1;
+	if (*dn != '\0') {
+		CHECK(dn_scan_rdn(&dn, &attr, origin_buf));
+		if (dn_attr_isidnsname(&attr) == ISC_TRUE)
+			idx = 2;
+	}
+	/* ldap_str2dn() path checks the RDN which ends idnsName sequence */
+	if (idx == 2 && *dn != '\0')
+		CHECK(dn_scan_rdn(&dn, &attr, &skip_buf));
+
+	*idxp = idx;
+
+cleanup:
+	return result;
+}
+
+/**
+ * Find values of the leading idnsName RDNs using ldap_str2dn(),
+ * see dn_scan_idnsnames().
+ *
+ * @param[out] dnp Parsed DN. Buffers point into it so the caller has to free
+ *                 it using ldap_dnfree() after the buffers are used.
+ */
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+dn_str2dn_idnsnames(const char *dn_str, LDAPDN *dnp, isc_buffer_t *name_buf,
+		    isc_buffer_t *origin_buf, int *idxp) {
+	isc_result_t result = ISC_R_SUCCESS;
+	LDAPDN dn;
 	LDAPRDN rdn = NULL;
 	LDAPAVA *attr = NULL;
-	int idx;
+	int idx = 0;
 	int ret;
 
-	DECLARE_BUFFERED_NAME(name);
-	DECLARE_BUFFERED_NAME(origin);
-	isc_buffer_t name_buf;
-	isc_buffer_t origin_buf;
-	isc_result_t result;
-
-	REQUIRE(dn_str != NULL);
-	REQUIRE(target != NULL);
-
-	INIT_BUFFERED_NAME(name);
-	INIT_BUFFERED_NAME(origin);
-	isc_buffer_initnull(&name_buf);
-	isc_buffer_initnull(&origin_buf);
+	isc_buffer_initnull(name_buf);
+	isc_buffer_initnull(origin_buf);
 
 	/* Example DN: cn=a+sn=b, ou=people */
 
-	ret = ldap_str2dn(dn_str, &dn, LDAP_DN_FORMAT_LDAPV3);
+	ret = ldap_str2dn(dn_str, dnp, LDAP_DN_FORMAT_LDAPV3);
+	dn = *dnp;
 	if (ret != LDAP_SUCCESS || dn == NULL) {
 		log_bug("ldap_str2dn failed: %u", ret);
 		CLEANUP_WITH(ISC_R_UNEXPECTED);
@@ -105,16 +216,16 @@ dn_to_dnsname(isc_mem_t *mctx, const char *dn_str, dns_name_t *target,
 		if (strncasecmp("idnsName", attr->la_attr.bv_val,
 				attr->la_attr.bv_len) == 0) {
 			if (idx == 0) {
-				isc_buffer_init(&name_buf,
+				isc_buffer_init(name_buf,
 						attr->la_value.bv_val,
 						attr->la_value.bv_len);
-				isc_buffer_add(&name_buf,
+				isc_buffer_add(name_buf,
 					       attr->la_value.bv_len);
 			} else if (idx == 1) {
-				isc_buffer_init(&origin_buf,
+				isc_buffer_init(origin_buf,
 						attr->la_value.bv_val,
 						attr->la_value.bv_len);
-				isc_buffer_add(&origin_buf,
+				isc_buffer_add(origin_buf,
 					       attr->la_value.bv_len);
 			} else { /* more than two idnsNames?! */
 				break;
@@ -124,6 +235,81 @@ dn_to_dnsname(isc_mem_t *mctx, const char *dn_str, dns_name_t *target,
 		}
 	}
 
+cleanup:
+	*idxp = idx;
+	return result;
+}
+
+/**
+ * Copy name into its dedicated buffer or allocate memory for it.
+ */
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+dn_name_store(isc_mem_t *mctx, dns_name_t *source, dns_name_t *target) {
+	if (target->buffer != NULL)
+		return dns_name_copy(source, target, NULL);
+	else
+		return dns_name_dupwithoffsets(source, mctx, target);
+}
+
+/**
+ * Convert LDAP DN to absolute DNS names.
+ *
+ * Usual DNS names are found by dn_scan_idnsnames() which does not allocate
+ * any memory, ldap_str2dn() is used only for DNs which it cannot handle.
+ *
+ * @param[in]  dn     LDAP DN with one or two idnsName components at the
+ *                    beginning.
+ * @param[out] target Absolute DNS name derived from the first two idnsNames.
+ * @param[out] origin Absolute DNS name derived from the last idnsName
+ *                    component of DN, i.e. zone. Can be NULL.
+ * @param[out] iszone ISC_TRUE if DN points to zone object, ISC_FALSE otherwise.
+ *
+ * Names with dedicated buffer (see INIT_BUFFERED_NAME) are written into
+ * the buffer, other names are allocated using mctx.
+ *
+ * @code
+ * Examples:
+ * dn = "idnsName=foo.bar, idnsName=example.org., cn=dns, dc=example, dc=org"
+ * target = "foo.bar.example.org."
+ * origin = "example.org."
+ *
+ * dn = "idnsname=89, idnsname=4.34.10.in-addr.arpa, cn=dns, dc=example, dc=org"
+ * target = "89.4.34.10.in-addr.arpa."
+ * origin = "4.34.10.in-addr.arpa."
+ *
+ * dn = "idnsname=third.test., idnsname=test., cn=dns, dc=example, dc=org"
+ * target = "third.test."
+ * origin = "test."
+ * @endcode
+ */
+isc_result_t
+dn_to_dnsname(isc_mem_t *mctx, const char *dn_str, dns_name_t *target,
+	      dns_name_t *otarget, isc_boolean_t *iszone)
+{
+	LDAPDN dn = NULL;
+	int idx;
+
+	DECLARE_BUFFERED_NAME(name);
+	DECLARE_BUFFERED_NAME(origin);
+	unsigned char name_text[DNS_NAME_MAXTEXT];
+	unsigned char origin_text[DNS_NAME_MAXTEXT];
+	isc_buffer_t name_buf;
+	isc_buffer_t origin_buf;
+	isc_result_t result;
+
+	REQUIRE(dn_str != NULL);
+	REQUIRE(target != NULL);
+
+	INIT_BUFFERED_NAME(name);
+	INIT_BUFFERED_NAME(origin);
+	isc_buffer_init(&name_buf, name_text, sizeof(name_text));
+	isc_buffer_init(&origin_buf, origin_text, sizeof(origin_text));
+
+	result = dn_scan_idnsnames(dn_str, &name_buf, &origin_buf, &idx);
+	if (result != ISC_R_SUCCESS)
+		CHECK(dn_str2dn_idnsnames(dn_str, &dn, &name_buf, &origin_buf,
+					  &idx));
+
 	/* filter out unsupported cases */
 	if (idx <= 0) {
 		log_error("no idnsName component found in DN");
@@ -156,12 +342,12 @@ dn_to_dnsname(isc_mem_t *mctx, const char *dn_str, dns_name_t *target,
 
 cleanup:
 	if (result == ISC_R_SUCCESS)
-		result = dns_name_dupwithoffsets(&name, mctx, target);
+		result = dn_name_store(mctx, &name, target);
 	else
 		log_error_r("failed to convert DN '%s' to DNS name", dn_str);
 
 	if (result == ISC_R_SUCCESS && otarget != NULL)
-		result = dns_name_dupwithoffsets(&origin, mctx, otarget);
+		result = dn_name_store(mctx, &origin, otarget);
 
 	if (result != ISC_R_SUCCESS) {
 		if (dns_name_dynamic(target))
@@ -202,113 +388,63 @@ dn_want_zone(const char * const prefix, const char * const dn,
 	return ISC_R_SUCCESS;
 }
 
+/* Digits for LDAP escapes \xy. */
+static const char dn_hexdigits[] = "0123456789abcdef";
+
+/* Label characters which are copied to LDAP DN without escaping. */
+static isc_boolean_t
+dn_char_isplain(const unsigned char c) {
+	return ISC_TF((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+		      || (c >= '0' && c <= '9') || c == '-' || c == '_');
+}
+
 /**
  * WARNING! This function is used to mangle input from network
  *          and it is security sensitive.
  *
- * Convert a string from DNS escaping to LDAP escaping.
- * The Input string dns_str is expected to be the result of dns_name_tostring().
- * The DNS label can contain any binary data as described in
- * http://tools.ietf.org/html/rfc2181#section-11 .
- *
- * DNS escaping uses 2 forms: (see dns_name_totext2() in bind/lib/dns/name.c)
- *     form "\123" = ASCII value 123 (decimal)
- *     form "\$" = character '$' is escaped with '\'
- *     WARNING! Some characters are not escaped at all (e.g. ',').
- *
- * LDAP escaping users form "\7b"  = ASCII value 7b (hexadecimal)
+ * Append relative DNS name to LDAP DN as RDN value. Labels are separated
+ * by dots, characters [a-zA-Z0-9_-] are copied as they are and all other
+ * bytes of labels (including dots inside labels) are written in LDAP
+ * escape form "\xy" with two hexadecimal digits. Labels are read in wire
+ * format so there is no DNS escaping to undo.
  *
- * Input  (DNS escaped)  example: \$.\255_aaa,bbb\127\000ccc.555.ddd-eee
- * Output (LDAP escaped) example: \24.\ff_aaa\2cbbb\7f\00ccc.555.ddd-eee
- *
- * The DNS to text functions from ISC libraries do not convert certain
- * characters (e.g. ","). This function converts \123 form to \7b form in all
- * cases. Other characters (not escaped by ISC libraries) will be additionally
- * converted to the LDAP escape form.
- * Input characters [a-zA-Z0-9._-] are left in raw ASCII form.
- *
- * If dns_str consists only of the characters in the [a-zA-Z0-9._-] set, it
- * will be checked & copied to the output buffer, without any additional escaping.
+ * Label "$", label "\255_aaa,bbb\127\000ccc" and labels "555" and "ddd-eee"
+ * will be written as: \24.\ff_aaa\2cbbb\7f\00ccc.555.ddd-eee
  */
-isc_result_t
-dns_to_ldap_dn_escape(isc_mem_t *mctx, const char * const dns_str, char ** ldap_name) {
-	isc_result_t result = ISC_R_FAILURE;
-	char * esc_name = NULL;
-	int idx_symb_first = -1; /* index of first "nice" printable symbol in dns_str */
-	int dns_idx = 0;
-	int esc_idx = 0;
-
-	REQUIRE(dns_str != NULL);
-	REQUIRE(ldap_name != NULL && *ldap_name == NULL);
-
-	int dns_str_len = strlen(dns_str);
-
-	/**
-	 * In worst case each symbol from DNS dns_str will be represented
-	 * as "\xy" in ldap_name. (xy are hexadecimal digits)
-	 */
-	CHECKED_MEM_ALLOCATE(mctx, *ldap_name, 3 * dns_str_len + 1);
-	esc_name = *ldap_name;
-
-	for (dns_idx = 0; dns_idx < dns_str_len; dns_idx++) {
-		if (isalnum(dns_str[dns_idx]) || dns_str[dns_idx] == '.'
-				|| dns_str[dns_idx] == '-' || dns_str[dns_idx] == '_' ) {
-			if (idx_symb_first == -1)
-				idx_symb_first = dns_idx;
-			continue;
-		} else { /* some not very nice symbols */
-			int ascii_val;
-			if (idx_symb_first != -1) { /* copy previous nice part */
-				int length_ok = dns_idx - idx_symb_first;
-				memcpy(esc_name + esc_idx, dns_str + idx_symb_first, length_ok);
-				esc_idx += length_ok;
-				idx_symb_first = -1;
-			}
-			if (dns_str[dns_idx] != '\\') { /* not nice raw value, e.g. ',' */
-				ascii_val = dns_str[dns_idx];
-			} else { /* DNS escaped value, it starts with '\' */
-				if (!(dns_idx + 1 < dns_str_len)) {
-					CHECK(DNS_R_BADESCAPE); /* this problem should never happen */
-				}
-				if (isdigit(dns_str[dns_idx + 1])) { /* \123 decimal format */
-					/* check if input length <= expected size */
-					if (!(dns_idx + 3 < dns_str_len)) {
-						CHECK(DNS_R_BADESCAPE); /* this problem should never happen */
-					}
-					ascii_val = 100 * (dns_str[dns_idx + 1] - '0')
-							+ 10 * (dns_str[dns_idx + 2] - '0')
-							+ (dns_str[dns_idx + 3] - '0');
-					dns_idx += 3;
-				} else { /* \$ single char format */
-					ascii_val = dns_str[dns_idx + 1];
-					dns_idx += 1;
-				}
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+dn_cat_escaped_name(ld_string_t *target, dns_name_t *name) {
+	/* every byte of wire format can take up to three characters */
+	char buf[3 * DNS_NAME_MAXWIRE];
+	char *p = buf;
+	dns_label_t label;
+	unsigned int i, j;
+	unsigned char c;
+
+	for (i = 0; i < dns_name_countlabels(name); i++) {
+		dns_name_getlabel(name, i, &label);
+		if (i > 0)
+			*p++ = '.';
+		/* skip label length */
+		for (j = 1; j < label.length; j++) {
+			c = label.base[j];
+			if (dn_char_isplain(c) == ISC_TRUE) {
+				*p++ = c;
+			} else {
+				*p++ = '\\';
+				*p++ = dn_hexdigits[c >> 4];
+				*p++ = dn_hexdigits[c & 0xf];
 			}
-			/* LDAP uses \xy escaping. "xy" represent two hexadecimal digits.*/
-			/* TODO: optimize to bit mask & rotate & dec->hex table? */
-			CHECK(isc_string_printf(esc_name + esc_idx, 4, "\\%02x", ascii_val));
-			esc_idx += 3; /* isc_string_printf wrote 4 bytes including '\0' */
 		}
 	}
-	if (idx_symb_first != -1) { /* copy last nice part */
-		int length_ok = dns_idx - idx_symb_first;
-		memcpy(esc_name + esc_idx, dns_str + idx_symb_first, dns_idx - idx_symb_first);
-		esc_idx += length_ok;
-	}
-	esc_name[esc_idx] = '\0';
-	return ISC_R_SUCCESS;
-
-cleanup:
-	if (result == DNS_R_BADESCAPE)
-		log_bug("improperly escaped DNS string: '%s'", dns_str);
+	INSIST(p <= buf + sizeof(buf));
 
-	if (*ldap_name) {
-		isc_mem_free(mctx, *ldap_name);
-		*ldap_name = NULL;
-	}
-	return result;
+	return str_cat_char_len(target, buf, p - buf);
 }
 
+/**
+ * Compose DN of the LDAP entry for the owner name from the DN of its zone
+ * cached in zone register.
+ */
 isc_result_t
 dnsname_to_dn(zone_register_t *zr, dns_name_t *name, dns_name_t *zone,
 	      ld_string_t *target)
@@ -316,19 +452,15 @@ dnsname_to_dn(zone_register_t *zr, dns_name_t *name, dns_name_t *zone,
 	isc_result_t result;
 	int label_count;
 	const char *zone_dn = NULL;
-	char *dns_str = NULL;
-	char *escaped_name = NULL;
 	int dummy;
 	dns_name_t labels;
 	unsigned int common_labels;
 	dns_namereln_t namereln;
 
-
 	REQUIRE(zr != NULL);
 	REQUIRE(name != NULL);
 	REQUIRE(target != NULL);
 
-	isc_mem_t * mctx = zr_get_mctx(zr);
 	str_clear(target);
 
 	/* Find the DN of the zone we belong to. */
@@ -340,24 +472,19 @@ dnsname_to_dn(zone_register_t *zr, dns_name_t *name, dns_name_t *zone,
 
 		dns_name_init(&labels, NULL);
 		dns_name_getlabelsequence(name, 0, label_count, &labels);
-		CHECK(dns_name_tostring(&labels, &dns_str, mctx));
 
-		CHECK(dns_to_ldap_dn_escape(mctx, dns_str, &escaped_name));
 		CHECK(str_cat_char(target, "idnsName="));
-		CHECK(str_cat_char(target, escaped_name));
-		/* 
+		CHECK(dn_cat_escaped_name(target, &labels));
+		/*
 		 * Modification of following line can affect modify_ldap_common().
-		 * See line with: char *zone_dn = strstr(str_buf(owner_dn),", ") + 1;  
+		 * See line with: zone_dn = strstr(str_buf(owner_dn),", ");
+		 * Escaped name cannot contain ", ".
 		 */
 		CHECK(str_cat_char(target, ", "));
 	}
 	CHECK(str_cat_char(target, zone_dn));
 
 cleanup:
-	if (dns_str)
-		isc_mem_free(mctx, dns_str);
-	if (escaped_name)
-		isc_mem_free(mctx, escaped_name);
 	return result;
 }
 
@@ -457,3 +584,260 @@ rdata_to_generic(dns_rdata_t *rdata, isc_buffer_t *target)
 cleanup:
 	return result;
 }
+
+/**
+ * Characters which isc_lex could interpret differently than the simple
+ * word splitting done by rdata_fromtext_fast().
+ */
+static isc_boolean_t
+rdata_text_isspecial(const char c) {
+	return ISC_TF(isspace((unsigned char)c) || c == '"' || c == '('
+		      || c == ')' || c == ';' || c == '\\');
+}
+
+/**
+ * Get next word separated by spaces or tabs.
+ *
+ * @retval ISC_R_NOTIMPLEMENTED Word is missing or contains a character which
+ *                              has to be handled by isc_lex.
+ */
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+rdata_text_nextword(const char **textp, isc_textregion_t *word) {
+	const char *p = *textp;
+
+	while (*p == ' ' || *p == '\t')
+		p++;
+	word->base = (char *)p;
+	for (; *p != '\0' && *p != ' ' && *p != '\t'; p++) {
+		/* backslash escapes in names are handled by
+		 * dns_name_fromtext() itself */
+		if (*p != '\\' && rdata_text_isspecial(*p))
+			return ISC_R_NOTIMPLEMENTED;
+	}
+	word->length = p - word->base;
+	if (word->length == 0)
+		return ISC_R_NOTIMPLEMENTED;
+
+	*textp = p;
+	return ISC_R_SUCCESS;
+}
+
+/**
+ * @retval ISC_R_NOTIMPLEMENTED Text contains something else than trailing
+ *                              spaces and tabs.
+ */
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+rdata_text_end(const char *text) {
+	while (*text == ' ' || *text == '\t')
+		text++;
+
+	return (*text == '\0') ? ISC_R_SUCCESS : ISC_R_NOTIMPLEMENTED;
+}
+
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+rdata_text_touint(const isc_textregion_t *word, isc_uint32_t max,
+		  isc_uint32_t *valuep) {
+	isc_uint64_t value = 0;
+	unsigned int i;
+
+	for (i = 0; i < word->length; i++) {
+		if (!isdigit((unsigned char)word->base[i]))
+			return ISC_R_NOTIMPLEMENTED;
+		value = value * 10 + (word->base[i] - '0');
+		if (value > max)
+			return ISC_R_RANGE;
+	}
+
+	*valuep = (isc_uint32_t)value;
+	return ISC_R_SUCCESS;
+}
+
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+rdata_text_toname(const isc_textregion_t *word, dns_name_t *origin,
+		  isc_buffer_t *target) {
+	isc_buffer_t source;
+	dns_name_t name;
+
+	isc_buffer_init(&source, word->base, word->length);
+	isc_buffer_add(&source, word->length);
+	dns_name_init(&name, NULL);
+
+	return dns_name_fromtext(&name, &source, origin, 0, target);
+}
+
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+rdata_text_toaddr(const isc_textregion_t *word, int af, isc_buffer_t *target) {
+	char addr_str[INET6_ADDRSTRLEN];
+	unsigned char addr[sizeof(struct in6_addr)];
+	unsigned int len = (af == AF_INET) ? sizeof(struct in_addr)
+					   : sizeof(struct in6_addr);
+
+	if (word->length >= sizeof(addr_str))
+		return ISC_R_NOTIMPLEMENTED;
+	memcpy(addr_str, word->base, word->length);
+	addr_str[word->length] = '\0';
+	if (inet_pton(af, addr_str, addr) != 1)
+		return ISC_R_NOTIMPLEMENTED;
+	if (isc_buffer_availablelength(target) < len)
+		return ISC_R_NOSPACE;
+	isc_buffer_putmem(target, addr, len);
+
+	return ISC_R_SUCCESS;
+}
+
+/**
+ * Convert TXT strings separated by spaces or tabs. Strings can be quoted
+ * but they must not contain any escape sequences.
+ */
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+rdata_text_totxt(const char *text, isc_buffer_t *target) {
+	isc_result_t result;
+	isc_textregion_t word;
+	const char *end;
+	unsigned int strings = 0;
+
+	while (rdata_text_end(text) != ISC_R_SUCCESS) {
+		while (*text == ' ' || *text == '\t')
+			text++;
+		if (*text == '"') {
+			word.base = (char *)text + 1;
+			end = strpbrk(word.base, "\"\\\r\n");
+			if (end == NULL || *end != '"')
+				return ISC_R_NOTIMPLEMENTED;
+			word.length = end - word.base;
+			text = end + 1;
+			if (*text != '\0' && *text != ' ' && *text != '\t')
+				return ISC_R_NOTIMPLEMENTED;
+		} else {
+			CHECK(rdata_text_nextword(&text, &word));
+			if (memchr(word.base, '\\', word.length) != NULL)
+				return ISC_R_NOTIMPLEMENTED;
+		}
+		if (word.length > 255)
+			return ISC_R_NOTIMPLEMENTED;
+		if (isc_buffer_availablelength(target) < word.length + 1)
+			return ISC_R_NOSPACE;
+		isc_buffer_putuint8(target, word.length);
+		isc_buffer_putmem(target, (unsigned char *)word.base,
+				  word.length);
+		strings++;
+	}
+	result = (strings > 0) ? ISC_R_SUCCESS : ISC_R_NOTIMPLEMENTED;
+
+cleanup:
+	return result;
+}
+
+/**
+ * Convert text representation of the most common record types directly
+ * to wire format without isc_lex and dns_rdata_fromtext(). Only simple
+ * texts are handled: anything with quotes (except TXT), escapes (except
+ * in domain names), comments, parentheses or line breaks is refused.
+ *
+ * Resulting wire format is identical to output of dns_rdata_fromtext().
+ *
+ * @param[in]  origin Origin for relative names. Root is used if NULL.
+ * @param[out] target Wire format is appended to this buffer.
+ *
+ * @retval ISC_R_SUCCESS Wire format was written to target.
+ * @retval others        Text has to be parsed by dns_rdata_fromtext().
+ *                       It also reports errors in text properly.
+ *                       Target buffer might contain garbage.
+ */
+isc_result_t
+rdata_fromtext_fast(dns_rdataclass_t rdclass, dns_rdatatype_t rdtype,
+		    dns_name_t *origin, const char *text,
+		    isc_buffer_t *target)
+{
+	isc_result_t result;
+	isc_textregion_t word;
+	isc_uint32_t value;
+	unsigned int i;
+	int af;
+
+	if (origin == NULL)
+		origin = dns_rootname;
+
+	switch (rdtype) {
+	case dns_rdatatype_a:
+	case dns_rdatatype_aaaa:
+		if (rdclass != dns_rdataclass_in)
+			return ISC_R_NOTIMPLEMENTED;
+		af = (rdtype == dns_rdatatype_a) ? AF_INET : AF_INET6;
+		CHECK(rdata_text_nextword(&text, &word));
+		CHECK(rdata_text_toaddr(&word, af, target));
+		break;
+
+	case dns_rdatatype_cname:
+	case dns_rdatatype_ns:
+	case dns_rdatatype_ptr:
+		CHECK(rdata_text_nextword(&text, &word));
+		CHECK(rdata_text_toname(&word, origin, target));
+		break;
+
+	case dns_rdatatype_srv:
+		if (rdclass != dns_rdataclass_in)
+			return ISC_R_NOTIMPLEMENTED;
+		/* priority, weight, port */
+		for (i = 0; i < 3; i++) {
+			CHECK(rdata_text_nextword(&text, &word));
+			CHECK(rdata_text_touint(&word, 0xffff, &value));
+			if (isc_buffer_availablelength(target) < 2)
+				return ISC_R_NOSPACE;
+			isc_buffer_putuint16(target, (isc_uint16_t)value);
+		}
+		CHECK(rdata_text_nextword(&text, &word));
+		CHECK(rdata_text_toname(&word, origin, target));
+		break;
+
+	case dns_rdatatype_txt:
+		return rdata_text_totxt(text, target);
+
+	default:
+		return ISC_R_NOTIMPLEMENTED;
+	}
+	result = rdata_text_end(text);
+
+cleanup:
+	return result;
+}
+
+/**
+ * Convert SOA fields directly to wire format, see rdata_fromtext_fast().
+ *
+ * @param[in] fields MNAME, RNAME, SERIAL, REFRESH, RETRY, EXPIRE and MINIMUM
+ *                   in this order. Each field has to be a single word.
+ */
+isc_result_t
+soa_fromtext_fast(dns_name_t *origin, const char * const fields[7],
+		  isc_buffer_t *target)
+{
+	isc_result_t result;
+	isc_textregion_t word;
+	const char *text;
+	isc_uint32_t value;
+	unsigned int i;
+
+	if (origin == NULL)
+		origin = dns_rootname;
+
+	for (i = 0; i < 7; i++) {
+		text = fields[i];
+		CHECK(rdata_text_nextword(&text, &word));
+		CHECK(rdata_text_end(text));
+		if (i < 2) {
+			CHECK(rdata_text_toname(&word, origin, target));
+			continue;
+		} else if (i == 2) {
+			CHECK(rdata_text_touint(&word, 0xffffffff, &value));
+		} else {
+			CHECK(dns_ttl_fromtext(&word, &value));
+		}
+		if (isc_buffer_availablelength(target) < 4)
+			return ISC_R_NOSPACE;
+		isc_buffer_putuint32(target, value);
+	}
+
+cleanup:
+	return result;
+}
@@ -21,8 +21,9 @@
 /*
  * Convert LDAP DN 'dn', to dns_name_t 'target'. 'target' needs to be
  * initialized with dns_name_init() before the call and freed by the caller
- * after it using dns_name_free(). If origin is not NULL, then origin name of
- * that DNS name is returned.
+ * after it using dns_name_free(). Names with dedicated buffer
+ * (INIT_BUFFERED_NAME) are stored into the buffer instead. If origin is not
+ * NULL, then origin name of that DNS name is returned.
  */
 isc_result_t dn_to_dnsname(isc_mem_t *mctx, const char *dn,
 			   dns_name_t *target, dns_name_t *origin,
@@ -48,6 +49,19 @@ isc_result_t
 rdata_to_generic(dns_rdata_t *rdata, isc_buffer_t *target)
 		ATTR_NONNULLS ATTR_CHECKRESULT;
 
+/* Wire format buffer size for rdata_fromtext_fast() and soa_fromtext_fast().
+ * Longer rdata are left to the generic parser. */
+#define RDATA_FAST_MAXLENGTH	1024
+
+isc_result_t
+rdata_fromtext_fast(dns_rdataclass_t rdclass, dns_rdatatype_t rdtype,
+		    dns_name_t *origin, const char *text,
+		    isc_buffer_t *target) ATTR_NONNULL(4,5) ATTR_CHECKRESULT;
+
+isc_result_t
+soa_fromtext_fast(dns_name_t *origin, const char * const fields[7],
+		  isc_buffer_t *target) ATTR_NONNULL(2,3) ATTR_CHECKRESULT;
+
 isc_result_t dn_to_text(const char *dn, ld_string_t *target,
 			ld_string_t *origin) ATTR_NONNULL(1, 2) ATTR_CHECKRESULT;
 
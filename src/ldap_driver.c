@@ -17,6 +17,7 @@
 #include <isc/refcount.h>
 #include <isc/util.h>
 
+#include <dns/callbacks.h>
 #include <dns/db.h>
 #include <dns/diff.h>
 #include <dns/dyndb.h>
@@ -77,6 +78,13 @@ struct ldapdb {
 	 * The purpose is to detect moment when the new version is closed.
 	 * That is the right time for unlocking newversion_lock. */
 	dns_dbversion_t			*newversion;
+
+	/**
+	 * State of bulk load into empty RBTDB, see ldapdb_bulkload_add().
+	 * Guarded by newversion_lock. */
+	isc_boolean_t			bulkload_allowed;
+	isc_boolean_t			bulkload_active;
+	dns_rdatacallbacks_t		bulkload_callbacks;
 };
 
 dns_db_t * ATTR_NONNULLS
@@ -88,6 +96,108 @@ ldapdb_get_rbtdb(dns_db_t *db) {
 	return ldapdb->rbtdb;
 }
 
+/**
+ * Finish bulk load and forbid new bulk loads.
+ *
+ * @pre ldapdb->newversion_lock is locked.
+ */
+static void ATTR_NONNULLS
+ldapdb_bulkload_finish(ldapdb_t *ldapdb) {
+	isc_result_t result;
+
+	ldapdb->bulkload_allowed = ISC_FALSE;
+	if (ldapdb->bulkload_active == ISC_FALSE)
+		return;
+
+	ldapdb->bulkload_active = ISC_FALSE;
+	result = dns_db_endload(ldapdb->rbtdb, &ldapdb->bulkload_callbacks);
+	if (result != ISC_R_SUCCESS)
+		log_error_r("unable to finish bulk load of zone database");
+}
+
+/**
+ * Allow data to be loaded into the database by ldapdb_bulkload_add().
+ *
+ * @pre The internal RBTDB was never loaded, e.g. from a zone snapshot.
+ */
+void
+ldapdb_bulkload_allow(dns_db_t *db) {
+	ldapdb_t *ldapdb = (ldapdb_t *)db;
+
+	REQUIRE(VALID_LDAPDB(ldapdb));
+
+	LOCK(&ldapdb->newversion_lock);
+	ldapdb->bulkload_allowed = ISC_TRUE;
+	UNLOCK(&ldapdb->newversion_lock);
+}
+
+/**
+ * Add data directly into the internal RBTDB using RBTDB load callbacks,
+ * i.e. without versioning and diffing. Bulk load is started by the first
+ * call and ends with the first new version opened after that
+ * or ldapdb_bulkload_end() call. Once finished it cannot be started again.
+ *
+ * Loaded data are merged with data already present in the database.
+ *
+ * @retval ISC_R_NOTIMPLEMENTED Bulk load is not allowed for this database
+ *                              anymore. Caller has to use new version.
+ */
+isc_result_t
+ldapdb_bulkload_add(dns_db_t *db, dns_name_t *name,
+		    ldapdb_rdatalist_t *rdatalist) {
+	ldapdb_t *ldapdb = (ldapdb_t *)db;
+	isc_result_t result = ISC_R_SUCCESS;
+	dns_rdatalist_t *l;
+	dns_rdataset_t rdataset;
+	dns_rdatacallbacks_t *callbacks;
+
+	REQUIRE(VALID_LDAPDB(ldapdb));
+
+	dns_rdataset_init(&rdataset);
+	LOCK(&ldapdb->newversion_lock);
+	if (ldapdb->bulkload_allowed == ISC_FALSE)
+		CLEANUP_WITH(ISC_R_NOTIMPLEMENTED);
+
+	callbacks = &ldapdb->bulkload_callbacks;
+	if (ldapdb->bulkload_active == ISC_FALSE) {
+		dns_rdatacallbacks_init(callbacks);
+		result = dns_db_beginload(ldapdb->rbtdb, callbacks);
+		if (result != ISC_R_SUCCESS) {
+			ldapdb->bulkload_allowed = ISC_FALSE;
+			goto cleanup;
+		}
+		ldapdb->bulkload_active = ISC_TRUE;
+	}
+
+	for (l = HEAD(*rdatalist); l != NULL; l = NEXT(l, link)) {
+		CHECK(dns_rdatalist_tordataset(l, &rdataset));
+		result = callbacks->add(callbacks->add_private, name,
+					&rdataset);
+		dns_rdataset_disassociate(&rdataset);
+		if (result != ISC_R_SUCCESS && result != DNS_R_UNCHANGED)
+			goto cleanup;
+	}
+	result = ISC_R_SUCCESS;
+
+cleanup:
+	UNLOCK(&ldapdb->newversion_lock);
+	return result;
+}
+
+/**
+ * Finish bulk load started by ldapdb_bulkload_add(), if any.
+ */
+void
+ldapdb_bulkload_end(dns_db_t *db) {
+	ldapdb_t *ldapdb = (ldapdb_t *)db;
+
+	REQUIRE(VALID_LDAPDB(ldapdb));
+
+	LOCK(&ldapdb->newversion_lock);
+	ldapdb_bulkload_finish(ldapdb);
+	UNLOCK(&ldapdb->newversion_lock);
+}
+
 /**
  * Get full DNS name from the node.
  *
@@ -151,6 +261,7 @@ cleanup:
 	}
 	str_destroy(&file_name);
 #endif
+	ldapdb_bulkload_finish(ldapdb);
 	dns_db_detach(&ldapdb->rbtdb);
 	dns_name_free(&ldapdb->common.origin, ldapdb->common.mctx);
 	RUNTIME_CHECK(isc_mutex_destroy(&ldapdb->newversion_lock)
@@ -279,6 +390,9 @@ newversion(dns_db_t *db, dns_dbversion_t **versionp)
 	REQUIRE(VALID_LDAPDB(ldapdb));
 
 	LOCK(&ldapdb->newversion_lock);
+	/* Loaded data cannot be mixed with data from versions. */
+	if (ldapdb->bulkload_active == ISC_TRUE)
+		ldapdb_bulkload_finish(ldapdb);
 	result = dns_db_newversion(ldapdb->rbtdb, versionp);
 	if (result == ISC_R_SUCCESS) {
 		INSIST(*versionp != NULL);
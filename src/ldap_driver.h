@@ -8,6 +8,7 @@
 #include <dns/diff.h>
 #include <dns/types.h>
 
+#include "types.h"
 #include "util.h"
 
 /* values shared by all LDAP database instances */
@@ -29,4 +30,14 @@ ldapdb_associate(isc_mem_t *mctx, dns_name_t *name, dns_dbtype_t type,
 dns_db_t *
 ldapdb_get_rbtdb(dns_db_t *db) ATTR_NONNULLS;
 
+void
+ldapdb_bulkload_allow(dns_db_t *db) ATTR_NONNULLS;
+
+isc_result_t
+ldapdb_bulkload_add(dns_db_t *db, dns_name_t *name,
+		    ldapdb_rdatalist_t *rdatalist) ATTR_NONNULLS ATTR_CHECKRESULT;
+
+void
+ldapdb_bulkload_end(dns_db_t *db) ATTR_NONNULLS;
+
 #endif /* LDAP_DRIVER_H_ */
@@ -1,12 +1,16 @@
 /*
  * Copyright (C) 2011-2014  bind-dyndb-ldap authors; see COPYING for license
  */
+#include <string.h>
 #include <uuid/uuid.h>
 
+#include <dns/name.h>
 #include <dns/rdata.h>
 #include <dns/ttl.h>
 #include <dns/types.h>
 
+#include <isc/mutex.h>
+#include <isc/net.h>
 #include <isc/region.h>
 #include <isc/types.h>
 #include <isc/util.h>
@@ -31,74 +35,209 @@
 static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
 ldap_entry_parseclass(ldap_entry_t *entry, ldap_entryclass_t *class);
 
-/* Represents values associated with LDAP attribute */
 static void ATTR_NONNULLS
-ldap_valuelist_destroy(isc_mem_t *mctx, ldap_valuelist_t *values)
+ldap_entry_fingerprint(ldap_entry_t *entry);
+
+/* Number of attributes which can be decoded without allocating memory
+ * for ldap_attrvals_t array, see ldap_entry_parse(). */
+#define LDAP_ENTRY_ATTRS_PREALLOC	32
+
+/* Attribute and its values decoded in-place from LDAPMessage. */
+typedef struct ldap_attrvals {
+	struct berval		name;
+	BerVarray		vals;
+} ldap_attrvals_t;
+
+/**
+ * Copy string from LDAPMessage into entry data block and terminate it.
+ */
+static char * ATTR_NONNULLS ATTR_CHECKRESULT
+ldap_entry_strcpy(char **bufp, const struct berval *bv)
 {
-	ldap_value_t *value, *next;
-
-	value = HEAD(*values);
-	while (value != NULL) {
-		next = NEXT(value, link);
-		UNLINK(*values, value, link);
-		SAFE_MEM_PUT_PTR(mctx, value);
-		value = next;
+	char *str = *bufp;
+
+	memcpy(str, bv->bv_val, bv->bv_len);
+	str[bv->bv_len] = '\0';
+	*bufp += bv->bv_len + 1;
+
+	return str;
+}
+
+/**
+ * Build attribute and value lists of the entry in one memory block:
+ * array of ldap_attribute_t, array of ldap_value_t and then all strings.
+ * Lists are only views into the block so they are released together with it.
+ */
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+ldap_entry_fill(ldap_entry_t *entry, const struct berval *dn,
+		ldap_attrvals_t *attrs, unsigned int attrs_cnt,
+		unsigned int vals_cnt, size_t str_size)
+{
+	isc_result_t result;
+	ldap_attribute_t *attr;
+	ldap_value_t *val;
+	char *str;
+	unsigned int i, j;
+
+	entry->data_size = attrs_cnt * sizeof(ldap_attribute_t)
+			   + vals_cnt * sizeof(ldap_value_t) + str_size;
+	CHECKED_MEM_GET(entry->mctx, entry->data, entry->data_size);
+	attr = entry->data;
+	val = (ldap_value_t *)(attr + attrs_cnt);
+	str = (char *)(val + vals_cnt);
+
+	entry->dn = ldap_entry_strcpy(&str, dn);
+	for (i = 0; i < attrs_cnt; i++, attr++) {
+		ZERO_PTR(attr);
+		attr->name = ldap_entry_strcpy(&str, &attrs[i].name);
+		INIT_LIST(attr->values);
+		INIT_LINK(attr, link);
+		for (j = 0; attrs[i].vals[j].bv_val != NULL; j++, val++) {
+			val->value = ldap_entry_strcpy(&str,
+						       &attrs[i].vals[j]);
+			INIT_LINK(val, link);
+			APPEND(attr->values, val, link);
+		}
+		APPEND(entry->attrs, attr, link);
 	}
+	INSIST(str == (char *)entry->data + entry->data_size);
+
+cleanup:
+	return result;
 }
 
+/* Idle parsers shared by all tasks of one LDAP instance. */
+struct ldap_parserpool {
+	isc_mem_t		*mctx;
+	isc_mutex_t		lock;
+	LIST(ldap_parser_t)	idle;
+};
+
 static void ATTR_NONNULLS
-ldap_attributelist_destroy(isc_mem_t *mctx, ldap_attributelist_t *attrlist)
+ldap_parser_destroy(isc_mem_t *mctx, ldap_parser_t **parserp)
 {
-        ldap_attribute_t *attr, *next;
-
-        attr = HEAD(*attrlist);
-        while (attr != NULL) {
-                next = NEXT(attr, link);
-                UNLINK(*attrlist, attr, link);
-		ldap_valuelist_destroy(mctx, &attr->values);
-                ldap_value_free(attr->ldap_values);
-                ldap_memfree(attr->name);
-                SAFE_MEM_PUT_PTR(mctx, attr);
-                attr = next;
-        }
+	ldap_parser_t *parser = *parserp;
+
+	if (parser == NULL)
+		return;
+
+	if (parser->lex != NULL)
+		isc_lex_destroy(&parser->lex);
+	if (parser->rdata_target_mem != NULL)
+		SAFE_MEM_PUT(mctx, parser->rdata_target_mem,
+			     DNS_RDATA_MAXLENGTH);
+	SAFE_MEM_PUT_PTR(mctx, parser);
+
+	*parserp = NULL;
 }
 
-static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
-ldap_attr_create(isc_mem_t *mctx, LDAP *ld, LDAPMessage *ldap_entry,
-		 ldap_attribute_t *attr)
+isc_result_t
+ldap_parserpool_create(isc_mem_t *mctx, ldap_parserpool_t **poolp)
 {
 	isc_result_t result;
-	char **values;
-	ldap_value_t *val;
+	ldap_parserpool_t *pool = NULL;
 
-	REQUIRE(ld != NULL);
-	REQUIRE(ldap_entry != NULL);
-	REQUIRE(attr != NULL);
+	REQUIRE(poolp != NULL && *poolp == NULL);
 
-	values = ldap_get_values(ld, ldap_entry, attr->name);
-	/* TODO: proper ldap error handling */
-	if (values == NULL)
-		return ISC_R_FAILURE;
+	CHECKED_MEM_GET_PTR(mctx, pool);
+	ZERO_PTR(pool);
+	INIT_LIST(pool->idle);
+	result = isc_mutex_init(&pool->lock);
+	if (result != ISC_R_SUCCESS) {
+		SAFE_MEM_PUT_PTR(mctx, pool);
+		goto cleanup;
+	}
+	isc_mem_attach(mctx, &pool->mctx);
 
-	attr->ldap_values = values;
+	*poolp = pool;
 
-	for (unsigned int i = 0; values[i] != NULL; i++) {
-		CHECKED_MEM_GET_PTR(mctx, val);
-		val->value = values[i];
-		INIT_LINK(val, link);
+cleanup:
+	return result;
+}
 
-		APPEND(attr->values, val, link);
+void
+ldap_parserpool_destroy(ldap_parserpool_t **poolp)
+{
+	ldap_parserpool_t *pool;
+	ldap_parser_t *parser;
+
+	REQUIRE(poolp != NULL);
+
+	pool = *poolp;
+	if (pool == NULL)
+		return;
+
+	while ((parser = HEAD(pool->idle)) != NULL) {
+		UNLINK(pool->idle, parser, link);
+		ldap_parser_destroy(pool->mctx, &parser);
 	}
+	DESTROYLOCK(&pool->lock);
+	MEM_PUT_AND_DETACH(pool);
 
+	*poolp = NULL;
+}
+
+/**
+ * Borrow parser for text-to-wire conversion of rdata. New parser is
+ * allocated only if all existing parsers are in use so the number of parsers
+ * is bounded by number of threads parsing at the same time and not by
+ * number of entries waiting in the SyncRepl queue.
+ *
+ * Parser has to be returned using ldap_parser_put().
+ */
+isc_result_t
+ldap_parser_get(ldap_parserpool_t *pool, ldap_parser_t **parserp)
+{
+	isc_result_t result;
+	ldap_parser_t *parser = NULL;
+
+	REQUIRE(parserp != NULL && *parserp == NULL);
+
+	LOCK(&pool->lock);
+	parser = HEAD(pool->idle);
+	if (parser != NULL)
+		UNLINK(pool->idle, parser, link);
+	UNLOCK(&pool->lock);
+
+	if (parser == NULL) {
+		CHECKED_MEM_GET_PTR(pool->mctx, parser);
+		ZERO_PTR(parser);
+		INIT_LINK(parser, link);
+		CHECKED_MEM_GET(pool->mctx, parser->rdata_target_mem,
+				DNS_RDATA_MAXLENGTH);
+		CHECK(isc_lex_create(pool->mctx, TOKENSIZ, &parser->lex));
+	}
+	isc_buffer_init(&parser->rdata_target, parser->rdata_target_mem,
+			DNS_RDATA_MAXLENGTH);
+
+	*parserp = parser;
 	return ISC_R_SUCCESS;
 
 cleanup:
-	ldap_valuelist_destroy(mctx, &attr->values);
-	ldap_value_free(values);
-
+	ldap_parser_destroy(pool->mctx, &parser);
 	return result;
 }
 
+/**
+ * Return parser borrowed by ldap_parser_get() to the pool.
+ */
+void
+ldap_parser_put(ldap_parserpool_t *pool, ldap_parser_t **parserp)
+{
+	ldap_parser_t *parser;
+
+	REQUIRE(parserp != NULL && *parserp != NULL);
+
+	parser = *parserp;
+	isc_lex_close(parser->lex);
+
+	LOCK(&pool->lock);
+	PREPEND(pool->idle, parser, link);
+	UNLOCK(&pool->lock);
+
+	*parserp = NULL;
+}
+
 /**
  * Allocate and initialize empty ldap_entry_t. The new entry will not contain
  * any data, it needs to be filled by ldap_entry_parse or ldap_entry_reconstruct.
@@ -119,15 +258,10 @@ ldap_entry_init(isc_mem_t *mctx, ldap_entry_t **entryp) {
 	INIT_BUFFERED_NAME(entry->fqdn);
 	INIT_BUFFERED_NAME(entry->zone_name);
 
-	CHECKED_MEM_GET(mctx, entry->rdata_target_mem, DNS_RDATA_MAXLENGTH);
-	CHECK(isc_lex_create(mctx, TOKENSIZ, &entry->lex));
-
 	*entryp = entry;
+	return ISC_R_SUCCESS;
 
 cleanup:
-	if (result != ISC_R_SUCCESS)
-		ldap_entry_destroy(&entry);
-
 	return result;
 }
 
@@ -177,20 +311,68 @@ cleanup:
 	return result;
 }
 
+/**
+ * Create fake LDAP entry which requests rendering of templates in the entry
+ * again. It has only UUID, class and DNS names of the original entry.
+ *
+ * @param[in]  entry    Template entry.
+ * @param[out] refreshp Resulting entry. Caller has to free it.
+ */
+isc_result_t
+ldap_entry_templaterefresh(const ldap_entry_t *entry, ldap_entry_t **refreshp)
+{
+	isc_result_t result;
+	ldap_entry_t *refresh = NULL;
+
+	REQUIRE(entry->uuid != NULL);
+
+	CHECK(ldap_entry_init(entry->mctx, &refresh));
+
+	refresh->uuid = ber_dupbv(NULL, entry->uuid);
+	if (refresh->uuid == NULL)
+		CLEANUP_WITH(ISC_R_NOMEMORY);
+
+	refresh->class = entry->class;
+	refresh->template_refresh = ISC_TRUE;
+	CHECK(dns_name_copy(&entry->fqdn, &refresh->fqdn, NULL));
+	CHECK(dns_name_copy(&entry->zone_name, &refresh->zone_name, NULL));
+
+	*refreshp = refresh;
+
+cleanup:
+	if (result != ISC_R_SUCCESS)
+		ldap_entry_destroy(&refresh);
+	return result;
+}
+
 /**
  * Allocate new ldap_entry and fill it with data from LDAPMessage.
+ *
+ * BER encoded entry is walked only once. Attribute names and values are
+ * decoded in-place and then copied into single memory block owned by
+ * the entry because the LDAPMessage is released before the entry
+ * is processed.
  */
 isc_result_t
 ldap_entry_parse(isc_mem_t *mctx, LDAP *ld, LDAPMessage *ldap_entry,
 		  struct berval	*uuid, ldap_entry_t **entryp)
 {
 	isc_result_t result;
-	ldap_attribute_t *attr = NULL;
-	char *attribute;
 	BerElement *ber = NULL;
 	ldap_entry_t *entry = NULL;
 	isc_boolean_t has_zone_dn;
 	isc_boolean_t has_zone_class;
+	struct berval dn;
+	struct berval name;
+	BerVarray vals = NULL;
+	ldap_attrvals_t attrs_prealloc[LDAP_ENTRY_ATTRS_PREALLOC];
+	ldap_attrvals_t *attrs = attrs_prealloc;
+	ldap_attrvals_t *attrs_new = NULL;
+	unsigned int attrs_max = LDAP_ENTRY_ATTRS_PREALLOC;
+	unsigned int attrs_cnt = 0;
+	unsigned int vals_cnt = 0;
+	size_t str_size;
+	unsigned int i;
 
 	REQUIRE(ld != NULL);
 	REQUIRE(ldap_entry != NULL);
@@ -199,28 +381,58 @@ ldap_entry_parse(isc_mem_t *mctx, LDAP *ld, LDAPMessage *ldap_entry,
 
 	CHECK(ldap_entry_init(mctx, &entry));
 
-	for (attribute = ldap_first_attribute(ld, ldap_entry, &ber);
-	     attribute != NULL;
-	     attribute = ldap_next_attribute(ld, ldap_entry, ber)) {
-		CHECKED_MEM_GET_PTR(mctx, attr);
-		ZERO_PTR(attr);
-
-		attr->name = attribute;
-		INIT_LIST(attr->values);
-		INIT_LINK(attr, link);
-		CHECK(ldap_attr_create(mctx, ld, ldap_entry, attr));
-
-		APPEND(entry->attrs, attr, link);
-	}
-	attr = NULL;
-
-	entry->dn = ldap_get_dn(ld, ldap_entry);
-	if (entry->dn == NULL) {
+	if (ldap_get_dn_ber(ld, ldap_entry, &ber, &dn) != LDAP_SUCCESS) {
 		log_ldap_error(ld, "unable to get entry DN");
 		CLEANUP_WITH(ISC_R_FAILURE);
 	}
+	str_size = dn.bv_len + 1;
+	while (ISC_TRUE) {
+		if (ldap_get_attribute_ber(ld, ldap_entry, ber, &name, &vals)
+		    != LDAP_SUCCESS) {
+			log_ldap_error(ld, "unable to decode attributes of "
+				       "LDAP entry '%.*s'", (int)dn.bv_len,
+				       dn.bv_val);
+			CLEANUP_WITH(ISC_R_FAILURE);
+		}
+		if (name.bv_val == NULL)
+			break;
+		/* attributes without values are not used anywhere */
+		if (vals == NULL)
+			continue;
+		if (vals[0].bv_val == NULL) {
+			ber_memfree(vals);
+			vals = NULL;
+			continue;
+		}
+
+		if (attrs_cnt == attrs_max) {
+			CHECKED_MEM_GET(mctx, attrs_new,
+					2 * attrs_max * sizeof(*attrs));
+			memcpy(attrs_new, attrs, attrs_max * sizeof(*attrs));
+			if (attrs != attrs_prealloc)
+				SAFE_MEM_PUT(mctx, attrs,
+					     attrs_max * sizeof(*attrs));
+			attrs = attrs_new;
+			attrs_new = NULL;
+			attrs_max *= 2;
+		}
+		attrs[attrs_cnt].name = name;
+		attrs[attrs_cnt].vals = vals;
+		vals = NULL;
+
+		str_size += name.bv_len + 1;
+		for (i = 0; attrs[attrs_cnt].vals[i].bv_val != NULL; i++) {
+			str_size += attrs[attrs_cnt].vals[i].bv_len + 1;
+			vals_cnt++;
+		}
+		attrs_cnt++;
+	}
+	CHECK(ldap_entry_fill(entry, &dn, attrs, attrs_cnt, vals_cnt,
+			      str_size));
+
 	entry->uuid = ber_dupbv(NULL, uuid);
 	CHECK(ldap_entry_parseclass(entry, &entry->class));
+	ldap_entry_fingerprint(entry);
 	if ((entry->class & LDAP_ENTRYCLASS_TEMPLATE) != 0
 	    && (entry->class
 		& ~(LDAP_ENTRYCLASS_TEMPLATE | LDAP_ENTRYCLASS_RR)) != 0) {
@@ -243,17 +455,92 @@ ldap_entry_parse(isc_mem_t *mctx, LDAP *ld, LDAPMessage *ldap_entry,
 	*entryp = entry;
 
 cleanup:
+	if (vals != NULL)
+		ber_memfree(vals);
+	for (i = 0; i < attrs_cnt; i++)
+		ber_memfree(attrs[i].vals);
+	if (attrs != attrs_prealloc)
+		SAFE_MEM_PUT(mctx, attrs, attrs_max * sizeof(*attrs));
 	if (ber != NULL)
 		ber_free(ber, 0);
 	if (result != ISC_R_SUCCESS) {
 		if (entry != NULL)
 			ldap_entry_destroy(&entry);
-		SAFE_MEM_PUT_PTR(mctx, attr);
 	}
 
 	return result;
 }
 
+/**
+ * Decide if attribute can influence DNS data or configuration. Other
+ * attributes like ACIs or description are not used by this plugin.
+ */
+static isc_boolean_t ATTR_NONNULLS ATTR_CHECKRESULT
+ldap_attr_isrelevant(const char *name)
+{
+	size_t len = strlen(name);
+
+	if (strcasecmp(name, "objectClass") == 0
+	    || strncasecmp(name, "idns", sizeof("idns") - 1) == 0
+	    /* dnsTTL, DNSdefaultTTL and dNSClass */
+	    || strncasecmp(name, "dns", sizeof("dns") - 1) == 0
+	    || strncasecmp(name, LDAP_RDATATYPE_UNKNOWN_PREFIX,
+			   LDAP_RDATATYPE_UNKNOWN_PREFIX_LEN) == 0)
+		return ISC_TRUE;
+
+	return ISC_TF(len > LDAP_RDATATYPE_SUFFIX_LEN
+		      && strcasecmp(name + len - LDAP_RDATATYPE_SUFFIX_LEN,
+				    LDAP_RDATATYPE_SUFFIX) == 0);
+}
+
+static void ATTR_NONNULLS
+ldap_fingerprint_add(isc_sha256_t *sha, isc_uint32_t len, const char *data)
+{
+	/* fingerprints are saved in state file, keep them portable */
+	isc_uint32_t netlen = htonl(len);
+
+	isc_sha256_update(sha, (const isc_uint8_t *)&netlen, sizeof(netlen));
+	if (data != NULL)
+		isc_sha256_update(sha, (const isc_uint8_t *)data, len);
+}
+
+/**
+ * Compute hash of entry DN and of all attributes relevant for DNS.
+ * Attributes and values are hashed in the order returned by LDAP server
+ * so equal fingerprints imply equal content but not vice versa.
+ */
+static void ATTR_NONNULLS
+ldap_entry_fingerprint(ldap_entry_t *entry)
+{
+	isc_sha256_t sha;
+	ldap_attribute_t *attr;
+	ldap_value_t *val;
+	isc_uint32_t count;
+
+	isc_sha256_init(&sha);
+	ldap_fingerprint_add(&sha, strlen(entry->dn), entry->dn);
+	for (attr = HEAD(entry->attrs);
+	     attr != NULL;
+	     attr = NEXT(attr, link)) {
+		if (ldap_attr_isrelevant(attr->name) == ISC_FALSE)
+			continue;
+		count = 0;
+		for (val = HEAD(attr->values);
+		     val != NULL;
+		     val = NEXT(val, link))
+			count++;
+		/* lengths and number of values keep boundaries unambiguous */
+		ldap_fingerprint_add(&sha, strlen(attr->name), attr->name);
+		ldap_fingerprint_add(&sha, count, NULL);
+		for (val = HEAD(attr->values);
+		     val != NULL;
+		     val = NEXT(val, link))
+			ldap_fingerprint_add(&sha, strlen(val->value),
+					     val->value);
+	}
+	isc_sha256_final(entry->fingerprint, &sha);
+}
+
 void
 ldap_entry_destroy(ldap_entry_t **entryp)
 {
@@ -265,22 +552,15 @@ ldap_entry_destroy(ldap_entry_t **entryp)
 	if (entry == NULL)
 		return;
 
-	ldap_attributelist_destroy(entry->mctx, &entry->attrs);
-	if (entry->dn != NULL)
-		ldap_memfree(entry->dn);
+	/* attributes, values and DN */
+	if (entry->data != NULL)
+		SAFE_MEM_PUT(entry->mctx, entry->data, entry->data_size);
 	if (entry->uuid != NULL)
 		ber_bvfree(entry->uuid);
 	if (dns_name_dynamic(&entry->fqdn))
 		dns_name_free(&entry->fqdn, entry->mctx);
 	if (dns_name_dynamic(&entry->zone_name))
 		dns_name_free(&entry->zone_name, entry->mctx);
-	if (entry->lex != NULL) {
-		isc_lex_close(entry->lex);
-		isc_lex_destroy(&entry->lex);
-	}
-	if (entry->rdata_target_mem != NULL)
-		SAFE_MEM_PUT(entry->mctx, entry->rdata_target_mem,
-			     DNS_RDATA_MAXLENGTH);
 	str_destroy(&entry->logname);
 
 	MEM_PUT_AND_DETACH(entry);
@@ -288,6 +568,24 @@ ldap_entry_destroy(ldap_entry_t **entryp)
 	*entryp = NULL;
 }
 
+/**
+ * Estimate amount of memory occupied by LDAP entry and its attributes.
+ * Parsing buffers are not owned by entries, see ldap_parser_get().
+ */
+size_t
+ldap_entry_size(const ldap_entry_t *entry)
+{
+	size_t size;
+
+	REQUIRE(entry != NULL);
+
+	size = sizeof(*entry) + entry->data_size;
+	if (entry->uuid != NULL)
+		size += sizeof(*entry->uuid) + entry->uuid->bv_len;
+
+	return size;
+}
+
 isc_result_t
 ldap_entry_getvalues(const ldap_entry_t *entry, const char *attrname,
 		     ldap_valuelist_t *values)
@@ -426,6 +724,47 @@ cleanup:
 	return result;
 }
 
+/**
+ * Convert SOA attributes directly to wire format without building
+ * a text representation, see ldap_entry_getfakesoa().
+ *
+ * @retval ISC_R_SUCCESS SOA wire format was appended to target.
+ * @retval others        Use ldap_entry_getfakesoa() and generic parser.
+ */
+isc_result_t
+ldap_entry_getsoa(ldap_entry_t *entry, const char *fake_mname,
+		  dns_name_t *origin, isc_buffer_t *target)
+{
+	isc_result_t result;
+	ldap_valuelist_t values;
+	const char *fields[7];
+	int i = 0;
+
+	const char *soa_attrs[7] = {
+		"idnsSOAmName", "idnsSOArName", "idnsSOAserial",
+		"idnsSOArefresh", "idnsSOAretry", "idnsSOAexpire",
+		"idnsSOAminimum"
+	};
+
+	if (strlen(fake_mname) > 0) {
+		fields[0] = fake_mname;
+		i = 1;
+	}
+	for (; i < 7; i++) {
+		result = ldap_entry_getvalues(entry, soa_attrs[i], &values);
+		/* Missing idnsSOAserial is read as 1,
+		 * see ldap_entry_getfakesoa(). */
+		if (result == ISC_R_NOTFOUND && i == 2)
+			fields[i] = "1";
+		else if (result != ISC_R_SUCCESS)
+			return result;
+		else
+			fields[i] = HEAD(values)->value;
+	}
+
+	return soa_fromtext_fast(origin, fields, target);
+}
+
 isc_result_t
 ldap_entry_parseclass(ldap_entry_t *entry, ldap_entryclass_t *class)
 {
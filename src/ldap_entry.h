@@ -6,6 +6,7 @@
 #define _LD_LDAP_ENTRY_H_
 
 #include <isc/lex.h>
+#include <isc/sha2.h>
 #include <isc/util.h>
 #include <dns/types.h>
 
@@ -25,28 +26,37 @@ struct ldap_value {
         LINK(ldap_value_t)      link;
 };
 
+typedef LIST(ldap_entry_t)	ldap_entrylist_t;
+
 /* Represents LDAP attribute and it's values */
 typedef struct ldap_attribute	ldap_attribute_t;
 typedef LIST(ldap_attribute_t)	ldap_attributelist_t;
 
 /* Represents LDAP entry and it's attributes */
 typedef unsigned char		ldap_entryclass_t;
+#define LDAP_ENTRY_FINGERPRINT_SIZE	ISC_SHA256_DIGESTLENGTH
 struct ldap_entry {
 	isc_mem_t		*mctx;
 	char			*dn;
 	struct berval		*uuid;
 	ldap_entryclass_t	class;
+	/* Hash of DN and attributes used by this plugin, see
+	 * ldap_entry_fingerprint(). Not available in reconstructed entries. */
+	unsigned char		fingerprint[LDAP_ENTRY_FINGERPRINT_SIZE];
 	DECLARE_BUFFERED_NAME(fqdn);
 	DECLARE_BUFFERED_NAME(zone_name);
+	/* Fake entry without attributes which requests rendering of templates
+	 * from the last known state of the entry, see rr_templateindex_t. */
+	isc_boolean_t		template_refresh;
 
 	ldap_attribute_t	*lastattr;
 	ldap_attributelist_t	attrs;
 	LINK(ldap_entry_t)	link;
 
-	/* Parsing. */
-	isc_lex_t		*lex;
-	isc_buffer_t		rdata_target;
-	unsigned char		*rdata_target_mem;
+	/* DN, attributes and values of parsed entry in one memory block,
+	 * see ldap_entry_parse(). */
+	void			*data;
+	size_t			data_size;
 
 	/* Human-readable identifier. It has to be accessed via
 	 * ldap_entry_logname(). */
@@ -56,12 +66,21 @@ struct ldap_entry {
 /* Represents LDAP attribute and it's values */
 struct ldap_attribute {
 	char			*name;
-	char			**ldap_values;
 	ldap_value_t		*lastval;
 	ldap_valuelist_t	values;
 	LINK(ldap_attribute_t)	link;
 };
 
+/* Lexer and buffer for text-to-wire conversion of rdata. Parsers are
+ * borrowed from ldap_parserpool_t only while rdata are being parsed. */
+typedef struct ldap_parser ldap_parser_t;
+struct ldap_parser {
+	isc_lex_t		*lex;
+	isc_buffer_t		rdata_target;
+	unsigned char		*rdata_target_mem;
+	LINK(ldap_parser_t)	link;
+};
+
 #define LDAP_ENTRYCLASS_NONE	0x0
 #define LDAP_ENTRYCLASS_RR	0x1
 #define LDAP_ENTRYCLASS_MASTER	0x2
@@ -73,6 +92,18 @@ struct ldap_attribute {
 /* Max type length definitions, from lib/dns/master.c */
 #define TOKENSIZ (8*1024)
 
+isc_result_t
+ldap_parserpool_create(isc_mem_t *mctx, ldap_parserpool_t **poolp) ATTR_NONNULLS ATTR_CHECKRESULT;
+
+void
+ldap_parserpool_destroy(ldap_parserpool_t **poolp) ATTR_NONNULLS;
+
+isc_result_t
+ldap_parser_get(ldap_parserpool_t *pool, ldap_parser_t **parserp) ATTR_NONNULLS ATTR_CHECKRESULT;
+
+void
+ldap_parser_put(ldap_parserpool_t *pool, ldap_parser_t **parserp) ATTR_NONNULLS;
+
 isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
 ldap_entry_init(isc_mem_t *mctx, ldap_entry_t **entryp);
 
@@ -84,9 +115,16 @@ isc_result_t
 ldap_entry_reconstruct(isc_mem_t *mctx, mldapdb_t *mldap, struct berval *uuid,
 		       ldap_entry_t **entryp) ATTR_NONNULLS ATTR_CHECKRESULT;
 
+isc_result_t
+ldap_entry_templaterefresh(const ldap_entry_t *entry,
+			   ldap_entry_t **refreshp) ATTR_NONNULLS ATTR_CHECKRESULT;
+
 void
 ldap_entry_destroy(ldap_entry_t **entryp) ATTR_NONNULLS;
 
+size_t
+ldap_entry_size(const ldap_entry_t *entry) ATTR_NONNULLS ATTR_CHECKRESULT;
+
 isc_result_t
 ldap_entry_getvalues(const ldap_entry_t *entry, const char *attrname,
 		     ldap_valuelist_t *values) ATTR_NONNULLS ATTR_CHECKRESULT;
@@ -105,6 +143,10 @@ isc_result_t
 ldap_entry_nextrdtype(ldap_entry_t *entry, ldap_attribute_t **attrp,
 		      dns_rdatatype_t *rdtype) ATTR_NONNULLS ATTR_CHECKRESULT;
 
+isc_result_t
+ldap_entry_getsoa(ldap_entry_t *entry, const char *fake_mname,
+		  dns_name_t *origin, isc_buffer_t *target) ATTR_NONNULL(1,2,4) ATTR_CHECKRESULT;
+
 isc_result_t
 ldap_entry_getfakesoa(ldap_entry_t *entry, const char *fake_mname,
 		      ld_string_t *target) ATTR_NONNULLS ATTR_CHECKRESULT;
@@ -26,6 +26,9 @@
 
 #include <isc/buffer.h>
 #include <isc/dir.h>
+#include <isc/errno.h>
+#include <isc/file.h>
+#include <isc/ht.h>
 #include <isc/mem.h>
 #include <isc/mutex.h>
 #include <isc/region.h>
@@ -45,20 +48,23 @@
 #include <isccfg/grammar.h>
 
 #include <alloca.h>
+#include <errno.h>
+#include <fcntl.h>
 #define LDAP_DEPRECATED 1
 #include <ldap.h>
 #include <limits.h>
-#include <regex.h>
+#include <poll.h>
 #include <sasl/sasl.h>
-#include <signal.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/socket.h>
 #include <unistd.h>
 #include <netdb.h>
 
 #include "acl.h"
+#include "arena.h"
 #include "empty_zones.h"
 #include "fs.h"
 #include "fwd.h"
@@ -71,6 +77,7 @@
 #include "log.h"
 #include "metadb.h"
 #include "mldap.h"
+#include "rr_template.h"
 #include "semaphore.h"
 #include "settings.h"
 #include "str.h"
@@ -90,6 +97,21 @@
 		}							\
 	} while (0)
 
+/* SyncRepl state files stored in the instance working directory. */
+#define LDAP_SYNC_MLDAP_FILE	"syncrepl-mldap.db"
+#define LDAP_SYNC_COOKIE_FILE	"syncrepl.cookie"
+#define LDAP_SYNC_COOKIE_MAXLEN	4096
+/* How long (in seconds) record shard waits for a zone which is not known yet. */
+#define LDAP_SYNC_ZONE_WAIT	5
+/* Number of entryUUID ranges split between record shards. */
+#define LDAP_SYNC_SHARD_BUCKETS	64
+/* Zone snapshot stored in the zone directory, see warm_start option. */
+#define ZONE_SNAPSHOT_FILE	"snapshot"
+
+#define LDAPDB_EVENT_ZONE_ACTIVATE	(LDAPDB_EVENTCLASS + 6)
+/* Number of activated zones between two progress messages. */
+#define ZONE_ACTIVATE_PROGRESS	1000
+
 /*
  * LDAP related typedefs and structs.
  */
@@ -114,6 +136,9 @@ typedef struct ldap_connection  ldap_connection_t;
 typedef struct ldap_pool	ldap_pool_t;
 typedef struct ldap_auth_pair	ldap_auth_pair_t;
 typedef struct settings		settings_t;
+typedef struct ldap_sync_session ldap_sync_session_t;
+typedef struct zone_activation	zone_activation_t;
+typedef struct zone_activateev	zone_activateev_t;
 
 /* Authentication method. */
 typedef enum ldap_auth {
@@ -128,6 +153,36 @@ struct ldap_auth_pair {
 	char *name;	/* String representation used in configuration file */
 };
 
+/*
+ * State of one SyncRepl session. Session 0 is run by the watcher thread,
+ * sessions 1..N are record shards run by their own threads.
+ * Flags are accessed only from the thread running the session except
+ * stop and abort which are set by other threads before the session
+ * is woken up by ldap_sync_wakeup().
+ */
+struct ldap_sync_session {
+	ldap_instance_t		*inst;
+	unsigned int		shard;		/* index of this session */
+	isc_thread_t		thread;		/* record shards only */
+	isc_boolean_t		stop;		/* shard has to end */
+	isc_boolean_t		abort;		/* session has to end because
+						   some shard failed */
+	isc_mutex_t		lock;		/* guards fd */
+	int			fd;		/* LDAP socket used by running
+						   session or -1 */
+	int			wakeup[2];	/* pipe for ldap_sync_wakeup() */
+	isc_boolean_t		resumed;	/* refresh started from cookie */
+	isc_boolean_t		presents;	/* server used present phase */
+	isc_boolean_t		polling;	/* refreshOnly data session,
+						   with or without cookie;
+						   ends by searchResultDone */
+	isc_boolean_t		refreshed;	/* refresh phase is done */
+	isc_boolean_t		failed;		/* some entry was not processed */
+	isc_ht_t		*zones_missing;	/* zones which did not appear
+						   in ldap_sync_zone_wait(),
+						   record shards only */
+};
+
 /* These are typedefed in ldap_helper.h */
 struct ldap_instance {
 	isc_mem_t		*mctx;
@@ -157,11 +212,33 @@ struct ldap_instance {
 	/* Settings. */
 	settings_set_t		*local_settings;
 	settings_set_t		*global_settings;
-	settings_set_t		empty_fwdz_settings;
+	settings_set_t		*empty_fwdz_settings;
 	settings_set_t		*server_ldap_settings;
 
 	sync_ctx_t		*sctx;
 	mldapdb_t		*mldapdb;
+	/* Lexers and buffers used for parsing of rdata, see parse_rdata(). */
+	ldap_parserpool_t	*parsers;
+	/* Compiled idnsTemplateAttribute values. */
+	rr_templatecache_t	*templates;
+	/* Template entries by substitution variables they use. */
+	rr_templateindex_t	*templateindex;
+
+	/* Zones are restored from snapshots during initial synchronization,
+	 * see ldap_sync_state_load(). Zone tasks read the flag while
+	 * the configuration task can clear it so it is accessed only via
+	 * ldap_warm_start_get() and ldap_warm_start_set(). */
+	isc_boolean_t		warm_start;
+	/* Some zone snapshot could not be loaded and data restored so far
+	 * have to be discarded, see warm_start_discard().
+	 * Used only by inst->task. */
+	isc_boolean_t		warm_start_failed;
+
+	/* SyncRepl data sessions: zones and configuration are synchronized
+	 * by session 0, records are split into sync_shards sessions
+	 * (0 = records are synchronized by session 0). */
+	unsigned int		sync_shards;
+	ldap_sync_session_t	*sync_sessions;
 };
 
 struct ldap_pool {
@@ -195,6 +272,16 @@ const ldap_auth_pair_t supported_ldap_auth[] = {
 
 extern const settings_set_t settings_default_set;
 
+static isc_boolean_t ATTR_NONNULLS ATTR_CHECKRESULT
+ldap_warm_start_get(ldap_instance_t *inst) {
+	return __atomic_load_n(&inst->warm_start, __ATOMIC_ACQUIRE);
+}
+
+static void ATTR_NONNULLS
+ldap_warm_start_set(ldap_instance_t *inst, isc_boolean_t warm_start) {
+	__atomic_store_n(&inst->warm_start, warm_start, __ATOMIC_RELEASE);
+}
+
 /** Local configuration file */
 static const setting_t settings_local_default[] = {
 	{ "uri",			no_default_string	},
@@ -226,6 +313,10 @@ static const setting_t settings_local_default[] = {
 	{ "forward_policy",		no_default_string	},
 	{ "forwarders",			no_default_string	},
 	{ "server_id",			no_default_string	},
+	{ "warm_start",			no_default_boolean	},
+	{ "sync_shards",		no_default_uint		},
+	{ "sync_queue_limit",		no_default_uint		},
+	{ "sync_poll_interval",		no_default_uint		},
 	end_of_settings
 };
 
@@ -254,10 +345,14 @@ dyndb_ldap_conf_clauses[] = {
 	{ "sasl_realm",         &cfg_type_qstring,	0	},
 	{ "sasl_user",          &cfg_type_qstring,	0	},
 	{ "server_id",          &cfg_type_qstring,	0	},
+	{ "sync_poll_interval", &cfg_type_uint32,	0	},
 	{ "sync_ptr",           &cfg_type_boolean,	0	},
+	{ "sync_queue_limit",   &cfg_type_uint32,	0	},
+	{ "sync_shards",        &cfg_type_uint32,	0	},
 	{ "timeout",            &cfg_type_uint32,	0	},
 	{ "uri",                &cfg_type_qstring,	0	},
 	{ "verbose_checks",     &cfg_type_boolean,	0	},
+	{ "warm_start",         &cfg_type_boolean,	0	},
 	{ NULL,			NULL,			0	}
 };
 
@@ -274,7 +369,7 @@ static cfg_type_t cfg_type_dyndb_conf = {
 };
 
 /** Global settings from idnsConfig object. */
-static setting_t settings_global_default[] = {
+static const setting_t settings_global_default[] = {
 	{ "dyn_update",		no_default_boolean					},
 	{ "sync_ptr",		no_default_boolean					},
 	{ "forward_policy",	default_string("first")					},
@@ -283,7 +378,7 @@ static setting_t settings_global_default[] = {
 };
 
 /** Server-specific config from idnsServerConfig object. */
-static setting_t settings_server_ldap_default[] = {
+static const setting_t settings_server_ldap_default[] = {
 	{ "fake_mname",		no_default_string	},
 	{ "forwarders",		no_default_string	},
 	{ "forward_policy",	no_default_string	},
@@ -291,7 +386,7 @@ static setting_t settings_server_ldap_default[] = {
 	end_of_settings
 };
 
-static setting_t settings_fwdz_defaults[] = {
+static const setting_t settings_fwdz_defaults[] = {
 	{ "forward_policy",	no_default_string	},
 	{ "forwarders",		no_default_string	},
 	end_of_settings
@@ -306,14 +401,18 @@ static isc_result_t new_ldap_connection(ldap_pool_t *pool,
 					ldap_connection_t **ldap_connp) ATTR_NONNULLS ATTR_CHECKRESULT;
 static void destroy_ldap_connection(ldap_connection_t **ldap_connp) ATTR_NONNULLS;
 
-static isc_result_t findrdatatype_or_create(isc_mem_t *mctx,
+static isc_result_t findrdatatype_or_create(arena_t *arena,
 		ldapdb_rdatalist_t *rdatalist, dns_rdataclass_t rdclass,
 		dns_rdatatype_t rdtype, dns_ttl_t ttl, dns_rdatalist_t **rdlistp) ATTR_NONNULLS ATTR_CHECKRESULT;
-static isc_result_t add_soa_record(isc_mem_t *mctx, dns_name_t *origin,
+static isc_result_t add_soa_record(isc_mem_t *mctx,
+		ldap_parserpool_t *parsers, arena_t *arena, dns_name_t *origin,
 		ldap_entry_t *entry, dns_ttl_t ttl, ldapdb_rdatalist_t *rdatalist,
 		const char *fake_mname) ATTR_NONNULLS ATTR_CHECKRESULT;
-static isc_result_t parse_rdata(isc_mem_t *mctx, ldap_entry_t *entry,
+static isc_result_t rdata_fromwire_arena(arena_t *arena,
 		dns_rdataclass_t rdclass, dns_rdatatype_t rdtype,
+		isc_buffer_t *wire, dns_rdata_t **rdatap) ATTR_NONNULLS ATTR_CHECKRESULT;
+static isc_result_t parse_rdata(isc_mem_t *mctx, ldap_parserpool_t *parsers,
+		arena_t *arena, dns_rdataclass_t rdclass, dns_rdatatype_t rdtype,
 		dns_name_t *origin, const char *rdata_text,
 		dns_rdata_t **rdatap) ATTR_NONNULLS ATTR_CHECKRESULT;
 static isc_result_t
@@ -323,7 +422,9 @@ ldap_parse_master_zoneentry(ldap_entry_t * const entry, dns_db_t * const olddb,
 			    ATTR_NONNULL(1,3,4) ATTR_CHECKRESULT;
 
 static isc_result_t
-ldap_parse_rrentry(isc_mem_t *mctx, ldap_entry_t *entry, dns_name_t *origin,
+ldap_parse_rrentry(isc_mem_t *mctx, ldap_parserpool_t *parsers,
+		   rr_templatecache_t *templates,
+		   arena_t *arena, ldap_entry_t *entry, dns_name_t *origin,
 		   const settings_set_t * const settings,
 		   ldapdb_rdatalist_t *rdatalist) ATTR_NONNULLS ATTR_CHECKRESULT;
 
@@ -367,15 +468,38 @@ static isc_threadresult_t
 ldap_syncrepl_watcher(isc_threadarg_t arg) ATTR_NONNULLS ATTR_CHECKRESULT;
 
 static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
-zone_master_reconfigure_nsec3param(settings_set_t *zone_settings,
+ldap_sync_session_init(ldap_instance_t *inst, unsigned int shard,
+		       ldap_sync_session_t *sess);
+
+static void ATTR_NONNULLS
+ldap_sync_session_destroy(ldap_sync_session_t *sess);
+
+static void ATTR_NONNULLS
+ldap_sync_wakeup(ldap_sync_session_t *sess);
+
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+ldap_sync_state_save(ldap_instance_t *inst);
+
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+ldap_sync_doit(ldap_instance_t *inst, ldap_sync_session_t *sess,
+	       ldap_connection_t *conn, const char * const filter_objcs,
+	       int mode, isc_boolean_t resume);
+
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+zone_master_reconfigure_nsec3param(ldap_parserpool_t *parsers,
+				   settings_set_t *zone_settings,
 				   dns_zone_t *secure);
 
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+syncrepl_update(ldap_instance_t *inst, ldap_entry_t **entryp, int chgtype);
+
 #define PRINT_BUFF_SIZE 10 /* for unsigned int 2^32 */
 isc_result_t
 validate_local_instance_settings(ldap_instance_t *inst, settings_set_t *set) {
 	isc_result_t result;
 
 	isc_uint32_t uint;
+	isc_uint32_t connections;
 	const char *sasl_mech = NULL;
 	const char *sasl_user = NULL;
 	const char *sasl_realm = NULL;
@@ -429,6 +553,33 @@ validate_local_instance_settings(ldap_instance_t *inst, settings_set_t *set) {
 		/* watcher needs one and update_*() requests second connection */
 		CLEANUP_WITH(ISC_R_RANGE);
 	}
+	connections = uint;
+
+	CHECK(setting_get_uint("sync_shards", set, &uint));
+	if (uint < 1 || uint > SYNC_SHARDS_MAX) {
+		log_error("sync_shards has to be in range 1-%u",
+			  SYNC_SHARDS_MAX);
+		CLEANUP_WITH(ISC_R_RANGE);
+	}
+	/* each record shard needs its own connection */
+	if (uint > 1 && connections < uint + 2) {
+		log_error("sync_shards %u requires at least %u connections",
+			  uint, uint + 2);
+		CLEANUP_WITH(ISC_R_RANGE);
+	}
+
+	CHECK(setting_get_uint("sync_queue_limit", set, &uint));
+	if (uint == 0) {
+		log_error("sync_queue_limit has to be greater than zero");
+		CLEANUP_WITH(ISC_R_RANGE);
+	}
+
+	CHECK(setting_get_uint("sync_poll_interval", set, &uint));
+	if (uint > SYNC_POLL_INTERVAL_MAX) {
+		log_error("sync_poll_interval has to be in range 0-%u",
+			  SYNC_POLL_INTERVAL_MAX);
+		CLEANUP_WITH(ISC_R_RANGE);
+	}
 
 	/* Select authentication method. */
 	CHECK(setting_get_str("auth_method", set, &auth_method_str));
@@ -536,6 +687,9 @@ new_ldap_instance(isc_mem_t *mctx, const char *db_name, const char *parameters,
 	isc_buffer_t *forwarders_list = NULL;
 	const char *forward_policy = NULL;
 	isc_uint32_t connections;
+	isc_uint32_t sync_shards;
+	isc_uint32_t sync_queue_limit;
+	unsigned int i;
 	char settings_name[PRINT_BUFF_SIZE];
 	ldap_globalfwd_handleez_t *gfwdevent = NULL;
 	const char *server_id = NULL;
@@ -640,20 +794,35 @@ new_ldap_instance(isc_mem_t *mctx, const char *db_name, const char *parameters,
 	      sizeof(settings_server_ldap_default), settings_name,
 	      ldap_inst->global_settings, &ldap_inst->server_ldap_settings));
 
-	ldap_inst->empty_fwdz_settings = (settings_set_t) {
-			NULL,
-			"dummy LDAP zone forwarding settings",
-			ldap_inst->server_ldap_settings,
-			NULL,
-			(setting_t *) &settings_fwdz_defaults[0]
-	};
+	CHECK(settings_set_create(mctx, settings_fwdz_defaults,
+	      sizeof(settings_fwdz_defaults),
+	      "dummy LDAP zone forwarding settings",
+	      ldap_inst->server_ldap_settings,
+	      &ldap_inst->empty_fwdz_settings));
 
 	CHECK(setting_get_uint("connections", ldap_inst->local_settings, &connections));
+	CHECK(setting_get_uint("sync_shards", ldap_inst->local_settings,
+			       &sync_shards));
+	ldap_inst->sync_shards = (sync_shards > 1) ? sync_shards : 0;
+	CHECKED_MEM_GET(mctx, ldap_inst->sync_sessions,
+			(ldap_inst->sync_shards + 1)
+			* sizeof(*ldap_inst->sync_sessions));
+	memset(ldap_inst->sync_sessions, 0,
+	       (ldap_inst->sync_shards + 1) * sizeof(*ldap_inst->sync_sessions));
+	for (i = 0; i <= ldap_inst->sync_shards; i++)
+		CHECK(ldap_sync_session_init(ldap_inst, i,
+					     &ldap_inst->sync_sessions[i]));
+	CHECK(setting_get_uint("sync_queue_limit", ldap_inst->local_settings,
+			       &sync_queue_limit));
+	sync_concurr_limit_set(ldap_inst->sctx, sync_queue_limit);
 
 	CHECK(zr_create(mctx, ldap_inst, ldap_inst->server_ldap_settings,
 			&ldap_inst->zone_register));
 	CHECK(fwdr_create(ldap_inst->mctx, &ldap_inst->fwd_register));
 	CHECK(mldap_new(mctx, &ldap_inst->mldapdb));
+	CHECK(ldap_parserpool_create(mctx, &ldap_inst->parsers));
+	CHECK(rr_templatecache_create(mctx, &ldap_inst->templates));
+	CHECK(rr_templateindex_create(mctx, &ldap_inst->templateindex));
 
 	CHECK(isc_mutex_init(&ldap_inst->kinit_lock));
 
@@ -688,6 +857,7 @@ void
 destroy_ldap_instance(ldap_instance_t **ldap_instp)
 {
 	ldap_instance_t *ldap_inst;
+	unsigned int i;
 
 	REQUIRE(ldap_instp != NULL);
 
@@ -697,24 +867,27 @@ destroy_ldap_instance(ldap_instance_t **ldap_instp)
 
 	if (ldap_inst->watcher != 0) {
 		ldap_inst->exiting = ISC_TRUE;
-		/*
-		 * Wake up the watcher thread. This might look like a hack
-		 * but isc_thread_t is actually pthread_t and libisc don't
-		 * have any isc_thread_kill() func.
-		 *
-		 * We use SIGUSR1 to not to interfere with any signal
-		 * used by BIND itself.
-		 */
-		REQUIRE(pthread_kill(ldap_inst->watcher, SIGUSR1) == 0);
+		/* Wake up the watcher thread and everything waiting
+		 * for syncrepl events. The watcher stops record shards. */
+		ldap_sync_wakeup(&ldap_inst->sync_sessions[0]);
+		sync_ctx_wakeup(ldap_inst->sctx);
 		RUNTIME_CHECK(isc_thread_join(ldap_inst->watcher, NULL)
 			      == ISC_R_SUCCESS);
 		ldap_inst->watcher = 0;
+
+		/* Watcher is gone so metaLDAP cannot change anymore. */
+		if (ldap_sync_state_save(ldap_inst) != ISC_R_SUCCESS)
+			log_error("unable to save SyncRepl state for "
+				  "instance '%s'", ldap_inst->db_name);
 	}
 
 	/* Unregister all zones already registered in BIND. */
 	zr_destroy(&ldap_inst->zone_register);
 	fwdr_destroy(&ldap_inst->fwd_register);
 	mldap_destroy(&ldap_inst->mldapdb);
+	ldap_parserpool_destroy(&ldap_inst->parsers);
+	rr_templatecache_destroy(&ldap_inst->templates);
+	rr_templateindex_destroy(&ldap_inst->templateindex);
 
 	ldap_pool_destroy(&ldap_inst->pool);
 	if (ldap_inst->db_imp != NULL)
@@ -730,9 +903,17 @@ destroy_ldap_instance(ldap_instance_t **ldap_instp)
 
 	settings_set_free(&ldap_inst->global_settings);
 	settings_set_free(&ldap_inst->local_settings);
+	settings_set_free(&ldap_inst->empty_fwdz_settings);
 	settings_set_free(&ldap_inst->server_ldap_settings);
 
 	sync_ctx_free(&ldap_inst->sctx);
+	for (i = 0;
+	     ldap_inst->sync_sessions != NULL && i <= ldap_inst->sync_shards;
+	     i++)
+		ldap_sync_session_destroy(&ldap_inst->sync_sessions[i]);
+	SAFE_MEM_PUT(ldap_inst->mctx, ldap_inst->sync_sessions,
+		     (ldap_inst->sync_shards + 1)
+		     * sizeof(*ldap_inst->sync_sessions));
 	/* zero out error counter (and do nothing other than that) */
 	ldap_instance_untaint_finish(ldap_inst,
 				     ldap_instance_untaint_start(ldap_inst));
@@ -841,7 +1022,33 @@ cleanup:
 }
 
 /**
- * Remove zone files and journal files associated with all zones in ZR.
+ * Remove files with signed zone and its journal so state of inline-signing
+ * is not re-used if the zone is deleted or its security status changes.
+ */
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+cleanup_signed_files(ldap_instance_t *inst, dns_name_t *name) {
+	isc_result_t result;
+	dns_zone_t *raw = NULL;
+	dns_zone_t *secure = NULL;
+
+	CHECK(zr_get_zone_ptr(inst->zone_register, name, &raw, &secure));
+	if (secure != NULL)
+		CHECK(cleanup_zone_files(secure));
+
+cleanup:
+	if (raw != NULL)
+		dns_zone_detach(&raw);
+	if (secure != NULL)
+		dns_zone_detach(&secure);
+	if (result == ISC_R_NOTFOUND || result == DNS_R_PARTIALMATCH)
+		result = ISC_R_SUCCESS;
+	return result;
+}
+
+/**
+ * Remove raw zone files and journal files associated with all zones in ZR.
+ * Signed zones and their journals are kept so inline-signing can continue
+ * from the previous state, see configure_paths().
  */
 static isc_result_t ATTR_CHECKRESULT
 cleanup_files(ldap_instance_t *inst) {
@@ -857,10 +1064,8 @@ cleanup_files(ldap_instance_t *inst) {
 		CHECK(zr_get_zone_ptr(inst->zone_register, &name, &raw, &secure));
 		cleanup_zone_files(raw);
 		dns_zone_detach(&raw);
-		if (secure != NULL) {
-			cleanup_zone_files(secure);
+		if (secure != NULL)
 			dns_zone_detach(&secure);
-		}
 
 		INIT_BUFFERED_NAME(name);
 		CHECK(rbt_iter_next(&iter, &name));
@@ -908,6 +1113,16 @@ cleanup:
 	return result;
 }
 
+/**
+ * Configure paths to zone file, journal and DNSSEC keys.
+ *
+ * Raw zone data are always loaded from LDAP so stale raw zone files
+ * are removed. Signed zone file and its journal are kept: BIND loads
+ * the previous signed zone and synchronizes it with raw zone data
+ * so only changed names are re-signed after restart.
+ * Signed zone is stored in raw format which carries serial of the raw
+ * zone it was signed from.
+ */
 static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
 configure_paths(isc_mem_t *mctx, ldap_instance_t *inst, dns_zone_t *zone,
 		isc_boolean_t issecure) {
@@ -918,16 +1133,19 @@ configure_paths(isc_mem_t *mctx, ldap_instance_t *inst, dns_zone_t *zone,
 	CHECK(zr_get_zone_path(mctx, ldap_instance_getsettings_local(inst),
 			       dns_zone_getorigin(zone),
 			       (issecure ? "signed" : "raw"), &file_name));
-	CHECK(dns_zone_setfile(zone, str_buf(file_name)));
 	if (issecure == ISC_TRUE) {
+		CHECK(dns_zone_setfile2(zone, str_buf(file_name),
+					dns_masterformat_raw));
 		CHECK(zr_get_zone_path(mctx,
 				       ldap_instance_getsettings_local(inst),
 				       dns_zone_getorigin(zone), "keys/",
 				       &key_dir));
 		dns_zone_setkeydirectory(zone, str_buf(key_dir));
+	} else {
+		CHECK(dns_zone_setfile(zone, str_buf(file_name)));
+		CHECK(fs_file_remove(dns_zone_getfile(zone)));
+		CHECK(fs_file_remove(dns_zone_getjournal(zone)));
 	}
-	CHECK(fs_file_remove(dns_zone_getfile(zone)));
-	CHECK(fs_file_remove(dns_zone_getjournal(zone)));
 
 cleanup:
 	str_destroy(&file_name);
@@ -935,6 +1153,80 @@ cleanup:
 	return result;
 }
 
+/**
+ * Write content of zone database into snapshot file in raw master format.
+ */
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+zone_snapshot_save(ldap_instance_t *inst, dns_name_t *name) {
+	isc_result_t result;
+	ld_string_t *file_name = NULL;
+	dns_db_t *rbtdb = NULL;
+	char zone_name[DNS_NAME_FORMATSIZE];
+
+	CHECK(zr_get_zone_path(inst->mctx, inst->local_settings, name,
+			       ZONE_SNAPSHOT_FILE, &file_name));
+	CHECK(zr_get_zone_dbs(inst->zone_register, name, NULL, &rbtdb));
+	CHECK(dns_db_dump2(rbtdb, NULL, str_buf(file_name),
+			   dns_masterformat_raw));
+
+cleanup:
+	if (result != ISC_R_SUCCESS) {
+		dns_name_format(name, zone_name, DNS_NAME_FORMATSIZE);
+		log_error_r("unable to save snapshot of zone '%s'", zone_name);
+	}
+	if (rbtdb != NULL)
+		dns_db_detach(&rbtdb);
+	str_destroy(&file_name);
+	return result;
+}
+
+/**
+ * Save snapshots of all master zones in zone register.
+ */
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+zone_snapshots_save(ldap_instance_t *inst) {
+	isc_result_t result;
+	rbt_iterator_t *iter = NULL;
+	DECLARE_BUFFERED_NAME(name);
+
+	INIT_BUFFERED_NAME(name);
+	for (result = zr_rbt_iter_init(inst->zone_register, &iter, &name);
+	     result == ISC_R_SUCCESS;
+	     dns_name_reset(&name), result = rbt_iter_next(&iter, &name))
+		CHECK(zone_snapshot_save(inst, &name));
+
+cleanup:
+	rbt_iter_stop(&iter);
+	if (result == ISC_R_NOTFOUND || result == ISC_R_NOMORE)
+		result = ISC_R_SUCCESS;
+	return result;
+}
+
+/**
+ * Fill database of newly created zone with data from zone snapshot.
+ *
+ * @pre Database is empty.
+ *
+ * @retval ISC_R_FILENOTFOUND Snapshot does not exist.
+ */
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+zone_snapshot_load(ldap_instance_t *inst, dns_name_t *name) {
+	isc_result_t result;
+	ld_string_t *file_name = NULL;
+	dns_db_t *rbtdb = NULL;
+
+	CHECK(zr_get_zone_path(inst->mctx, inst->local_settings, name,
+			       ZONE_SNAPSHOT_FILE, &file_name));
+	CHECK(zr_get_zone_dbs(inst->zone_register, name, NULL, &rbtdb));
+	CHECK(dns_db_load2(rbtdb, str_buf(file_name), dns_masterformat_raw));
+
+cleanup:
+	if (rbtdb != NULL)
+		dns_db_detach(&rbtdb);
+	str_destroy(&file_name);
+	return result;
+}
+
 /*
  * Create a new zone with origin 'name'. The zone will be added to the
  * ldap_inst->view.
@@ -952,6 +1244,7 @@ create_zone(ldap_instance_t * const inst, const char * const dn,
 	const char *rbt_argv[1] = { "rbt" };
 	sync_state_t sync_state;
 	isc_task_t *task = NULL;
+	isc_boolean_t fullsign;
 	char zone_name[DNS_NAME_FORMATSIZE];
 
 	REQUIRE(inst != NULL);
@@ -983,9 +1276,12 @@ create_zone(ldap_instance_t * const inst, const char * const dn,
 		CHECK(dns_zone_setdbtype(secure, 1, rbt_argv));
 		CHECK(dns_zonemgr_managezone(inst->zmgr, secure));
 		CHECK(dns_zone_link(secure, raw));
-		dns_zone_rekey(secure, ISC_TRUE);
 		CHECK(configure_paths(inst->mctx, inst, secure, ISC_TRUE));
-		CHECK(cleanup_zone_files(secure));
+		CHECK(cleanup_zone_files(raw));
+		/* Full signing is necessary only if there is no signed zone
+		 * from previous run. */
+		fullsign = ISC_TF(!isc_file_exists(dns_zone_getfile(secure)));
+		dns_zone_rekey(secure, fullsign);
 	}
 
 	sync_state_get(inst->sctx, &sync_state);
@@ -1136,23 +1432,160 @@ cleanup:
 }
 
 /**
- * Add zone to view and call dns_zone_load().
+ * Shared state of one activate_zones() or activate_zones_warm() run.
+ * Zones are published serially from inst->task but loaded in parallel
+ * on their own tasks. The last finished zone reports the result.
  */
-static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
-activate_zone(isc_task_t *task, ldap_instance_t *inst, dns_name_t *name) {
+struct zone_activation {
+	isc_mem_t		*mctx;
+	ldap_instance_t		*inst;
+	isc_mutex_t		lock;
+	isc_boolean_t		warm;
+	/* Unprocessed load events + 1 for activate_zones_start(). */
+	unsigned int		pending;
+	unsigned int		total_cnt;
+	unsigned int		active_cnt;
+	unsigned int		loaded_cnt;
+	unsigned int		done_cnt;
+};
+
+/**
+ * Event for asynchronous zone loading, see activate_zone_load().
+ */
+struct zone_activateev {
+	ISC_EVENT_COMMON(zone_activateev_t);
+	zone_activation_t	*za;
+	dns_zone_t		*raw;
+	dns_zone_t		*secure;
+	DECLARE_BUFFERED_NAME(name);
+};
+
+/**
+ * Report the result of zone activation and free the shared state.
+ *
+ * @pre No load event is pending.
+ */
+static void ATTR_NONNULLS
+activate_zones_finish(zone_activation_t **zap) {
+	zone_activation_t *za = *zap;
+	ldap_instance_t *inst = za->inst;
+
+	if (za->warm == ISC_TRUE) {
+		log_info("%u master zones from LDAP instance '%s' restored "
+			 "from snapshots, LDAP data are being synchronized",
+			 za->loaded_cnt, inst->db_name);
+	} else {
+		log_info("%u master zones from LDAP instance '%s' loaded "
+			 "(%u zones defined, %u inactive, %u failed to load)",
+			 za->loaded_cnt, inst->db_name, za->total_cnt,
+			 za->total_cnt - za->active_cnt,
+			 za->active_cnt - za->loaded_cnt);
+		if (za->total_cnt < 1)
+			log_info("0 master zones is suspicious number, please "
+				 "check access control instructions on LDAP "
+				 "server");
+	}
+
+	DESTROYLOCK(&za->lock);
+	MEM_PUT_AND_DETACH(za);
+	*zap = NULL;
+}
+
+/**
+ * Account one finished zone and release one pending reference.
+ * The whole activation is finished when the last reference is released.
+ *
+ * @param[in] counted Zone was already accounted and only the reference
+ *                    is released.
+ */
+static void ATTR_NONNULLS
+activate_zones_done(zone_activation_t *za, isc_boolean_t counted,
+		    isc_boolean_t loaded) {
+	isc_boolean_t last;
+
+	LOCK(&za->lock);
+	if (counted == ISC_FALSE) {
+		if (loaded == ISC_TRUE)
+			za->loaded_cnt++;
+		za->done_cnt++;
+		if (za->done_cnt % ZONE_ACTIVATE_PROGRESS == 0)
+			log_info("%u of %u master zones from LDAP instance "
+				 "'%s' processed", za->done_cnt,
+				 za->active_cnt, za->inst->db_name);
+	}
+	INSIST(za->pending > 0);
+	last = ISC_TF(--za->pending == 0);
+	UNLOCK(&za->lock);
+
+	if (last == ISC_TRUE)
+		activate_zones_finish(&za);
+}
+
+/**
+ * Load zone published by activate_zone(). This runs on the task
+ * of the raw zone so zones are loaded in parallel and changes from LDAP
+ * received later are always processed after the load.
+ */
+static void
+activate_zone_load(isc_task_t *task, isc_event_t *event) {
+	zone_activateev_t *zev = (zone_activateev_t *)event;
+	zone_activation_t *za = zev->za;
+	ldap_instance_t *inst = za->inst;
 	isc_result_t result;
-	dns_zone_t *raw = NULL;
-	dns_zone_t *secure = NULL;
-	dns_zone_t *toview = NULL;
+	dns_zone_t *toview;
 	settings_set_t *zone_settings = NULL;
 
-	CHECK(zr_get_zone_ptr(inst->zone_register, name, &raw, &secure));
+	UNUSED(task);
 
 	/* Load only "secure" zone if inline-signing is active.
 	 * It will not work if raw zone is loaded explicitly
 	 * - dns_zone_load() will fail magically. */
+	toview = (zev->secure != NULL) ? zev->secure : zev->raw;
+
+	CHECK(load_zone(toview, ISC_TRUE));
+	if (zev->secure != NULL) {
+		CHECK(zr_get_zone_settings(inst->zone_register, &zev->name,
+					   &zone_settings));
+		CHECK(zone_master_reconfigure_nsec3param(inst->parsers,
+							 zone_settings,
+							 zev->secure));
+	}
+
+cleanup:
+	if (result != ISC_R_SUCCESS)
+		dns_zone_log(toview, ISC_LOG_ERROR, "unable to load zone: %s",
+			     dns_result_totext(result));
+	dns_zone_detach(&zev->raw);
+	if (zev->secure != NULL)
+		dns_zone_detach(&zev->secure);
+	isc_event_free(&event);
+	activate_zones_done(za, ISC_FALSE, ISC_TF(result == ISC_R_SUCCESS));
+}
+
+/**
+ * Add zone to view and prepare event which will load it,
+ * see activate_zone_load().
+ */
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+activate_zone(isc_task_t *task, zone_activation_t *za, dns_name_t *name,
+	      zone_activateev_t **zevp) {
+	isc_result_t result;
+	ldap_instance_t *inst = za->inst;
+	dns_zone_t *raw = NULL;
+	dns_zone_t *secure = NULL;
+	dns_zone_t *toview = NULL;
+	dns_db_t *ldapdb = NULL;
+	zone_activateev_t *zev = NULL;
+
+	REQUIRE(zevp != NULL && *zevp == NULL);
+
+	CHECK(zr_get_zone_ptr(inst->zone_register, name, &raw, &secure));
 	toview = (secure != NULL) ? secure : raw;
 
+	/* Records from initial refresh are all in, see update_record(). */
+	CHECK(zr_get_zone_dbs(inst->zone_register, name, &ldapdb, NULL));
+	ldapdb_bulkload_end(ldapdb);
+
 	/*
 	 * Zone has to be published *before* zone load
 	 * otherwise it will race with zone->view != NULL check
@@ -1166,15 +1599,28 @@ activate_zone(isc_task_t *task, ldap_instance_t *inst, dns_name_t *name) {
 		goto cleanup;
 	}
 
-	CHECK(load_zone(toview, ISC_TRUE));
-	if (secure != NULL) {
-		CHECK(zr_get_zone_settings(inst->zone_register, name,
-					   &zone_settings));
-		CHECK(zone_master_reconfigure_nsec3param(zone_settings,
-							 secure));
+	zev = (zone_activateev_t *)isc_event_allocate(za->mctx, za,
+						LDAPDB_EVENT_ZONE_ACTIVATE,
+						activate_zone_load, NULL,
+						sizeof(zone_activateev_t));
+	if (zev == NULL)
+		CLEANUP_WITH(ISC_R_NOMEMORY);
+
+	INIT_BUFFERED_NAME(zev->name);
+	result = dns_name_copy(name, &zev->name, NULL);
+	if (result != ISC_R_SUCCESS) {
+		isc_event_free((isc_event_t **)&zev);
+		goto cleanup;
 	}
+	zev->za = za;
+	zev->raw = raw;
+	zev->secure = secure;
+	raw = secure = NULL;
+	*zevp = zev;
 
 cleanup:
+	if (ldapdb != NULL)
+		dns_db_detach(&ldapdb);
 	if (raw != NULL)
 		dns_zone_detach(&raw);
 	if (secure != NULL)
@@ -1183,20 +1629,45 @@ cleanup:
 }
 
 /**
- * Add all active zones in zone register to DNS view specified in inst->view
- * and load zones.
+ * Publish all active zones in zone register in DNS view specified
+ * in inst->view and send events which load them on their own tasks.
+ *
+ * Publishing needs task-exclusive mode so all zones are published
+ * in one exclusive section. Zone loading does not need it and
+ * is the expensive part so it is done in parallel.
+ * The result is logged when the last zone is loaded.
+ *
+ * @param[in] warm Activate only zones restored from snapshots.
  */
-isc_result_t
-activate_zones(isc_task_t *task, ldap_instance_t *inst) {
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+activate_zones_start(isc_task_t *task, ldap_instance_t *inst,
+		     isc_boolean_t warm) {
 	isc_result_t result;
+	isc_result_t lock_state = ISC_R_IGNORE;
 	rbt_iterator_t *iter = NULL;
 	DECLARE_BUFFERED_NAME(name);
-	unsigned int published_cnt = 0;
-	unsigned int total_cnt = 0;
-	unsigned int active_cnt = 0;
+	zone_activation_t *za = NULL;
+	zone_activateev_t *zev = NULL;
+	isc_eventlist_t events;
+	isc_event_t *ev = NULL;
+	isc_task_t *zone_task = NULL;
 	settings_set_t *settings;
 	isc_boolean_t active;
 
+	ISC_LIST_INIT(events);
+	CHECKED_MEM_GET_PTR(inst->mctx, za);
+	ZERO_PTR(za);
+	result = isc_mutex_init(&za->lock);
+	if (result != ISC_R_SUCCESS) {
+		SAFE_MEM_PUT_PTR(inst->mctx, za);
+		goto cleanup;
+	}
+	isc_mem_attach(inst->mctx, &za->mctx);
+	za->inst = inst;
+	za->warm = warm;
+	za->pending = 1;
+
+	run_exclusive_enter(inst, &lock_state);
 	INIT_BUFFERED_NAME(name);
 	for(result = zr_rbt_iter_init(inst->zone_register, &iter, &name);
 	    result == ISC_R_SUCCESS;
@@ -1207,29 +1678,109 @@ activate_zones(isc_task_t *task, ldap_instance_t *inst) {
 		result = setting_get_bool("active", settings, &active);
 		INSIST(result == ISC_R_SUCCESS);
 
-		++total_cnt;
-		if (active == ISC_TRUE) {
-			++active_cnt;
-			result = activate_zone(task, inst, &name);
-			if (result == ISC_R_SUCCESS)
-				++published_cnt;
-			result = fwd_configure_zone(settings, inst, &name);
-			if (result != ISC_R_SUCCESS)
-				log_error_r("could not configure forwarding");
+		++za->total_cnt;
+		if (active == ISC_FALSE)
+			continue;
 
+		++za->active_cnt;
+		zev = NULL;
+		if (activate_zone(task, za, &name, &zev) == ISC_R_SUCCESS) {
+			ISC_LIST_APPEND(events, (isc_event_t *)zev, ev_link);
+			++za->pending;
+		} else {
+			++za->done_cnt;
 		}
+		if (warm == ISC_TRUE)
+			continue;
+		result = fwd_configure_zone(settings, inst, &name);
+		if (result != ISC_R_SUCCESS)
+			log_error_r("could not configure forwarding");
 	};
+	run_exclusive_exit(inst, lock_state);
+	if (result == ISC_R_NOMORE || result == ISC_R_NOTFOUND)
+		result = ISC_R_SUCCESS;
+
+	while ((ev = HEAD(events)) != NULL) {
+		ISC_LIST_UNLINK(events, ev, ev_link);
+		zev = (zone_activateev_t *)ev;
+		dns_zone_gettask(zev->raw, &zone_task);
+		isc_task_send(zone_task, &ev);
+		isc_task_detach(&zone_task);
+	}
+	/* Release reference held while events were being sent. */
+	activate_zones_done(za, ISC_TRUE, ISC_FALSE);
 
-	log_info("%u master zones from LDAP instance '%s' loaded (%u zones "
-		 "defined, %u inactive, %u failed to load)", published_cnt,
-		 inst->db_name, total_cnt, total_cnt - active_cnt,
-		 active_cnt - published_cnt);
-	if (total_cnt < 1)
-		log_info("0 master zones is suspicious number, please check "
-			 "access control instructions on LDAP server");
+cleanup:
 	return result;
 }
 
+/**
+ * Add all active zones in zone register to DNS view specified in inst->view
+ * and load zones.
+ */
+isc_result_t
+activate_zones(isc_task_t *task, ldap_instance_t *inst) {
+	return activate_zones_start(task, inst, ISC_FALSE);
+}
+
+/**
+ * Publish and load zones restored from snapshots so they can answer queries
+ * while LDAP data are being synchronized. Does nothing if warm start
+ * is not in progress.
+ *
+ * All zones are activated again by activate_zones() when initial
+ * synchronization is finished.
+ */
+isc_result_t
+activate_zones_warm(isc_task_t *task, ldap_instance_t *inst) {
+	if (ldap_warm_start_get(inst) == ISC_FALSE)
+		return ISC_R_SUCCESS;
+
+	return activate_zones_start(task, inst, ISC_TRUE);
+}
+
+/**
+ * Discard zones and metaLDAP restored by warm start if some zone snapshot
+ * could not be loaded. Restored data would not match the full refresh
+ * which replaces warm start, e.g. entries deleted while named was not
+ * running would never be removed. Zones are created again by the data
+ * synchronization. Does nothing if warm start did not fail.
+ *
+ * It has to be called from inst->task at the end of configuration
+ * synchronization when no other thread uses metaLDAP.
+ */
+void
+warm_start_discard(isc_task_t *task, ldap_instance_t *inst) {
+	isc_result_t result;
+	rbt_iterator_t *iter = NULL;
+	DECLARE_BUFFERED_NAME(name);
+
+	REQUIRE(task == inst->task);
+
+	if (inst->warm_start_failed == ISC_FALSE)
+		return;
+
+	log_info("LDAP instance '%s': discarding data restored by warm start",
+		 inst->db_name);
+	INIT_BUFFERED_NAME(name);
+	/* Deleting zones would invalidate the iterator. */
+	while ((result = zr_rbt_iter_init(inst->zone_register, &iter, &name))
+	       == ISC_R_SUCCESS) {
+		rbt_iter_stop(&iter);
+		CHECK(ldap_delete_zone2(inst, &name, ISC_TRUE));
+		dns_name_reset(&name);
+	}
+	if (result != ISC_R_NOTFOUND && result != ISC_R_NOMORE)
+		goto cleanup;
+	CHECK(mldap_reset(inst->mldapdb));
+	inst->warm_start_failed = ISC_FALSE;
+
+cleanup:
+	if (result != ISC_R_SUCCESS)
+		log_error_r("LDAP instance '%s': unable to discard data "
+			    "restored by warm start", inst->db_name);
+}
+
 
 static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
 configure_zone_acl(isc_mem_t *mctx, dns_zone_t *zone,
@@ -1332,7 +1883,7 @@ ldap_delete_zone2(ldap_instance_t *inst, dns_name_t *name, isc_boolean_t lock)
 		run_exclusive_enter(inst, &lock_state);
 
 	/* simulate no explicit forwarding configuration */
-	CHECK(fwd_configure_zone(&inst->empty_fwdz_settings, inst, name));
+	CHECK(fwd_configure_zone(inst->empty_fwdz_settings, inst, name));
 	isforward = fwdr_zone_ispresent(inst->fwd_register, name);
 	if (isforward == ISC_R_SUCCESS)
 		CHECK(fwdr_del_zone(inst->fwd_register, name));
@@ -1403,7 +1954,7 @@ unpublish_zone(ldap_instance_t *inst, dns_name_t *name, const char *logname) {
 	CHECK(dns_view_findzone(inst->view, name, &zone_in_view));
 	INSIST(zone_in_view == raw || zone_in_view == secure);
 	/* simulate no explicit forwarding configuration */
-	CHECK(fwd_configure_zone(&inst->empty_fwdz_settings, inst, name));
+	CHECK(fwd_configure_zone(inst->empty_fwdz_settings, inst, name));
 	CHECK(dns_zt_unmount(inst->view->zonetable, zone_in_view));
 
 cleanup:
@@ -1459,13 +2010,80 @@ cleanup:
 	return ISC_R_SUCCESS;
 }
 
-/* Parse the idnsServerConfig object entry */
+/**
+ * Render records from all template entries which use given substitution
+ * variable again. Refresh requests go through the same per-zone queues
+ * and batches as changes from LDAP, see update_record_diff().
+ *
+ * Failure to queue one entry does not stop the refresh of other entries.
+ * Each failure is logged, records can be refreshed by `rndc reload`.
+ *
+ * @retval ISC_R_SUCCESS All entries were queued for refresh.
+ * @retval others        The first error.
+ */
 static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
-ldap_parse_serverconfigentry(ldap_entry_t *entry, ldap_instance_t *inst)
+ldap_templates_refresh(ldap_instance_t *inst, const char *variable)
 {
 	isc_result_t result;
-
-	/* BIND functions are thread safe, ldap instance 'inst' is locked
+	isc_result_t first = ISC_R_SUCCESS;
+	ldap_entrylist_t refreshes;
+	ldap_entry_t *refresh;
+	ld_string_t *logname = NULL;
+	unsigned int count = 0;
+
+	INIT_LIST(refreshes);
+	result = rr_templateindex_refresh(inst->templateindex, variable,
+					  &refreshes);
+	if (result != ISC_R_SUCCESS) {
+		log_error_r("unable to find templates using variable '%s', "
+			    "run `rndc reload`", variable);
+		goto cleanup;
+	}
+	CHECK(str_new(inst->mctx, &logname));
+
+	while ((refresh = HEAD(refreshes)) != NULL) {
+		UNLINK(refreshes, refresh, link);
+		/* entry is gone when syncrepl_update() fails */
+		str_clear(logname);
+		result = str_cat_char(logname, ldap_entry_logname(refresh));
+		/* refresh is destroyed by event handler on success,
+		 * refresh requests do not wait for space in the queue
+		 * so they cannot block this task */
+		if (result == ISC_R_SUCCESS)
+			result = syncrepl_update(inst, &refresh,
+						 LDAP_SYNC_CAPI_MODIFY);
+		if (result == ISC_R_SUCCESS) {
+			count++;
+		} else {
+			log_error_r("unable to refresh records of %s "
+				    "after change of variable '%s', "
+				    "run `rndc reload`",
+				    str_buf(logname), variable);
+			if (first == ISC_R_SUCCESS)
+				first = result;
+		}
+		ldap_entry_destroy(&refresh);
+	}
+	log_debug(2, "variable '%s' changed: %u template entries queued "
+		  "for refresh", variable, count);
+	result = first;
+
+cleanup:
+	while ((refresh = HEAD(refreshes)) != NULL) {
+		UNLINK(refreshes, refresh, link);
+		ldap_entry_destroy(&refresh);
+	}
+	str_destroy(&logname);
+	return result;
+}
+
+/* Parse the idnsServerConfig object entry */
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+ldap_parse_serverconfigentry(ldap_entry_t *entry, ldap_instance_t *inst)
+{
+	isc_result_t result;
+
+	/* BIND functions are thread safe, ldap instance 'inst' is locked
 	 * inside setting* functions. */
 
 	log_debug(3, "Parsing server configuration object");
@@ -1487,7 +2105,10 @@ ldap_parse_serverconfigentry(ldap_entry_t *entry, ldap_instance_t *inst)
 						inst->server_ldap_settings,
 						"idnsSubstitutionVariable;ipalocation",
 						entry);
-	if (result != ISC_R_SUCCESS && result != ISC_R_IGNORE)
+	if (result == ISC_R_SUCCESS)
+		CHECK(ldap_templates_refresh(inst,
+					     "substitutionvariable_ipalocation"));
+	else if (result != ISC_R_IGNORE)
 		goto cleanup;
 
 cleanup:
@@ -1705,7 +2326,8 @@ cleanup:
 }
 
 static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
-zone_master_reconfigure_nsec3param(settings_set_t *zone_settings,
+zone_master_reconfigure_nsec3param(ldap_parserpool_t *parsers,
+				   settings_set_t *zone_settings,
 				   dns_zone_t *secure) {
 	isc_mem_t *mctx = NULL;
 	isc_result_t result;
@@ -1713,18 +2335,18 @@ zone_master_reconfigure_nsec3param(settings_set_t *zone_settings,
 	dns_rdata_nsec3param_t nsec3p_rr;
 	dns_name_t *origin = NULL;
 	const char *nsec3p_str = NULL;
-	ldap_entry_t *fake_entry = NULL;
+	arena_t *arena = NULL;
 
 	REQUIRE(secure != NULL);
 
 	mctx = dns_zone_getmctx(secure);
 	origin = dns_zone_getorigin(secure);
-	CHECK(ldap_entry_init(mctx, &fake_entry));
+	CHECK(arena_create(mctx, &arena));
 
 	CHECK(setting_get_str("nsec3param", zone_settings, &nsec3p_str));
 	dns_zone_log(secure, ISC_LOG_INFO,
 		     "reconfiguring NSEC3PARAM to '%s'", nsec3p_str);
-	CHECK(parse_rdata(mctx, fake_entry, dns_rdataclass_in,
+	CHECK(parse_rdata(mctx, parsers, arena, dns_rdataclass_in,
 			  dns_rdatatype_nsec3param, origin, nsec3p_str,
 			  &nsec3p_rdata));
 	CHECK(dns_rdata_tostruct(nsec3p_rdata, &nsec3p_rr, NULL));
@@ -1734,12 +2356,7 @@ zone_master_reconfigure_nsec3param(settings_set_t *zone_settings,
 				     ISC_TRUE));
 
 cleanup:
-	if (nsec3p_rdata != NULL) {
-		isc_mem_put(mctx, nsec3p_rdata->data, nsec3p_rdata->length);
-		SAFE_MEM_PUT_PTR(mctx, nsec3p_rdata);
-	}
-	if (fake_entry != NULL)
-		ldap_entry_destroy(&fake_entry);
+	arena_destroy(&arena);
 	return result;
 }
 
@@ -1749,9 +2366,10 @@ cleanup:
  * @param[in]  raw Raw zone backed by LDAP database. In-line secure zone
  *                 will be reconfigured as necessary.
  */
-static isc_result_t ATTR_NONNULL(1,2,3,5) ATTR_CHECKRESULT
+static isc_result_t ATTR_NONNULL(1,2,3,5,6) ATTR_CHECKRESULT
 zone_master_reconfigure(ldap_entry_t *entry, settings_set_t *zone_settings,
-			dns_zone_t *raw, dns_zone_t *secure, isc_task_t *task) {
+			dns_zone_t *raw, dns_zone_t *secure, isc_task_t *task,
+			ldap_parserpool_t *parsers) {
 	isc_result_t result;
 	ldap_valuelist_t values;
 	isc_mem_t *mctx = NULL;
@@ -1873,7 +2491,8 @@ zone_master_reconfigure(ldap_entry_t *entry, settings_set_t *zone_settings,
 							"nsec3paramRecord",
 							entry);
 		if (result == ISC_R_SUCCESS)
-			CHECK(zone_master_reconfigure_nsec3param(zone_settings,
+			CHECK(zone_master_reconfigure_nsec3param(parsers,
+								 zone_settings,
 								 secure));
 		else if (result == ISC_R_IGNORE)
 			result = ISC_R_SUCCESS;
@@ -1924,14 +2543,17 @@ zone_sync_apex(const ldap_instance_t * const inst,
 	dns_dbnode_t *node = NULL;
 	dns_difftuple_t *soa_tuple = NULL;
 	isc_uint32_t curr_serial;
+	arena_t *arena = NULL;
 
 	REQUIRE(ldap_writeback != NULL);
 
 	INIT_LIST(rdatalist);
 	*ldap_writeback = ISC_FALSE; /* GCC */
 
-	CHECK(ldap_parse_rrentry(inst->mctx, entry, &name,
-				 zone_settings, &rdatalist));
+	CHECK(arena_create(inst->mctx, &arena));
+	CHECK(ldap_parse_rrentry(inst->mctx, inst->parsers, inst->templates,
+				 arena, entry, &name, zone_settings,
+				 &rdatalist));
 
 	CHECK(dns_db_getoriginnode(rbtdb, &node));
 	result = dns_db_allrdatasets(rbtdb, node, version, 0,
@@ -1993,7 +2615,7 @@ cleanup:
 		dns_db_detachnode(rbtdb, &node);
 	if (rbt_rds_iterator != NULL)
 		dns_rdatasetiter_destroy(&rbt_rds_iterator);
-	ldapdb_rdatalist_destroy(inst->mctx, &rdatalist);
+	arena_destroy(&arena);
 	return result;
 }
 
@@ -2016,6 +2638,7 @@ zone_security_change(ldap_entry_t * const entry, dns_name_t * const name,
 	 * in period where old zone was deleted but the new zone was not
 	 * created yet. */
 	run_exclusive_enter(inst, &lock_state);
+	CHECK(cleanup_signed_files(inst, name));
 	CHECK(ldap_delete_zone2(inst, name, ISC_FALSE));
 	CHECK(ldap_parse_master_zoneentry(entry, olddb, inst, task));
 
@@ -2092,6 +2715,29 @@ ldap_parse_master_zoneentry(ldap_entry_t * const entry, dns_db_t * const olddb,
 		new_zone = ISC_TRUE;
 		log_debug(2, "created %s: raw %p; secure %p",
 			  ldap_entry_logname(entry), raw, secure);
+		sync_state_get(inst->sctx, &sync_state);
+		if (ldap_warm_start_get(inst) == ISC_TRUE && olddb == NULL
+		    && sync_state == sync_configinit) {
+			result = zone_snapshot_load(inst, &entry->fqdn);
+			if (result != ISC_R_SUCCESS) {
+				/* Data of this zone will not be delivered
+				 * by resumed SyncRepl session. */
+				dns_zone_log(raw, ISC_LOG_WARNING,
+					     "unable to load zone snapshot: "
+					     "%s; warm start disabled",
+					     dns_result_totext(result));
+				ldap_warm_start_set(inst, ISC_FALSE);
+				inst->warm_start_failed = ISC_TRUE;
+				sync_cookie_clear(inst->sctx);
+			}
+		} else if (olddb == NULL && sync_state == sync_datainit) {
+			/* Database is empty, records from initial refresh
+			 * can be loaded without versioning. */
+			CHECK(zr_get_zone_dbs(inst->zone_register,
+					      &entry->fqdn, &ldapdb, NULL));
+			ldapdb_bulkload_allow(ldapdb);
+			dns_db_detach(&ldapdb);
+		}
 	} else if (result != ISC_R_SUCCESS)
 		goto cleanup;
 	else if (want_secure != ISC_TF(secure != NULL)) {
@@ -2109,7 +2755,8 @@ ldap_parse_master_zoneentry(ldap_entry_t * const entry, dns_db_t * const olddb,
 
 	CHECK(zr_get_zone_settings(inst->zone_register, &entry->fqdn,
 				   &zone_settings));
-	CHECK(zone_master_reconfigure(entry, zone_settings, raw, secure, task));
+	CHECK(zone_master_reconfigure(entry, zone_settings, raw, secure, task,
+				      inst->parsers));
 	result = fwd_parse_ldap(entry, zone_settings);
 	if (result != ISC_R_SUCCESS && result != ISC_R_IGNORE)
 		goto cleanup;
@@ -2180,7 +2827,7 @@ ldap_parse_master_zoneentry(ldap_entry_t * const entry, dns_db_t * const olddb,
 		CHECK(unpublish_zone(inst, &entry->fqdn,
 				     ldap_entry_logname(entry)));
 		/* emulate "no explicit forwarding config" */
-		CHECK(fwd_configure_zone(&inst->empty_fwdz_settings, inst,
+		CHECK(fwd_configure_zone(inst->empty_fwdz_settings, inst,
 					 &entry->fqdn));
 		dns_zone_log(toview, ISC_LOG_INFO, "zone deactivated "
 			     "and removed from view");
@@ -2203,6 +2850,9 @@ cleanup:
 		if (result != ISC_R_SUCCESS)
 			log_error_r("%s: rollback failed: ",
 				    ldap_entry_logname(entry));
+	} else if (zone_settings != NULL) {
+		/* all tasks are paused, see ldap_settings_reclaim() */
+		settings_set_reclaim(zone_settings);
 	}
 	run_exclusive_exit(inst, lock_state);
 	if (raw != NULL)
@@ -2214,7 +2864,7 @@ cleanup:
 }
 
 static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
-findrdatatype_or_create(isc_mem_t *mctx, ldapdb_rdatalist_t *rdatalist,
+findrdatatype_or_create(arena_t *arena, ldapdb_rdatalist_t *rdatalist,
 			dns_rdataclass_t rdclass, dns_rdatatype_t rdtype,
 			dns_ttl_t ttl, dns_rdatalist_t **rdlistp)
 {
@@ -2228,7 +2878,8 @@ findrdatatype_or_create(isc_mem_t *mctx, ldapdb_rdatalist_t *rdatalist,
 
 	result = ldapdb_rdatalist_findrdatatype(rdatalist, rdtype, &rdlist);
 	if (result != ISC_R_SUCCESS) {
-		CHECKED_MEM_GET_PTR(mctx, rdlist);
+		rdlist = NULL;
+		CHECK(arena_get(arena, sizeof(*rdlist), (void **)&rdlist));
 
 		dns_rdatalist_init(rdlist);
 		rdlist->rdclass = rdclass;
@@ -2250,8 +2901,6 @@ findrdatatype_or_create(isc_mem_t *mctx, ldapdb_rdatalist_t *rdatalist,
 	return ISC_R_SUCCESS;
 
 cleanup:
-	SAFE_MEM_PUT_PTR(mctx, rdlist);
-
 	return result;
 }
 
@@ -2278,132 +2927,6 @@ ldapdb_rdatalist_findrdatatype(ldapdb_rdatalist_t *rdatalist,
 	return (rdlist == NULL) ? ISC_R_NOTFOUND : ISC_R_SUCCESS;
 }
 
-void
-ldapdb_rdatalist_destroy(isc_mem_t *mctx, ldapdb_rdatalist_t *rdatalist)
-{
-	dns_rdatalist_t *rdlist;
-
-	REQUIRE(rdatalist != NULL);
-
-	while (!EMPTY(*rdatalist)) {
-		rdlist = HEAD(*rdatalist);
-		free_rdatalist(mctx, rdlist);
-		UNLINK(*rdatalist, rdlist, link);
-		SAFE_MEM_PUT_PTR(mctx, rdlist);
-	}
-}
-
-void
-free_rdatalist(isc_mem_t *mctx, dns_rdatalist_t *rdlist)
-{
-	dns_rdata_t *rdata;
-	isc_region_t r;
-
-	REQUIRE(rdlist != NULL);
-
-	while (!EMPTY(rdlist->rdata)) {
-		rdata = HEAD(rdlist->rdata);
-		UNLINK(rdlist->rdata, rdata, link);
-		dns_rdata_toregion(rdata, &r);
-		isc_mem_put(mctx, r.base, r.length);
-		SAFE_MEM_PUT_PTR(mctx, rdata);
-	}
-}
-
-/**
- * Replace occurrences of \{variable_name\} with respective strings from
- * settings tree. Remaining parts of the original string are just copied
- * into the output.
- *
- * Double-escaped strings \\{ \\} do not trigger substitution.
- * Nested references will expand only innermost variable: \{\{var1\}\}
- * Non-matching parentheses and other garbage will be copied verbatim
- * without trigerring an error.
- *
- * @retval  ISC_R_SUCCESS  Output string is valid. Caller must deallocate output.
- * @retval  ISC_R_IGNORE   Some variables used in the template are not defined
- *                         in settings tree. Substitution was terminated
- *                         prematurely and output is not available.
- * @retval  others         Unexpected errors.
- */
-static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
-ldap_substitute_rr_template(isc_mem_t *mctx, const settings_set_t const * set,
-			    ld_string_t *orig_val, ld_string_t **output) {
-	isc_result_t result;
-	regex_t regex;
-	regmatch_t matches[3];
-	size_t processed = 0;
-	char *tmp = NULL;
-	const char *setting_name;
-	setting_t *setting;
-	ld_string_t *replaced = NULL;
-
-	/* match \{variable_name\} in the text
-	 * \{ and \} must not be double-escaped like \\{ or \\} */
-	if (regcomp(&regex,
-		    "\\(^\\|[^\\]\\)" /* character preceding \{ = matches[1] */
-		    "\\\\{"
-		    "\\([a-zA-Z0-9_-]\\+\\)" /* variable name = matches[2] */
-		    "\\\\}",
-		    0) != 0)
-		CLEANUP_WITH(ISC_R_UNEXPECTED);
-
-	CHECK(str_new(mctx, &replaced));
-	CHECKED_MEM_STRDUP(mctx, str_buf(orig_val), tmp);
-
-	while (regexec(&regex, tmp + processed,
-		       sizeof(matches)/sizeof(regmatch_t),
-		       matches, 0) == 0)
-	{
-		/* derelativize offsets to make sure they
-		 * always start from tmp instead of tmp + processed */
-		for (size_t i = 0; i < sizeof(matches)/sizeof(regmatch_t); i++) {
-			matches[i].rm_so += processed;
-			matches[i].rm_eo += processed;
-		}
-		/* copy verbatim part of the string which precedes the \{ */
-		CHECK(str_cat_char_len(replaced,
-				       tmp + processed,
-				       matches[1].rm_eo - processed));
-
-		/* find value for given variable name in settings tree */
-		setting_name = tmp + matches[2].rm_so;
-		tmp[matches[2].rm_eo] = '\0';
-		setting = NULL;
-		result = setting_find(setting_name, set, isc_boolean_true,
-				      isc_boolean_true, &setting);
-		if (result != ISC_R_SUCCESS) {
-			log_debug(3, "setting '%s' is not defined so it "
-				  "cannot be substituted into template '%s'",
-				  setting_name, str_buf(orig_val));
-			CLEANUP_WITH(ISC_R_IGNORE);
-		}
-		if (setting->type != ST_STRING) {
-			log_bug("setting '%s' it not string so it cannot be "
-				"substituted", setting_name);
-			CLEANUP_WITH(ISC_R_NOTIMPLEMENTED);
-		}
-		CHECK(str_cat_char(replaced, setting->value.value_char));
-
-		/* end offset of previous match = matches[0].rm_eo */
-		processed = matches[0].rm_eo;
-	};
-
-	/* copy remaining part of the string */
-	CHECK(str_cat_char(replaced, tmp + processed));
-
-	*output = replaced;
-	replaced = NULL;
-	result = ISC_R_SUCCESS;
-
-cleanup:
-	if (tmp != NULL)
-		isc_mem_free(mctx, tmp);
-
-	str_destroy(&replaced);
-	return result;
-}
-
 /**
  * Substitute strings into idnsTemplateAttributes
  * and parse results into list of rdatas.
@@ -2421,7 +2944,9 @@ cleanup:
  *                         do not have defined values. Ignore output.
  */
 static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
-ldap_parse_rrentry_template(isc_mem_t *mctx, ldap_entry_t *entry,
+ldap_parse_rrentry_template(isc_mem_t *mctx, ldap_parserpool_t *parsers,
+			    rr_templatecache_t *templates,
+			    arena_t *arena, ldap_entry_t *entry,
 			    dns_name_t *origin,
 			    const settings_set_t * const settings,
 			    ldapdb_rdatalist_t *rdatalist)
@@ -2440,9 +2965,12 @@ ldap_parse_rrentry_template(isc_mem_t *mctx, ldap_entry_t *entry,
 	static const char prefix_len = sizeof(prefix) - 1;
 
 	CHECK(str_new(mctx, &orig_val));
+	CHECK(str_new(mctx, &new_val));
 	rdclass = ldap_entry_getrdclass(entry);
 	ttl = ldap_entry_getttl(entry, settings);
 
+	/* entry can be parsed repeatedly, see rr_templateindex_take() */
+	entry->lastattr = NULL;
 	while ((attr = ldap_entry_nextattr(entry)) != NULL) {
 		if (strncasecmp(prefix, attr->name, prefix_len) != 0)
 			continue;
@@ -2456,19 +2984,20 @@ ldap_parse_rrentry_template(isc_mem_t *mctx, ldap_entry_t *entry,
 			continue;
 		}
 
-		CHECK(findrdatatype_or_create(mctx, rdatalist, rdclass,
+		CHECK(findrdatatype_or_create(arena, rdatalist, rdclass,
 					      rdtype, ttl, &rdlist));
 		for (result = ldap_attr_firstvalue(attr, orig_val);
 		     result == ISC_R_SUCCESS;
 		     result = ldap_attr_nextvalue(attr, orig_val)) {
-			str_destroy(&new_val);
-			CHECK(ldap_substitute_rr_template(mctx, settings,
-							  orig_val, &new_val));
+			CHECK(rr_template_substitute(templates,
+						     str_buf(orig_val),
+						     settings, new_val));
 			log_debug(10, "%s: substituted '%s' '%s' -> '%s'",
 				  ldap_entry_logname(entry), attr->name,
 				  str_buf(orig_val), str_buf(new_val));
-			CHECK(parse_rdata(mctx, entry, rdclass, rdtype, origin,
-					  str_buf(new_val), &rdata));
+			CHECK(parse_rdata(mctx, parsers, arena, rdclass,
+					  rdtype, origin, str_buf(new_val),
+					  &rdata));
 			APPEND(rdlist->rdata, rdata, link);
 			rdata = NULL;
 			did_something = ISC_TRUE;
@@ -2497,7 +3026,9 @@ cleanup:
  * @param rdatalist[in,out]
  */
 static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
-ldap_parse_rrentry(isc_mem_t *mctx, ldap_entry_t *entry, dns_name_t *origin,
+ldap_parse_rrentry(isc_mem_t *mctx, ldap_parserpool_t *parsers,
+		   rr_templatecache_t *templates,
+		   arena_t *arena, ldap_entry_t *entry, dns_name_t *origin,
 		   const settings_set_t * const settings,
 		   ldapdb_rdatalist_t *rdatalist)
 {
@@ -2518,12 +3049,13 @@ ldap_parse_rrentry(isc_mem_t *mctx, ldap_entry_t *entry, dns_name_t *origin,
 	rdclass = ldap_entry_getrdclass(entry);
 	if ((entry->class & LDAP_ENTRYCLASS_MASTER) != 0) {
 		CHECK(setting_get_str("fake_mname", settings, &fake_mname));
-		CHECK(add_soa_record(mctx, origin, entry, ttl, rdatalist,
-				     fake_mname));
+		CHECK(add_soa_record(mctx, parsers, arena, origin, entry,
+				     ttl, rdatalist, fake_mname));
 	}
 
 	if ((entry->class & LDAP_ENTRYCLASS_TEMPLATE) != 0) {
-		result = ldap_parse_rrentry_template(mctx, entry, origin,
+		result = ldap_parse_rrentry_template(mctx, parsers, templates,
+						     arena, entry, origin,
 						     settings, rdatalist);
 		if (result == ISC_R_SUCCESS)
 			/* successful substitution overrides all constants */
@@ -2537,12 +3069,12 @@ ldap_parse_rrentry(isc_mem_t *mctx, ldap_entry_t *entry, dns_name_t *origin,
 	     result == ISC_R_SUCCESS;
 	     result = ldap_entry_nextrdtype(entry, &attr, &rdtype)) {
 
-		CHECK(findrdatatype_or_create(mctx, rdatalist, rdclass,
+		CHECK(findrdatatype_or_create(arena, rdatalist, rdclass,
 					      rdtype, ttl, &rdlist));
 		for (result = ldap_attr_firstvalue(attr, data_buf);
 		     result == ISC_R_SUCCESS;
 		     result = ldap_attr_nextvalue(attr, data_buf)) {
-			CHECK(parse_rdata(mctx, entry, rdclass,
+			CHECK(parse_rdata(mctx, parsers, arena, rdclass,
 					  rdtype, origin,
 					  str_buf(data_buf), &rdata));
 			APPEND(rdlist->rdata, rdata, link);
@@ -2568,53 +3100,96 @@ cleanup:
 }
 
 static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
-add_soa_record(isc_mem_t *mctx, dns_name_t *origin,
-	       ldap_entry_t *entry, dns_ttl_t ttl, ldapdb_rdatalist_t *rdatalist,
-	       const char *fake_mname)
+add_soa_record(isc_mem_t *mctx, ldap_parserpool_t *parsers, arena_t *arena,
+	       dns_name_t *origin, ldap_entry_t *entry, dns_ttl_t ttl,
+	       ldapdb_rdatalist_t *rdatalist, const char *fake_mname)
 {
 	isc_result_t result;
 	ld_string_t *string = NULL;
 	dns_rdataclass_t rdclass;
 	dns_rdata_t *rdata = NULL;
 	dns_rdatalist_t *rdlist = NULL;
+	unsigned char wire[RDATA_FAST_MAXLENGTH];
+	isc_buffer_t wire_buffer;
 
-	CHECK(str_new(mctx, &string));
-
-	CHECK(ldap_entry_getfakesoa(entry, fake_mname, string));
 	rdclass = ldap_entry_getrdclass(entry);
-	CHECK(parse_rdata(mctx, entry, rdclass, dns_rdatatype_soa, origin,
-			  str_buf(string), &rdata));
+	isc_buffer_init(&wire_buffer, wire, sizeof(wire));
+	result = ldap_entry_getsoa(entry, fake_mname, origin, &wire_buffer);
+	if (result == ISC_R_SUCCESS) {
+		CHECK(rdata_fromwire_arena(arena, rdclass, dns_rdatatype_soa,
+					   &wire_buffer, &rdata));
+	} else {
+		CHECK(str_new(mctx, &string));
+		CHECK(ldap_entry_getfakesoa(entry, fake_mname, string));
+		CHECK(parse_rdata(mctx, parsers, arena, rdclass,
+				  dns_rdatatype_soa, origin, str_buf(string),
+				  &rdata));
+	}
 
-	CHECK(findrdatatype_or_create(mctx, rdatalist, rdclass, dns_rdatatype_soa,
-				      ttl, &rdlist));
+	CHECK(findrdatatype_or_create(arena, rdatalist, rdclass,
+				      dns_rdatatype_soa, ttl, &rdlist));
 
 	APPEND(rdlist->rdata, rdata, link);
 
 cleanup:
 	str_destroy(&string);
-	if (result != ISC_R_SUCCESS)
-		SAFE_MEM_PUT_PTR(mctx, rdata);
 
 	return result;
 }
 
+/**
+ * Copy rdata in wire format into new rdata allocated from the arena.
+ */
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+rdata_fromwire_arena(arena_t *arena, dns_rdataclass_t rdclass,
+		     dns_rdatatype_t rdtype, isc_buffer_t *wire,
+		     dns_rdata_t **rdatap)
+{
+	isc_result_t result;
+	isc_region_t rdatamem;
+	dns_rdata_t *rdata = NULL;
+
+	/* rdata structure and its data share one arena allocation */
+	rdatamem.length = isc_buffer_usedlength(wire);
+	CHECK(arena_get(arena, sizeof(*rdata) + rdatamem.length,
+			(void **)&rdata));
+	dns_rdata_init(rdata);
+	rdatamem.base = (unsigned char *)(rdata + 1);
+	memcpy(rdatamem.base, isc_buffer_base(wire), rdatamem.length);
+	dns_rdata_fromregion(rdata, rdclass, rdtype, &rdatamem);
+
+	*rdatap = rdata;
+
+cleanup:
+	return result;
+}
+
+/**
+ * Convert text representation of rdata to wire format. Simple values
+ * of common record types are converted directly by rdata_fromtext_fast(),
+ * everything else goes through isc_lex and dns_rdata_fromtext().
+ */
 static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
-parse_rdata(isc_mem_t *mctx, ldap_entry_t *entry,
+parse_rdata(isc_mem_t *mctx, ldap_parserpool_t *parsers, arena_t *arena,
 	    dns_rdataclass_t rdclass, dns_rdatatype_t rdtype,
 	    dns_name_t *origin, const char *rdata_text, dns_rdata_t **rdatap)
 {
 	isc_result_t result;
 	isc_consttextregion_t text;
 	isc_buffer_t lex_buffer;
-	isc_region_t rdatamem;
-	dns_rdata_t *rdata;
+	ldap_parser_t *parser = NULL;
+	unsigned char wire[RDATA_FAST_MAXLENGTH];
+	isc_buffer_t wire_buffer;
 
-	REQUIRE(entry != NULL);
+	REQUIRE(parsers != NULL);
 	REQUIRE(rdata_text != NULL);
 	REQUIRE(rdatap != NULL);
 
-	rdata = NULL;
-	rdatamem.base = NULL;
+	isc_buffer_init(&wire_buffer, wire, sizeof(wire));
+	if (rdata_fromtext_fast(rdclass, rdtype, origin, rdata_text,
+				&wire_buffer) == ISC_R_SUCCESS)
+		return rdata_fromwire_arena(arena, rdclass, rdtype,
+					    &wire_buffer, rdatap);
 
 	text.base = rdata_text;
 	text.length = strlen(text.base);
@@ -2623,33 +3198,17 @@ parse_rdata(isc_mem_t *mctx, ldap_entry_t *entry,
 	isc_buffer_add(&lex_buffer, text.length);
 	isc_buffer_setactive(&lex_buffer, text.length);
 
-	CHECK(isc_lex_openbuffer(entry->lex, &lex_buffer));
-
-	isc_buffer_init(&entry->rdata_target, entry->rdata_target_mem,
-			DNS_RDATA_MAXLENGTH);
-	CHECK(dns_rdata_fromtext(NULL, rdclass, rdtype, entry->lex, origin,
-				 0, mctx, &entry->rdata_target, NULL));
-
-	CHECKED_MEM_GET_PTR(mctx, rdata);
-	dns_rdata_init(rdata);
-
-	rdatamem.length = isc_buffer_usedlength(&entry->rdata_target);
-	CHECKED_MEM_GET(mctx, rdatamem.base, rdatamem.length);
-
-	memcpy(rdatamem.base, isc_buffer_base(&entry->rdata_target),
-	       rdatamem.length);
-	dns_rdata_fromregion(rdata, rdclass, rdtype, &rdatamem);
-
-	isc_lex_close(entry->lex);
+	CHECK(ldap_parser_get(parsers, &parser));
+	CHECK(isc_lex_openbuffer(parser->lex, &lex_buffer));
+	CHECK(dns_rdata_fromtext(NULL, rdclass, rdtype, parser->lex, origin,
+				 0, mctx, &parser->rdata_target, NULL));
 
-	*rdatap = rdata;
-	return ISC_R_SUCCESS;
+	CHECK(rdata_fromwire_arena(arena, rdclass, rdtype,
+				   &parser->rdata_target, rdatap));
 
 cleanup:
-	isc_lex_close(entry->lex);
-	SAFE_MEM_PUT_PTR(mctx, rdata);
-	if (rdatamem.base != NULL)
-		isc_mem_put(mctx, rdatamem.base, rdatamem.length);
+	if (parser != NULL)
+		ldap_parser_put(parsers, &parser);
 
 	return result;
 }
@@ -3335,7 +3894,6 @@ modify_ldap_common(dns_name_t *owner, dns_name_t *zone, ldap_instance_t *ldap_in
 	LDAPMod *change[3] = { NULL };
 	isc_boolean_t zone_sync_ptr;
 	char **vals = NULL;
-	dns_name_t zone_name;
 	char *zone_dn = NULL;
 	settings_set_t *zone_settings = NULL;
 	int af; /* address family */
@@ -3345,7 +3903,6 @@ modify_ldap_common(dns_name_t *owner, dns_name_t *zone, ldap_instance_t *ldap_in
 	 * Find parent zone entry and check if Dynamic Update is allowed.
 	 * @todo Try the cache first and improve split: SOA records are problematic.
 	 */
-	dns_name_init(&zone_name, NULL);
 	CHECK(str_new(mctx, &owner_dn));
 
 	CHECK(dnsname_to_dn(ldap_inst->zone_register, owner, zone, owner_dn));
@@ -3357,10 +3914,7 @@ modify_ldap_common(dns_name_t *owner, dns_name_t *zone, ldap_instance_t *ldap_in
 		zone_dn += 1; /* skip whitespace */
 	}
 
-	CHECK(dn_to_dnsname(mctx, zone_dn, &zone_name, NULL, NULL));
-	INSIST(dns_name_equal(zone, &zone_name) == ISC_TRUE);
-
-	result = zr_get_zone_settings(ldap_inst->zone_register, &zone_name,
+	result = zr_get_zone_settings(ldap_inst->zone_register, zone,
 				      &zone_settings);
 	if (result != ISC_R_SUCCESS) {
 		if (result == ISC_R_NOTFOUND)
@@ -3429,7 +3983,6 @@ cleanup:
 	ldap_mod_free(mctx, &change[0]);
 	ldap_mod_free(mctx, &change[1]);
 	free_char_array(mctx, &vals);
-	dns_name_free(&zone_name, mctx);
 
 	return result;
 }
@@ -3671,6 +4224,18 @@ cleanup:
 #define SYNCREPL_ANY(chgtype) ((chgtype & LDAP_ENTRYCHANGE_ALL) != 0)
  */
 
+/**
+ * Change from syncrepl event was not applied. Make sure that the next change
+ * of the entry is not ignored even if its content matches the fingerprint
+ * stored when this event was received, see mldap_entry_unchanged().
+ */
+static void ATTR_NONNULLS
+syncrepl_event_failed(ldap_instance_t *inst, ldap_syncreplevent_t *ev) {
+	if (ev->entry->uuid != NULL && !SYNCREPL_DEL(ev->chgtype)
+	    && ev->entry->template_refresh == ISC_FALSE)
+		mldap_entry_failed(inst->mldapdb, ev->entry->uuid);
+}
+
 /*
  * update_zone routine is processed asynchronously so it cannot assume
  * anything about state of ldap_inst from where it was sent. The ldap_inst
@@ -3695,6 +4260,7 @@ update_zone(isc_task_t *task, isc_event_t *event)
 	INSIST(task == inst->task); /* For task-exclusive mode */
 
 	if (SYNCREPL_DEL(pevent->chgtype)) {
+		CHECK(cleanup_signed_files(inst, &entry->fqdn));
 		CHECK(ldap_delete_zone2(inst, &entry->fqdn, ISC_TRUE));
 	} else {
 		if (entry->class & LDAP_ENTRYCLASS_MASTER)
@@ -3709,8 +4275,10 @@ update_zone(isc_task_t *task, isc_event_t *event)
 
 cleanup:
 	if (inst != NULL) {
-		sync_concurr_limit_signal(inst->sctx);
+		sync_concurr_limit_signal(inst->sctx, NULL, pevent);
 		sync_event_signal(inst->sctx, pevent);
+		if (result != ISC_R_SUCCESS)
+			syncrepl_event_failed(inst, pevent);
 		if (dns_name_dynamic(&prevname))
 			dns_name_free(&prevname, inst->mctx);
 	}
@@ -3727,6 +4295,28 @@ cleanup:
 	isc_task_detach(&task);
 }
 
+/**
+ * Free versions of settings replaced by changes from LDAP. All tasks are
+ * paused in task-exclusive mode so none of them can use a value obtained
+ * before the change. Threads which are not tasks read only settings
+ * from named.conf which do not change at run time.
+ */
+static void ATTR_NONNULLS
+ldap_settings_reclaim(ldap_instance_t *inst, isc_task_t *task,
+		      settings_set_t *set)
+{
+	isc_result_t lock_state = ISC_R_IGNORE;
+
+	REQUIRE(task == inst->task); /* For task-exclusive mode */
+
+	if (settings_set_reclaimable(set) == ISC_FALSE)
+		return;
+
+	run_exclusive_enter(inst, &lock_state);
+	settings_set_reclaim(set);
+	run_exclusive_exit(inst, lock_state);
+}
+
 static void ATTR_NONNULLS
 update_config(isc_task_t * task, isc_event_t *event)
 {
@@ -3740,11 +4330,14 @@ update_config(isc_task_t * task, isc_event_t *event)
 
 	INSIST(task == inst->task); /* For task-exclusive mode */
 	CHECK(ldap_parse_configentry(entry, inst));
+	ldap_settings_reclaim(inst, task, inst->global_settings);
 
 cleanup:
 	if (inst != NULL) {
-		sync_concurr_limit_signal(inst->sctx);
+		sync_concurr_limit_signal(inst->sctx, NULL, pevent);
 		sync_event_signal(inst->sctx, pevent);
+		if (result != ISC_R_SUCCESS)
+			syncrepl_event_failed(inst, pevent);
 	}
 	if (result != ISC_R_SUCCESS)
 		log_error_r("update_config (syncrepl) failed for %s. "
@@ -3770,11 +4363,14 @@ update_serverconfig(isc_task_t * task, isc_event_t *event)
 
 	INSIST(task == inst->task); /* For task-exclusive mode */
 	CHECK(ldap_parse_serverconfigentry(entry, inst));
+	ldap_settings_reclaim(inst, task, inst->server_ldap_settings);
 
 cleanup:
 	if (inst != NULL) {
-		sync_concurr_limit_signal(inst->sctx);
+		sync_concurr_limit_signal(inst->sctx, NULL, pevent);
 		sync_event_signal(inst->sctx, pevent);
+		if (result != ISC_R_SUCCESS)
+			syncrepl_event_failed(inst, pevent);
 	}
 	if (result != ISC_R_SUCCESS)
 		log_error_r("update_serverconfig (syncrepl) failed for %s. "
@@ -3788,73 +4384,48 @@ cleanup:
 }
 
 /**
- * @brief Update record in cache.
- *
- * If it exists it is replaced with newer version.
+ * Compute changes in zone database requested by single syncrepl event.
  *
- * @param task Task indentifier.
- * @param event Internal data of type ldap_syncreplevent_t.
+ * @param[in]  arena   Arena for parsed rdata. It is reset before return.
+ * @param[in]  rbtdb   Zone database to compare LDAP data with.
+ * @param[in]  version Database version to read current data from.
+ * @param[out] diff    Minimal diff which transforms data in the database
+ *                     to data in LDAP entry from the event.
  */
-static void ATTR_NONNULLS
-update_record(isc_task_t *task, isc_event_t *event)
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+update_record_diff(ldap_instance_t *inst, ldap_syncreplevent_t *pevent,
+		   arena_t *arena, dns_db_t *rbtdb, dns_dbversion_t *version,
+		   dns_diff_t *diff)
 {
-	/* syncrepl event */
-	ldap_syncreplevent_t *pevent = (ldap_syncreplevent_t *)event;
 	isc_result_t result;
-	ldap_instance_t *inst = pevent->inst;
-	isc_mem_t *mctx;
-	settings_set_t *zone_settings = NULL;
-	dns_zone_t *raw = NULL;
-	dns_zone_t *secure = NULL;
-	isc_boolean_t zone_found = ISC_FALSE;
-	isc_boolean_t zone_reloaded = ISC_FALSE;
-	isc_uint32_t serial;
+	isc_mem_t *mctx = pevent->mctx;
 	ldap_entry_t *entry = pevent->entry;
-
-	dns_db_t *rbtdb = NULL;
-	dns_db_t *ldapdb = NULL;
-	dns_diff_t diff;
-
-	dns_dbversion_t *version = NULL; /* version is shared between rbtdb and ldapdb */
-	dns_dbnode_t *node = NULL; /* node is shared between rbtdb and ldapdb */
+	ldap_entry_t *indexed = NULL;
+	settings_set_t *zone_settings = NULL;
+	dns_dbnode_t *node = NULL;
 	dns_rdatasetiter_t *rbt_rds_iterator = NULL;
 
-	sync_state_t sync_state;
-
-	mctx = pevent->mctx;
-	dns_diff_init(mctx, &diff);
-
-#ifdef RBTDB_DEBUG
-	static unsigned int count = 0;
-#endif
-
 	/* Structure to be stored in the cache. */
 	ldapdb_rdatalist_t rdatalist;
 	INIT_LIST(rdatalist);
 
-	/* Convert domain name from text to struct dns_name_t. */
-	dns_name_t prevname;
-	dns_name_t prevorigin;
-	dns_name_init(&prevname, NULL);
-	dns_name_init(&prevorigin, NULL);
-
-	CHECK(zr_get_zone_ptr(inst->zone_register, &entry->zone_name, &raw, &secure));
-	zone_found = ISC_TRUE;
-
-update_restart:
-	rbtdb = NULL;
-	ldapdb = NULL;
-	zone_settings = NULL;
-	ldapdb_rdatalist_destroy(mctx, &rdatalist);
-	CHECK(zr_get_zone_dbs(inst->zone_register, &entry->zone_name, &ldapdb, &rbtdb));
-	CHECK(dns_db_newversion(ldapdb, &version));
+	/* Render templates again from the last known state of the entry. */
+	if (entry->template_refresh == ISC_TRUE) {
+		result = rr_templateindex_take(inst->templateindex,
+					       entry->uuid, &indexed);
+		if (result == ISC_R_NOTFOUND)
+			/* entry was deleted or it is not a template anymore */
+			return ISC_R_SUCCESS;
+		else if (result != ISC_R_SUCCESS)
+			return result;
+		entry = indexed;
+	}
 
 	CHECK(dns_db_findnode(rbtdb, &entry->fqdn, ISC_TRUE, &node));
 	result = dns_db_allrdatasets(rbtdb, node, version, 0, &rbt_rds_iterator);
 	if (result != ISC_R_SUCCESS && result != ISC_R_NOTFOUND)
 		goto cleanup;
 
-
 	/* This code is disabled because we don't have UUID->DN database yet.
 	    || SYNCREPL_MODDN(pevent->chgtype)) { */
 	if (SYNCREPL_DEL(pevent->chgtype)) {
@@ -3899,63 +4470,349 @@ update_restart:
 			  "%s", ldap_entry_logname(entry));
 		CHECK(zr_get_zone_settings(inst->zone_register,
 					   &entry->zone_name, &zone_settings));
-		CHECK(ldap_parse_rrentry(mctx, entry, &entry->zone_name,
+		CHECK(ldap_parse_rrentry(mctx, inst->parsers, inst->templates,
+					 arena, entry, &entry->zone_name,
 					 zone_settings, &rdatalist));
 	}
 
 	if (rbt_rds_iterator != NULL) {
 		CHECK(diff_ldap_rbtdb(mctx, &entry->fqdn, &rdatalist,
-				      rbt_rds_iterator, &diff));
+				      rbt_rds_iterator, diff));
 		dns_rdatasetiter_destroy(&rbt_rds_iterator);
 	}
 
-	sync_state_get(inst->sctx, &sync_state);
-	/* No real change in RR data -> do not increment SOA serial. */
-	if (HEAD(diff.tuples) != NULL) {
-		if (sync_state == sync_finished) {
-			CHECK(zone_soaserial_addtuple(mctx, ldapdb, version,
-						      &diff, &serial));
-			dns_zone_log(raw, ISC_LOG_DEBUG(5),
-				     "writing new zone serial %u to LDAP",
-				     serial);
-			result = ldap_replace_serial(inst, &entry->zone_name, serial);
-			if (result != ISC_R_SUCCESS)
-				dns_zone_log(raw, ISC_LOG_ERROR,
-					     "serial (%u) write back to LDAP failed",
-					     serial);
-		}
+cleanup:
+	if (rbt_rds_iterator != NULL)
+		dns_rdatasetiter_destroy(&rbt_rds_iterator);
+	if (node != NULL)
+		dns_db_detachnode(rbtdb, &node);
+	if (indexed != NULL)
+		rr_templateindex_store(inst->templateindex, inst->templates,
+				       &indexed);
+	/* diff tuples hold their own copies of rdata */
+	arena_reset(arena);
+
+	return result;
+}
+
+/**
+ * Load records from single syncrepl event directly into zone database
+ * which was empty when initial refresh started, see ldapdb_bulkload_add().
+ *
+ * Parsed rdata are allocated from the arena which is reset before return.
+ *
+ * @retval ISC_R_NOTIMPLEMENTED Bulk load is not possible, changes have to be
+ *                              applied using update_record_diff().
+ */
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+update_record_bulkload(ldap_instance_t *inst, ldap_syncreplevent_t *pevent,
+		       arena_t *arena, dns_db_t *ldapdb)
+{
+	isc_result_t result;
+	isc_mem_t *mctx = pevent->mctx;
+	ldap_entry_t *entry = pevent->entry;
+	settings_set_t *zone_settings = NULL;
+	ldapdb_rdatalist_t rdatalist;
+
+	INIT_LIST(rdatalist);
+
+	/* Only new names can be loaded, everything else needs diff. */
+	if (!SYNCREPL_ADD(pevent->chgtype))
+		return ISC_R_NOTIMPLEMENTED;
+
+	log_debug(5, "syncrepl_update: loading name into rbtdb, "
+		  "%s", ldap_entry_logname(entry));
+	CHECK(zr_get_zone_settings(inst->zone_register, &entry->zone_name,
+				   &zone_settings));
+	CHECK(ldap_parse_rrentry(mctx, inst->parsers, inst->templates,
+				 arena, entry, &entry->zone_name,
+				 zone_settings, &rdatalist));
+	CHECK(ldapdb_bulkload_add(ldapdb, &entry->fqdn, &rdatalist));
+
+cleanup:
+	arena_reset(arena);
+	return result;
+}
+
+/**
+ * Undo tuples applied to the database version, the newest one first.
+ */
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+update_record_revert(dns_diff_t *applied, dns_db_t *rbtdb,
+		     dns_dbversion_t *version)
+{
+	isc_result_t result;
+	dns_diff_t revert;
+	dns_difftuple_t *tuple;
+	dns_difftuple_t *inverse = NULL;
+
+	dns_diff_init(applied->mctx, &revert);
+	for (tuple = TAIL(applied->tuples);
+	     tuple != NULL;
+	     tuple = PREV(tuple, link)) {
+		CHECK(dns_difftuple_create(applied->mctx,
+					   (tuple->op == DNS_DIFFOP_ADD)
+					   ? DNS_DIFFOP_DEL : DNS_DIFFOP_ADD,
+					   &tuple->name, tuple->ttl,
+					   &tuple->rdata, &inverse));
+		dns_diff_append(&revert, &inverse);
+	}
+	CHECK(dns_diff_apply(&revert, rbtdb, version));
+
+cleanup:
+	dns_diff_clear(&revert);
+	return result;
+}
+
+/**
+ * Apply diff to the database version and move all tuples to the diff
+ * which will be written to the journal.
+ *
+ * The diff is applied one rdataset at a time. If some rdataset cannot be
+ * applied, rdatasets applied so far are reverted so the version
+ * is not affected by the diff at all and other changes in the same
+ * version can be committed.
+ *
+ * @retval DNS_R_BADZONE Partially applied diff cannot be reverted,
+ *                       the version has to be rolled back and the zone
+ *                       reloaded.
+ */
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+update_record_apply(dns_diff_t *diff, dns_db_t *rbtdb,
+		    dns_dbversion_t *version, dns_diff_t *journal_diff)
+{
+	isc_result_t result = ISC_R_SUCCESS;
+	dns_difftuple_t *tuple = NULL;
+	dns_difftuple_t *first;
+	dns_diff_t rdataset;
+	dns_diff_t applied;
+
+	dns_diff_init(diff->mctx, &rdataset);
+	dns_diff_init(diff->mctx, &applied);
 
 #if RBTDB_DEBUG >= 2
-		dns_diff_print(&diff, stdout);
+	dns_diff_print(diff, stdout);
 #else
-		dns_diff_print(&diff, NULL);
+	dns_diff_print(diff, NULL);
 #endif
-		if (sync_state == sync_finished) {
-			/* write the transaction to journal */
-			CHECK(zone_journal_adddiff(inst->mctx, raw, &diff));
+	while ((first = HEAD(diff->tuples)) != NULL) {
+		/* tuples for the same rdataset, see dns_diff_apply() */
+		while ((tuple = HEAD(diff->tuples)) != NULL
+		       && tuple->op == first->op
+		       && tuple->rdata.type == first->rdata.type
+		       && dns_name_equal(&tuple->name, &first->name)) {
+			UNLINK(diff->tuples, tuple, link);
+			APPEND(rdataset.tuples, tuple, link);
 		}
-		/* commit */
-		CHECK(dns_diff_apply(&diff, rbtdb, version));
-		dns_db_closeversion(ldapdb, &version, ISC_TRUE);
-		dns_zone_markdirty(raw);
+		CHECK(dns_diff_apply(&rdataset, rbtdb, version));
+		ISC_LIST_APPENDLIST(applied.tuples, rdataset.tuples, link);
+	}
+	while ((tuple = HEAD(applied.tuples)) != NULL) {
+		UNLINK(applied.tuples, tuple, link);
+		dns_diff_appendminimal(journal_diff, &tuple);
 	}
-
-	/* Check if the zone is loaded or not.
-	 * No other function above returns DNS_R_NOTLOADED. */
-	if (sync_state == sync_finished)
-		result = dns_zone_getserial2(raw, &serial);
 
 cleanup:
-#ifdef RBTDB_DEBUG
-	if (++count % 100 == 0)
+	if (result != ISC_R_SUCCESS && !EMPTY(applied.tuples)
+	    && update_record_revert(&applied, rbtdb, version)
+	       != ISC_R_SUCCESS) {
+		log_error_r("unable to revert partially applied change");
+		result = DNS_R_BADZONE;
+	}
+	dns_diff_clear(&rdataset);
+	dns_diff_clear(&applied);
+	return result;
+}
+
+/**
+ * Remember the last state of template entries so their records can be
+ * rendered again when substitution variables change.
+ * Ownership of template entry is passed to the index.
+ */
+static void ATTR_NONNULLS
+update_record_index(ldap_instance_t *inst, ldap_syncreplevent_t *ev)
+{
+	ldap_entry_t *entry = ev->entry;
+
+	if (entry->uuid == NULL || entry->template_refresh == ISC_TRUE)
+		return;
+
+	if (!SYNCREPL_DEL(ev->chgtype)
+	    && (entry->class & LDAP_ENTRYCLASS_TEMPLATE) != 0)
+		rr_templateindex_store(inst->templateindex, inst->templates,
+				       &ev->entry);
+	else
+		rr_templateindex_remove(inst->templateindex, entry->uuid,
+					&entry->fqdn);
+}
+
+/**
+ * @brief Update records in cache.
+ *
+ * If it exists it is replaced with newer version.
+ *
+ * The event can carry a batch of other events for the same zone,
+ * see sync_batch_add(). Changes from all events are applied in one
+ * database version with single SOA serial increment and journal
+ * transaction. Change which cannot be applied is logged and skipped,
+ * it does not prevent other changes in the batch from being applied.
+ *
+ * @param task Task indentifier.
+ * @param event Internal data of type ldap_syncreplevent_t.
+ */
+static void ATTR_NONNULLS
+update_record(isc_task_t *task, isc_event_t *event)
+{
+	/* syncrepl event */
+	ldap_syncreplevent_t *pevent = (ldap_syncreplevent_t *)event;
+	ldap_syncreplevent_t *ev = NULL;
+	ldap_syncreplevent_t *next_ev = NULL;
+	LIST(ldap_syncreplevent_t) batch;
+	unsigned int batch_len = 0;
+	isc_result_t result;
+	ldap_instance_t *inst = pevent->inst;
+	isc_mem_t *mctx;
+	dns_zone_t *raw = NULL;
+	dns_zone_t *secure = NULL;
+	isc_boolean_t zone_found = ISC_FALSE;
+	isc_boolean_t zone_reloaded = ISC_FALSE;
+	isc_uint32_t serial;
+	ldap_entry_t *entry = pevent->entry;
+
+	dns_db_t *rbtdb = NULL;
+	dns_db_t *ldapdb = NULL;
+	dns_diff_t diff;
+	dns_diff_t journal_diff;
+
+	dns_dbversion_t *version = NULL; /* version is shared between rbtdb and ldapdb */
+
+	sync_state_t sync_state;
+	isc_boolean_t zone_live;
+	arena_t *arena = NULL;
+
+	mctx = pevent->mctx;
+	dns_diff_init(mctx, &diff);
+	dns_diff_init(mctx, &journal_diff);
+
+#ifdef RBTDB_DEBUG
+	static unsigned int count = 0;
+#endif
+
+	/* Nothing can be appended to the batch from now on. */
+	sync_batch_start(inst->sctx, &entry->zone_name, pevent);
+	batch = pevent->batch;
+	INIT_LIST(pevent->batch);
+	PREPEND(batch, pevent, link);
+
+	CHECK(arena_create(mctx, &arena));
+	CHECK(zr_get_zone_ptr(inst->zone_register, &entry->zone_name, &raw, &secure));
+	zone_found = ISC_TRUE;
+
+	/* Initial refresh into empty zone does not need versions and diffs. */
+	sync_state_get(inst->sctx, &sync_state);
+	if (sync_state == sync_datainit) {
+		CHECK(zr_get_zone_dbs(inst->zone_register, &entry->zone_name,
+				      &ldapdb, NULL));
+		for (ev = HEAD(batch); ev != NULL; ev = NEXT(ev, link)) {
+			result = update_record_bulkload(inst, ev, arena,
+							ldapdb);
+			ev->applied = ISC_TF(result == ISC_R_SUCCESS);
+			if (result == ISC_R_NOTIMPLEMENTED)
+				break;
+			else if (result != ISC_R_SUCCESS)
+				log_error_r("update_record (syncrepl) failed, "
+					    "%s change type 0x%x. Records can "
+					    "be outdated, run `rndc reload`",
+					    ldap_entry_logname(ev->entry),
+					    ev->chgtype);
+			batch_len++;
+		}
+		dns_db_detach(&ldapdb);
+		if (ev == NULL)
+			CLEANUP_WITH(ISC_R_SUCCESS);
+		/* Fall back to versions. Changes loaded so far are already
+		 * in the database so they will produce empty diffs. */
+	}
+
+update_restart:
+	rbtdb = NULL;
+	ldapdb = NULL;
+	batch_len = 0;
+	dns_diff_clear(&journal_diff);
+	CHECK(zr_get_zone_dbs(inst->zone_register, &entry->zone_name, &ldapdb, &rbtdb));
+	CHECK(dns_db_newversion(ldapdb, &version));
+
+	for (ev = HEAD(batch); ev != NULL; ev = NEXT(ev, link)) {
+		batch_len++;
+		result = update_record_diff(inst, ev, arena, rbtdb, version,
+					    &diff);
+		if (result == ISC_R_SUCCESS)
+			result = update_record_apply(&diff, rbtdb, version,
+						     &journal_diff);
+		ev->applied = ISC_TF(result == ISC_R_SUCCESS);
+		if (result == DNS_R_NOTLOADED || result == DNS_R_BADZONE) {
+			goto cleanup;
+		} else if (result != ISC_R_SUCCESS) {
+			/* skip this change and continue with the rest */
+			log_error_r("update_record (syncrepl) failed, %s "
+				    "change type 0x%x. Records can be "
+				    "outdated, run `rndc reload`",
+				    ldap_entry_logname(ev->entry),
+				    ev->chgtype);
+		}
+		dns_diff_clear(&diff);
+	}
+	/* skipped changes do not fail the whole batch */
+	result = ISC_R_SUCCESS;
+	if (batch_len > 1)
+		dns_zone_log(raw, ISC_LOG_DEBUG(5),
+			     "%u changes from LDAP processed as one "
+			     "update", batch_len);
+
+	sync_state_get(inst->sctx, &sync_state);
+	/* Zones restored from snapshots are already serving data so changes
+	 * have to be visible to secondaries even before initial
+	 * synchronization is finished. */
+	zone_live = (sync_state == sync_finished
+		     || (ldap_warm_start_get(inst) == ISC_TRUE
+			 && dns_zone_getserial2(raw, &serial) == ISC_R_SUCCESS));
+	/* No real change in RR data -> do not increment SOA serial. */
+	if (HEAD(journal_diff.tuples) != NULL) {
+		if (zone_live == ISC_TRUE) {
+			CHECK(zone_soaserial_addtuple(mctx, ldapdb, version,
+						      &diff, &serial));
+			CHECK(update_record_apply(&diff, rbtdb, version,
+						  &journal_diff));
+			dns_zone_log(raw, ISC_LOG_DEBUG(5),
+				     "writing new zone serial %u to LDAP",
+				     serial);
+			result = ldap_replace_serial(inst, &entry->zone_name, serial);
+			if (result != ISC_R_SUCCESS)
+				dns_zone_log(raw, ISC_LOG_ERROR,
+					     "serial (%u) write back to LDAP failed",
+					     serial);
+			/* write the transaction to journal */
+			CHECK(zone_journal_adddiff(inst->mctx, raw,
+						   &journal_diff));
+		}
+		/* commit */
+		dns_db_closeversion(ldapdb, &version, ISC_TRUE);
+		dns_zone_markdirty(raw);
+	}
+
+	/* Check if the zone is loaded or not.
+	 * No other function above returns DNS_R_NOTLOADED. */
+	if (sync_state == sync_finished)
+		result = dns_zone_getserial2(raw, &serial);
+
+cleanup:
+#ifdef RBTDB_DEBUG
+	if ((count + batch_len) / 100 != count / 100)
 		log_info("update_record: %u entries processed; inuse: %zd",
-			 count, isc_mem_inuse(mctx));
+			 count + batch_len, isc_mem_inuse(mctx));
+	count += batch_len;
 #endif
 	dns_diff_clear(&diff);
-	if (rbt_rds_iterator != NULL)
-		dns_rdatasetiter_destroy(&rbt_rds_iterator);
-	if (node != NULL)
-		dns_db_detachnode(rbtdb, &node);
 	/* rollback */
 	if (rbtdb != NULL && version != NULL)
 		dns_db_closeversion(ldapdb, &version, ISC_FALSE);
@@ -3994,27 +4851,37 @@ cleanup:
 	} else if (result != ISC_R_SUCCESS) {
 		/* error other than invalid zone */
 		log_error_r("update_record (syncrepl) failed, %s change type "
-			    "0x%x. Records can be outdated, run `rndc reload`",
-			    ldap_entry_logname(entry), pevent->chgtype);
+			    "0x%x and %u other changes in the same zone. "
+			    "Records can be outdated, run `rndc reload`",
+			    ldap_entry_logname(entry), pevent->chgtype,
+			    batch_len > 0 ? batch_len - 1 : 0);
 	}
+	dns_diff_clear(&journal_diff);
+	arena_destroy(&arena);
 
-	if (inst != NULL) {
-		sync_concurr_limit_signal(inst->sctx);
-		if (dns_name_dynamic(&prevname))
-			dns_name_free(&prevname, inst->mctx);
-		if (dns_name_dynamic(&prevorigin))
-			dns_name_free(&prevorigin, inst->mctx);
-	}
 	if (raw != NULL)
 		dns_zone_detach(&raw);
 	if (secure != NULL)
 		dns_zone_detach(&secure);
-	ldapdb_rdatalist_destroy(mctx, &rdatalist);
-	if (pevent->prevdn != NULL)
-		isc_mem_free(mctx, pevent->prevdn);
-	ldap_entry_destroy(&entry);
-	isc_mem_detach(&mctx);
-	isc_event_free(&event);
+	/* Release all events in the batch, the first one is pevent. */
+	for (ev = HEAD(batch); ev != NULL; ev = next_ev) {
+		next_ev = NEXT(ev, link);
+		UNLINK(batch, ev, link);
+		sync_concurr_limit_signal(inst->sctx, &ev->entry->zone_name,
+					  ev);
+		/* index has to match data in the zone */
+		if (result == ISC_R_SUCCESS && ev->applied == ISC_TRUE)
+			update_record_index(inst, ev);
+		else
+			syncrepl_event_failed(inst, ev);
+		if (ev->prevdn != NULL)
+			isc_mem_free(ev->mctx, ev->prevdn);
+		ldap_entry_destroy(&ev->entry);
+		mctx = ev->mctx;
+		isc_mem_detach(&mctx);
+		event = (isc_event_t *)ev;
+		isc_event_free(&event);
+	}
 	isc_task_detach(&task);
 }
 
@@ -4082,7 +4949,9 @@ syncrepl_update(ldap_instance_t *inst, ldap_entry_t **entryp, int chgtype)
 	char *dn = NULL;
 	isc_taskaction_t action = NULL;
 	isc_task_t *task = NULL;
-	isc_boolean_t synchronous;
+	isc_boolean_t dependency;
+	isc_boolean_t queued = ISC_FALSE;
+	dns_name_t *queue_zone = NULL;
 
 	REQUIRE(entryp != NULL);
 	entry = *entryp;
@@ -4102,15 +4971,25 @@ syncrepl_update(ldap_instance_t *inst, ldap_entry_t **entryp, int chgtype)
 	 * See discussion about run_exclusive_begin() function in lock.c. */
 	if ((entry->class & LDAP_ENTRYCLASS_RR) != 0 &&
 	    (entry->class & LDAP_ENTRYCLASS_MASTER) == 0) {
+		/* Zone object for the record might be still in the queue.
+		 * Template refresh is requested by configuration task
+		 * only for records which were loaded already and it cannot
+		 * wait for the configuration event it is sent from. */
+		if (entry->template_refresh == ISC_FALSE)
+			CHECK(sync_event_wait(inst->sctx, zone_name));
 		CHECK(zr_get_zone_ptr(inst->zone_register, zone_name,
 				      &zone_ptr, NULL));
 		dns_zone_gettask(zone_ptr, &task);
-		synchronous = ISC_FALSE;
+		dependency = ISC_FALSE;
+		/* Share queue fairly between zones. */
+		queue_zone = zone_name;
 	} else {
 		/* For configuration object and zone object use single task
-		 * to make sure that the exclusive mode actually works. */
+		 * to make sure that the exclusive mode actually works.
+		 * Events are not waited for, records which depend on them
+		 * wait in sync_event_wait(). */
 		isc_task_attach(inst->task, &task);
-		synchronous = ISC_TRUE;
+		dependency = ISC_TRUE;
 	}
 	REQUIRE(task != NULL);
 
@@ -4153,10 +5032,34 @@ syncrepl_update(ldap_instance_t *inst, ldap_entry_t **entryp, int chgtype)
 	pevent->prevdn = NULL;
 	pevent->chgtype = chgtype;
 	pevent->entry = entry;
+	pevent->size = sizeof(*pevent) + ldap_entry_size(entry);
+	pevent->applied = ISC_FALSE;
+
+	/* Limit memory occupied by events waiting in task queues. */
+	CHECK(sync_concurr_limit_wait(inst->sctx, queue_zone, pevent));
+	queued = ISC_TRUE;
+
+	/* Merge consecutive changes in a zone into single zone update
+	 * and share task queues fairly between zones. */
+	if (queue_zone != NULL) {
+		result = sync_batch_add(inst->sctx, queue_zone, task, pevent);
+		if (result == ISC_R_SUCCESS) {
+			pevent = NULL;
+			/* event handler will deallocate the entry */
+			*entryp = NULL;
+			isc_task_detach(&task);
+			goto cleanup;
+		}
+		/* Queued change of the same entry got the new state,
+		 * drop the old state. */
+		INSIST(result == ISC_R_EXISTS);
+		*entryp = pevent->entry;
+		CLEANUP_WITH(ISC_R_SUCCESS);
+	}
 
-	/* Lock syncrepl queue to prevent zone, config and resource records
-	 * from racing with each other. */
-	CHECK(sync_event_send(inst->sctx, task, &pevent, synchronous));
+	/* Track zone and config events to prevent resource records
+	 * from racing with them. */
+	CHECK(sync_event_send(inst->sctx, task, &pevent, dependency));
 	*entryp = NULL; /* event handler will deallocate the LDAP entry */
 
 cleanup:
@@ -4167,10 +5070,13 @@ cleanup:
 			    ldap_entry_logname(entry));
 	if (pevent != NULL) {
 		/* Event was not sent */
-		sync_concurr_limit_signal(inst->sctx);
+		if (queued == ISC_TRUE)
+			sync_concurr_limit_signal(inst->sctx, queue_zone,
+						  pevent);
 		if (pevent->mctx != NULL)
 			isc_mem_detach(&pevent->mctx);
 		ldap_entry_destroy(entryp);
+		isc_event_free((isc_event_t **)&pevent);
 		if (task != NULL)
 			isc_task_detach(&task);
 	}
@@ -4183,68 +5089,494 @@ cleanup:
 			goto cleanup; \
 	} while (0)
 
+/**
+ * Initialize SyncRepl session state including the pipe used
+ * by ldap_sync_wakeup().
+ */
+static isc_result_t
+ldap_sync_session_init(ldap_instance_t *inst, unsigned int shard,
+		       ldap_sync_session_t *sess) {
+	isc_result_t result;
+	int i;
+
+	ZERO_PTR(sess);
+	sess->fd = -1;
+	sess->wakeup[0] = sess->wakeup[1] = -1;
+	CHECK(isc_mutex_init(&sess->lock));
+	sess->inst = inst;
+	sess->shard = shard;
+	if (shard > 0)
+		CHECK(isc_ht_init(&sess->zones_missing, inst->mctx, 4));
+
+	if (pipe(sess->wakeup) != 0) {
+		sess->wakeup[0] = sess->wakeup[1] = -1;
+		CLEANUP_WITH(isc_errno_toresult(errno));
+	}
+	/* Wake up is level-triggered, full pipe already wakes up. */
+	for (i = 0; i < 2; i++) {
+		if (fcntl(sess->wakeup[i], F_SETFL, O_NONBLOCK) != 0)
+			CLEANUP_WITH(isc_errno_toresult(errno));
+	}
+
+cleanup:
+	if (result != ISC_R_SUCCESS)
+		log_error_r("unable to initialize SyncRepl session %u", shard);
+	return result;
+}
+
+static void
+ldap_sync_session_destroy(ldap_sync_session_t *sess) {
+	int i;
+
+	if (sess->inst == NULL)
+		return;
+
+	for (i = 0; i < 2; i++) {
+		if (sess->wakeup[i] >= 0)
+			close(sess->wakeup[i]);
+		sess->wakeup[i] = -1;
+	}
+	DESTROYLOCK(&sess->lock);
+	if (sess->zones_missing != NULL)
+		isc_ht_destroy(&sess->zones_missing);
+	sess->inst = NULL;
+}
+
+/**
+ * Wake up thread running the session. It has to re-check inst->exiting,
+ * sess->stop and sess->abort flags which must be set before this call.
+ *
+ * A session blocked inside libldap cannot be woken up by the pipe so
+ * its LDAP socket is shut down and the session fails immediately.
+ */
+static void
+ldap_sync_wakeup(ldap_sync_session_t *sess) {
+	char c = 0;
+
+	if (sess->inst == NULL)
+		return;
+
+	LOCK(&sess->lock);
+	if (sess->fd >= 0)
+		(void)shutdown(sess->fd, SHUT_RDWR);
+	UNLOCK(&sess->lock);
+
+	/* EAGAIN: pipe is full and will wake up the session anyway. */
+	if (write(sess->wakeup[1], &c, 1) != 1 && errno != EAGAIN)
+		log_error("unable to wake up SyncRepl session %u: %s",
+			  sess->shard, isc_result_totext(
+					isc_errno_toresult(errno)));
+}
+
+/**
+ * Remember LDAP socket used by the session so ldap_sync_wakeup() can
+ * interrupt it. -1 forgets the socket before it is closed.
+ *
+ * @retval ISC_TRUE Session was already asked to end.
+ */
+static isc_boolean_t ATTR_NONNULLS ATTR_CHECKRESULT
+ldap_sync_fd_set(ldap_sync_session_t *sess, int fd) {
+	ldap_instance_t *inst = sess->inst;
+
+	LOCK(&sess->lock);
+	sess->fd = fd;
+	UNLOCK(&sess->lock);
+
+	/* Flags are set before ldap_sync_wakeup() locks sess->lock. */
+	return ISC_TF(inst->exiting || sess->stop || sess->abort);
+}
+
+/**
+ * Wait until LDAP socket has data to read, timeout expires or the session
+ * is woken up by ldap_sync_wakeup().
+ *
+ * @param[in] fd         LDAP socket or -1 to wait for wake up only.
+ * @param[in] timeout_ms Timeout in milliseconds, -1 waits forever.
+ *
+ * @retval ISC_R_SUCCESS  Socket is ready to be read (or it failed).
+ * @retval ISC_R_CANCELED Session was woken up.
+ * @retval ISC_R_TIMEDOUT Timeout expired.
+ */
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+ldap_sync_wait(ldap_sync_session_t *sess, int fd, int timeout_ms) {
+	struct pollfd fds[2];
+	nfds_t nfds = 1;
+	char buf[64];
+	int ret;
+
+	fds[0].fd = sess->wakeup[0];
+	fds[0].events = POLLIN;
+	fds[0].revents = 0;
+	if (fd >= 0) {
+		fds[1].fd = fd;
+		fds[1].events = POLLIN;
+		fds[1].revents = 0;
+		nfds = 2;
+	}
+
+	do {
+		ret = poll(fds, nfds, timeout_ms);
+	} while (ret == -1 && errno == EINTR);
+	if (ret == -1)
+		return isc_errno_toresult(errno);
+	else if (ret == 0)
+		return ISC_R_TIMEDOUT;
+
+	if ((fds[0].revents & POLLIN) != 0) {
+		while (read(sess->wakeup[0], buf, sizeof(buf)) > 0)
+			; /* flags are re-checked by the caller */
+		return ISC_R_CANCELED;
+	}
+
+	return ISC_R_SUCCESS;
+}
+
 /*
- * This "sane" sleep allows us to end if signal set the "exiting" variable.
+ * Sleep which ends immediately when the session is woken up.
  *
- * Returns ISC_FALSE if we should terminate, ISC_TRUE otherwise.
+ * Returns ISC_FALSE if the session should terminate, ISC_TRUE otherwise.
  */
-static inline isc_boolean_t ATTR_NONNULLS
-sane_sleep(const ldap_instance_t *inst, unsigned int timeout)
+static isc_boolean_t ATTR_NONNULLS
+ldap_sync_sleep(ldap_sync_session_t *sess, unsigned int timeout)
 {
-	unsigned int remains = timeout;
+	ldap_instance_t *inst = sess->inst;
+	isc_result_t result;
 
-	while (remains && !inst->exiting)
-		remains = sleep(remains);
+	if (!inst->exiting && !sess->stop && !sess->abort) {
+		result = ldap_sync_wait(sess, -1, timeout * 1000);
+		if (result == ISC_R_CANCELED)
+			log_debug(99, "ldap_sync_sleep: interrupted");
+	}
 
-	if (remains)
-		log_debug(99, "sane_sleep: interrupted");
+	return (inst->exiting || sess->stop || sess->abort)
+		? ISC_FALSE : ISC_TRUE;
+}
 
-	return inst->exiting ? ISC_FALSE : ISC_TRUE;
+/*
+ * Called when a reference is returned by ldap_sync_init()/ldap_sync_poll().
+ */
+static int ATTR_NONNULLS ATTR_CHECKRESULT
+ldap_sync_search_reference (
+	ldap_sync_t			*ls,
+	LDAPMessage			*msg ) {
+
+	UNUSED(ls);
+	UNUSED(msg);
+
+	log_error("ldap_sync_search_reference is not yet handled");
+	return LDAP_SUCCESS;
 }
 
-/* No-op signal handler for SIGUSR1 */
-static void
-noop_handler(int signal)
-{
-	UNUSED(signal);
+/**
+ * Remember cookie from the data session so the next session can resume
+ * from it. Cookie is forgotten if some entry was not processed because
+ * the next session has to deliver it again, i.e. it has to do full refresh.
+ */
+static void ATTR_NONNULLS
+ldap_sync_cookie_keep(ldap_sync_session_t *sess, ldap_sync_t *ls) {
+	isc_result_t result;
+	ldap_instance_t *inst = sess->inst;
+
+	if (sess->failed == ISC_TRUE) {
+		log_debug(1, "some LDAP entries were not processed, "
+			  "next SyncRepl session will do full refresh");
+		sync_cookie_clear(inst->sctx);
+		return;
+	}
+
+	result = sync_cookie_set(inst->sctx, sess->shard, &ls->ls_cookie);
+	if (result != ISC_R_SUCCESS)
+		/* previous cookie is still valid, it just refers
+		 * to an older synchronization point */
+		log_error_r("unable to store SyncRepl cookie");
+}
+
+/**
+ * Construct path to the file with SyncRepl cookie of given data session.
+ * File names depend on number of record shards because cookies
+ * are not interchangeable between sessions with different filters.
+ */
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+ldap_sync_cookie_path(ldap_instance_t *inst, unsigned int session,
+		      ld_string_t *path) {
+	isc_result_t result;
+	const char *dir = NULL;
+
+	CHECK(setting_get_str("directory", inst->local_settings, &dir));
+	if (inst->sync_shards == 0)
+		CHECK(str_sprintf(path, "%s%s", dir, LDAP_SYNC_COOKIE_FILE));
+	else
+		CHECK(str_sprintf(path, "%s%s.%u.%u", dir,
+				  LDAP_SYNC_COOKIE_FILE, inst->sync_shards,
+				  session));
+
+cleanup:
+	return result;
+}
+
+/**
+ * Save metaLDAP, the SyncRepl cookies and zone snapshots into the instance
+ * working directory. The state is used only by warm start so nothing is
+ * saved if warm_start is disabled.
+ *
+ * Snapshots and metaLDAP are written first so crash between the writes
+ * leaves older cookies on disk. Resuming from an older cookie is safe
+ * because all changes will be delivered again.
+ *
+ * Zone snapshots have to match metaLDAP, e.g. deletion of a record
+ * which is still in a snapshot would be ignored after restart if metaLDAP
+ * did not know the record anymore. Nothing can change metaLDAP or zones
+ * while the state is saved: record shards wait in refresh done handler
+ * until the state is saved and all other sessions are stopped on unload.
+ */
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+ldap_sync_state_save(ldap_instance_t *inst) {
+	isc_result_t result;
+	const char *dir = NULL;
+	ld_string_t *path = NULL;
+	struct berval cookies[SYNC_SHARDS_MAX + 1];
+	sync_state_t state;
+	isc_boolean_t warm_start;
+	unsigned int i;
+
+	memset(cookies, 0, sizeof(cookies));
+	CHECK(setting_get_bool("warm_start", inst->local_settings,
+			       &warm_start));
+	if (warm_start == ISC_FALSE)
+		return ISC_R_SUCCESS;
+
+	/* metaLDAP content is not complete until initial synchronization
+	 * is finished */
+	sync_state_get(inst->sctx, &state);
+	if (state != sync_finished)
+		return ISC_R_SUCCESS;
+
+	for (i = 0; i <= inst->sync_shards; i++) {
+		result = sync_cookie_get(inst->sctx, i, &cookies[i]);
+		if (result == ISC_R_NOTFOUND)
+			CLEANUP_WITH(ISC_R_SUCCESS);
+		else if (result != ISC_R_SUCCESS)
+			goto cleanup;
+
+		if (cookies[i].bv_len > LDAP_SYNC_COOKIE_MAXLEN) {
+			log_error("SyncRepl cookie is longer than %u bytes, "
+				  "unable to save it", LDAP_SYNC_COOKIE_MAXLEN);
+			CLEANUP_WITH(ISC_R_NOSPACE);
+		}
+	}
+
+	/* Zone content has to include all changes up to the cookie. */
+	result = sync_concurr_limit_drain(inst->sctx);
+	if (result != ISC_R_SUCCESS) {
+		log_error_r("unable to wait for processing of all LDAP changes");
+		goto cleanup;
+	}
+	CHECK(zone_snapshots_save(inst));
+
+	CHECK(setting_get_str("directory", inst->local_settings, &dir));
+	CHECK(str_new(inst->mctx, &path));
+	CHECK(str_sprintf(path, "%s%s", dir, LDAP_SYNC_MLDAP_FILE));
+	CHECK(mldap_save(inst->mldapdb, str_buf(path)));
+	for (i = 0; i <= inst->sync_shards; i++) {
+		CHECK(ldap_sync_cookie_path(inst, i, path));
+		CHECK(fs_file_write(str_buf(path), cookies[i].bv_val,
+				    cookies[i].bv_len));
+	}
+	log_debug(1, "SyncRepl state for instance '%s' saved", inst->db_name);
+
+cleanup:
+	for (i = 0; i <= SYNC_SHARDS_MAX; i++) {
+		if (cookies[i].bv_val != NULL)
+			ber_memfree(cookies[i].bv_val);
+	}
+	str_destroy(&path);
+	return result;
+}
+
+/**
+ * Load metaLDAP and the SyncRepl cookies saved by ldap_sync_state_save().
+ * Zones will be restored from snapshots and the first data sessions will
+ * resume from the loaded cookies.
+ *
+ * @retval ISC_R_FILENOTFOUND No state was saved yet.
+ */
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+ldap_sync_state_load(ldap_instance_t *inst) {
+	isc_result_t result;
+	const char *dir = NULL;
+	ld_string_t *path = NULL;
+	char cookie_buf[LDAP_SYNC_COOKIE_MAXLEN];
+	size_t cookie_len = 0;
+	struct berval cookie;
+	unsigned int i;
+
+	CHECK(str_new(inst->mctx, &path));
+	for (i = 0; i <= inst->sync_shards; i++) {
+		CHECK(ldap_sync_cookie_path(inst, i, path));
+		CHECK(fs_file_read(str_buf(path), cookie_buf,
+				   sizeof(cookie_buf), &cookie_len));
+		cookie.bv_val = cookie_buf;
+		cookie.bv_len = cookie_len;
+		CHECK(sync_cookie_set(inst->sctx, i, &cookie));
+	}
+	CHECK(setting_get_str("directory", inst->local_settings, &dir));
+	CHECK(str_sprintf(path, "%s%s", dir, LDAP_SYNC_MLDAP_FILE));
+	CHECK(mldap_load(inst->mldapdb, str_buf(path)));
+	ldap_warm_start_set(inst, ISC_TRUE);
+
+cleanup:
+	if (result != ISC_R_SUCCESS)
+		sync_cookie_clear(inst->sctx);
+	str_destroy(&path);
+	return result;
+}
+
+/**
+ * Add tasks of all zones in the zone register to the list of tasks
+ * which have to reach the data barrier. Zones restored from snapshots
+ * were created before the configuration barrier and thus are not
+ * on the list yet.
+ */
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+zone_tasks_add(ldap_instance_t *inst) {
+	isc_result_t result;
+	rbt_iterator_t *iter = NULL;
+	DECLARE_BUFFERED_NAME(name);
+	dns_zone_t *raw = NULL;
+	dns_zone_t *secure = NULL;
+	isc_task_t *task = NULL;
+
+	INIT_BUFFERED_NAME(name);
+	for (result = zr_rbt_iter_init(inst->zone_register, &iter, &name);
+	     result == ISC_R_SUCCESS;
+	     dns_name_reset(&name), result = rbt_iter_next(&iter, &name)) {
+		CHECK(zr_get_zone_ptr(inst->zone_register, &name,
+				      &raw, &secure));
+		dns_zone_gettask(raw, &task);
+		CHECK(sync_task_add(inst->sctx, task));
+		isc_task_detach(&task);
+		if (secure != NULL) {
+			dns_zone_gettask(secure, &task);
+			CHECK(sync_task_add(inst->sctx, task));
+			isc_task_detach(&task);
+			dns_zone_detach(&secure);
+		}
+		dns_zone_detach(&raw);
+	}
+	if (result == ISC_R_NOTFOUND || result == ISC_R_NOMORE)
+		result = ISC_R_SUCCESS;
+
+cleanup:
+	rbt_iter_stop(&iter);
+	if (task != NULL)
+		isc_task_detach(&task);
+	if (secure != NULL)
+		dns_zone_detach(&secure);
+	if (raw != NULL)
+		dns_zone_detach(&raw);
+	return result;
 }
 
-static inline void
-install_usr1handler(void)
-{
-	struct sigaction sa;
-	struct sigaction oldsa;
-	int ret;
-	static isc_boolean_t once = ISC_FALSE;
+/**
+ * Record shards run in parallel with the session which synchronizes zones
+ * so a new record can arrive before its zone was created. Give the zone
+ * session a chance to catch up before the record is processed.
+ *
+ * All zones existing before refresh phase are created before record shards
+ * are started so waiting is necessary only in persist phase.
+ *
+ * Zone which did not appear in time, e.g. disabled zone, is remembered
+ * and records of it do not wait again until the zone appears.
+ */
+static void ATTR_NONNULLS
+ldap_sync_zone_wait(ldap_sync_session_t *sess, dns_name_t *zone_name) {
+	ldap_instance_t *inst = sess->inst;
+	dns_zone_t *raw = NULL;
+	DECLARE_BUFFERED_NAME(key);
+	void *dummy = NULL;
+	isc_boolean_t missing;
+	char zone_txt[DNS_NAME_FORMATSIZE];
+	unsigned int i;
 
-	if (once)
+	if (sess->refreshed == ISC_FALSE)
 		return;
 
-	memset(&sa, 0, sizeof(sa));
-	sa.sa_handler = &noop_handler;
-
-	ret = sigaction(SIGUSR1, &sa, &oldsa);
-	RUNTIME_CHECK(ret == 0); /* If sigaction fails, it's a bug */
-
-	/* Don't attempt to replace already existing handler */
-	RUNTIME_CHECK(oldsa.sa_handler == NULL);
+	INIT_BUFFERED_NAME(key);
+	if (dns_name_downcase(zone_name, &key, NULL) != ISC_R_SUCCESS)
+		return;
+	missing = ISC_TF(isc_ht_find(sess->zones_missing, key.ndata,
+				     key.length, &dummy) == ISC_R_SUCCESS);
+
+	for (i = 0; i < LDAP_SYNC_ZONE_WAIT; i++) {
+		/* Zone event might be queued already. */
+		if (sync_event_wait(inst->sctx, zone_name) != ISC_R_SUCCESS)
+			return;
+		if (zr_get_zone_ptr(inst->zone_register, zone_name, &raw, NULL)
+		    == ISC_R_SUCCESS) {
+			dns_zone_detach(&raw);
+			if (missing == ISC_TRUE)
+				(void)isc_ht_delete(sess->zones_missing,
+						    key.ndata, key.length);
+			return;
+		}
+		if (missing == ISC_TRUE)
+			return;
+		if (!ldap_sync_sleep(sess, 1))
+			return;
+	}
 
-	once = ISC_TRUE;
+	dns_name_format(zone_name, zone_txt, DNS_NAME_FORMATSIZE);
+	log_debug(1, "SyncRepl record shard %u: zone '%s' did not appear "
+		  "in %u seconds, its records will not wait anymore",
+		  sess->shard, zone_txt, LDAP_SYNC_ZONE_WAIT);
+	if (isc_ht_add(sess->zones_missing, key.ndata, key.length, NULL)
+	    != ISC_R_SUCCESS)
+		log_error("SyncRepl record shard %u: unable to remember "
+			  "missing zone '%s'", sess->shard, zone_txt);
 }
 
-/*
- * Called when a reference is returned by ldap_sync_init()/ldap_sync_poll().
+/**
+ * Construct LDAP filter for given record shard. Records are partitioned
+ * by value of their entryUUID attribute which is effectively random and
+ * never changes, not even when the record is renamed, so each record
+ * belongs to exactly one shard for its whole life.
+ *
+ * The first 6 bits of entryUUID select one of LDAP_SYNC_SHARD_BUCKETS
+ * ranges and the ranges are assigned to shards round-robin. Interleaved
+ * ranges spread also records which were created at the same time
+ * and thus have similar time-based UUIDs.
+ *
+ * The LDAP server has to support ordering matching rule for entryUUID.
  */
-static int ATTR_NONNULLS ATTR_CHECKRESULT
-ldap_sync_search_reference (
-	ldap_sync_t			*ls,
-	LDAPMessage			*msg ) {
-
-	UNUSED(ls);
-	UNUSED(msg);
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+ldap_sync_shard_filter(ldap_instance_t *inst, unsigned int shard,
+		       ld_string_t *filter) {
+	isc_result_t result;
+	char term[sizeof("(&(entryUUID>=xx000000-0000-0000-0000-000000000000)"
+			 "(entryUUID<=xxffffff-ffff-ffff-ffff-ffffffffffff))")];
+	unsigned int bucket;
+	unsigned int first;
+
+	REQUIRE(shard > 0 && shard <= inst->sync_shards);
+
+	CHECK(str_cat_char(filter, "(&(objectClass=idnsRecord)"
+				   "(!(objectClass=idnsZone))(|"));
+	for (bucket = shard - 1; bucket < LDAP_SYNC_SHARD_BUCKETS;
+	     bucket += inst->sync_shards) {
+		first = bucket * (256 / LDAP_SYNC_SHARD_BUCKETS);
+		CHECK(isc_string_printf(term, sizeof(term),
+				"(&(entryUUID>=%02x000000-0000-0000-0000-"
+				"000000000000)"
+				"(entryUUID<=%02xffffff-ffff-ffff-ffff-"
+				"ffffffffffff))",
+				first,
+				first + 256 / LDAP_SYNC_SHARD_BUCKETS - 1));
+		CHECK(str_cat_char(filter, term));
+	}
+	CHECK(str_cat_char(filter, "))"));
 
-	log_error("ldap_sync_search_reference is not yet handled");
-	return LDAP_SUCCESS;
+cleanup:
+	return result;
 }
 
 /*
@@ -4261,13 +5593,17 @@ int ldap_sync_search_entry (
 	struct berval			*entryUUID,
 	ldap_sync_refresh_t		phase ) {
 
-	ldap_instance_t *inst = ls->ls_private;
+	ldap_sync_session_t *sess = ls->ls_private;
+	ldap_instance_t *inst = sess->inst;
 	ldap_entry_t *old_entry = NULL;
 	ldap_entry_t *new_entry = NULL;
 	isc_result_t result;
 	metadb_node_t *node = NULL;
 	isc_boolean_t mldap_open = ISC_FALSE;
 	isc_boolean_t modrdn = ISC_FALSE;
+	isc_boolean_t unchanged;
+	ldap_entryclass_t class;
+	sync_state_t state;
 
 #ifdef RBTDB_DEBUG
 	static unsigned int count = 0;
@@ -4276,21 +5612,72 @@ int ldap_sync_search_entry (
 	if (inst->exiting)
 		return LDAP_SUCCESS;
 
+	/* Parse the entry before metaDB is locked so record shards
+	 * do not serialize on it. */
+	if (phase == LDAP_SYNC_CAPI_ADD || phase == LDAP_SYNC_CAPI_MODIFY) {
+		CHECK(ldap_entry_parse(inst->mctx, ls->ls_ld, msg, entryUUID,
+				       &new_entry));
+	}
+
 	CHECK(mldap_newversion(inst->mldapdb));
 	mldap_open = ISC_TRUE;
 
-	CHECK(sync_concurr_limit_wait(inst->sctx));
+	if (phase == LDAP_SYNC_CAPI_PRESENT) {
+		/* Entry did not change since the cookie was issued,
+		 * keep it alive so the dead node sweep will not delete it. */
+		sess->presents = ISC_TRUE;
+		CHECK(mldap_entry_touch(inst->mldapdb, entryUUID));
+		goto cleanup;
+	}
+
 	log_debug(20, "ldap_sync_search_entry phase: %x", phase);
 
+	/* Refresh after reconnect reports all changed entries as ADD and
+	 * delete phase can report entries which were never seen here.
+	 * Use metaDB to find out what really happened. */
+	if (phase == LDAP_SYNC_CAPI_ADD || phase == LDAP_SYNC_CAPI_DELETE) {
+		result = mldap_entry_read(inst->mldapdb, entryUUID, &node);
+		if (result == ISC_R_SUCCESS)
+			result = mldap_class_get(node, &class);
+		metadb_node_close(&node);
+		if (result == ISC_R_SUCCESS && phase == LDAP_SYNC_CAPI_ADD) {
+			phase = LDAP_SYNC_CAPI_MODIFY;
+		} else if (result == ISC_R_NOTFOUND
+			   && phase == LDAP_SYNC_CAPI_DELETE
+			   && sess->resumed == ISC_TRUE) {
+			log_debug(1, "ignoring deletion of unknown LDAP entry");
+			CLEANUP_WITH(ISC_R_SUCCESS);
+		} else if (result != ISC_R_SUCCESS
+			   && result != ISC_R_NOTFOUND) {
+			goto cleanup;
+		}
+	}
+
+	/* Changes of attributes which are not used by this plugin, e.g. ACIs,
+	 * do not need to be processed. Full refresh processes all entries
+	 * so inconsistencies can be repaired by it. */
+	if (phase == LDAP_SYNC_CAPI_MODIFY
+	    && (sess->resumed == ISC_TRUE || sess->refreshed == ISC_TRUE)) {
+		sync_state_get(inst->sctx, &state);
+		if (state == sync_finished) {
+			CHECK(mldap_entry_unchanged(inst->mldapdb, new_entry,
+						    &unchanged));
+			if (unchanged == ISC_TRUE) {
+				log_debug(20, "ignoring modification of %s "
+					  "without change in DNS attributes",
+					  ldap_entry_logname(new_entry));
+				CHECK(mldap_entry_touch(inst->mldapdb,
+							entryUUID));
+				goto cleanup;
+			}
+		}
+	}
+
 	/* MODIFY can be rename: get old name from metaDB */
 	if (phase == LDAP_SYNC_CAPI_DELETE || phase == LDAP_SYNC_CAPI_MODIFY) {
 		CHECK(ldap_entry_reconstruct(inst->mctx, inst->mldapdb,
 					     entryUUID, &old_entry));
 	}
-	if (phase == LDAP_SYNC_CAPI_ADD || phase == LDAP_SYNC_CAPI_MODIFY) {
-		CHECK(ldap_entry_parse(inst->mctx, ls->ls_ld, msg, entryUUID,
-				       &new_entry));
-	}
 	/* detect type of modification */
 	if (phase == LDAP_SYNC_CAPI_MODIFY) {
 		if (old_entry->class != new_entry->class)
@@ -4317,8 +5704,18 @@ int ldap_sync_search_entry (
 		}
 	}
 	if (phase == LDAP_SYNC_CAPI_DELETE || modrdn == ISC_TRUE) {
+		/* Queueing can block so do not hold metaDB which is shared
+		 * with other shards. The entry is synchronized only by this
+		 * session so it cannot change in the meantime. metaDB is
+		 * changed only after the deletion was queued so failure
+		 * does not leave record in the zone without its entry
+		 * in metaDB. */
+		mldap_closeversion(inst->mldapdb, ISC_FALSE);
+		mldap_open = ISC_FALSE;
 		/* delete old entry from zone and metaDB */
 		CHECK(syncrepl_update(inst, &old_entry, LDAP_SYNC_CAPI_DELETE));
+		CHECK(mldap_newversion(inst->mldapdb));
+		mldap_open = ISC_TRUE;
 		CHECK(mldap_entry_delete(inst->mldapdb, entryUUID));
 	}
 	if (phase == LDAP_SYNC_CAPI_ADD || phase == LDAP_SYNC_CAPI_MODIFY) {
@@ -4333,10 +5730,17 @@ int ldap_sync_search_entry (
 		metadb_node_close(&node);
 		mldap_closeversion(inst->mldapdb, ISC_TRUE);
 		mldap_open = ISC_FALSE;
+		if (sess->shard > 0)
+			ldap_sync_zone_wait(sess, &new_entry->zone_name);
 		/* re-add entry under new DN, if necessary */
-		CHECK(syncrepl_update(inst, &new_entry,
-		                      (modrdn == ISC_TRUE)
-					      ? LDAP_SYNC_CAPI_ADD : phase));
+		result = syncrepl_update(inst, &new_entry,
+					 (modrdn == ISC_TRUE)
+					 ? LDAP_SYNC_CAPI_ADD : phase);
+		if (result != ISC_R_SUCCESS) {
+			/* fingerprint is committed already */
+			mldap_entry_failed(inst->mldapdb, entryUUID);
+			goto cleanup;
+		}
 	}
 	if (phase != LDAP_SYNC_CAPI_ADD && phase != LDAP_SYNC_CAPI_MODIFY &&
 	    phase != LDAP_SYNC_CAPI_DELETE) {
@@ -4357,7 +5761,8 @@ cleanup:
 		mldap_closeversion(inst->mldapdb, ISC_TF(result == ISC_R_SUCCESS));
 	if (result != ISC_R_SUCCESS) {
 		log_error_r("ldap_sync_search_entry failed");
-		sync_concurr_limit_signal(inst->sctx);
+		/* do not resume next SyncRepl session from current cookie */
+		sess->failed = ISC_TRUE;
 		/* TODO: Add 'tainted' flag to the LDAP instance. */
 	}
 	ldap_entry_destroy(&old_entry);
@@ -4369,6 +5774,277 @@ cleanup:
 	return LDAP_SUCCESS;
 }
 
+/**
+ * Decide if dead node detection has to be done after refresh phase
+ * of all data sessions.
+ *
+ * Refresh resumed from cookie without present phase reported deleted
+ * entries explicitly. Entries which were not mentioned did not change
+ * so they have old generation number but they are not dead.
+ *
+ * @retval ISC_R_SUCCESS Sweep parameter is set.
+ * @retval ISC_R_FAILURE Some sessions reported deleted entries explicitly
+ *                       and some did not. Dead entries cannot be detected,
+ *                       full refresh is required.
+ */
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+ldap_sync_sweep_needed(ldap_instance_t *inst, isc_boolean_t *sweep) {
+	ldap_sync_session_t *sess;
+	unsigned int deletes = 0;
+	unsigned int i;
+
+	for (i = 0; i <= inst->sync_shards; i++) {
+		sess = &inst->sync_sessions[i];
+		if (sess->resumed == ISC_TRUE && sess->presents == ISC_FALSE)
+			deletes++;
+	}
+
+	if (deletes == 0)
+		*sweep = ISC_TRUE;
+	else if (deletes == inst->sync_shards + 1)
+		*sweep = ISC_FALSE;
+	else
+		return ISC_R_FAILURE;
+
+	return ISC_R_SUCCESS;
+}
+
+/**
+ * Thread running one record shard session. The shard runs until
+ * the watcher stops it or until its session fails. In polling mode, the shard
+ * ends when its refresh is done. Failed shard cannot recover on its own
+ * because dead node detection has to cover all sessions, so all data sessions
+ * are restarted by the watcher.
+ */
+static isc_threadresult_t
+ldap_sync_shard(isc_threadarg_t arg) {
+	ldap_sync_session_t *sess = (ldap_sync_session_t *)arg;
+	ldap_instance_t *inst = sess->inst;
+	ldap_connection_t *conn = NULL;
+	ld_string_t *filter = NULL;
+	isc_result_t result;
+	isc_uint32_t poll_interval;
+
+	log_debug(1, "Entering SyncRepl record shard %u", sess->shard);
+
+	CHECK(setting_get_uint("sync_poll_interval", inst->local_settings,
+			       &poll_interval));
+	CHECK(str_new(inst->mctx, &filter));
+	CHECK(ldap_sync_shard_filter(inst, sess->shard, filter));
+	CHECK(ldap_pool_getconnection(inst->pool, &conn));
+	CHECK(ldap_connect(inst, conn, ISC_TRUE));
+	result = ldap_sync_doit(inst, sess, conn, str_buf(filter),
+				(poll_interval > 0) ? LDAP_SYNC_REFRESH_ONLY
+						    : LDAP_SYNC_REFRESH_AND_PERSIST,
+				ISC_TRUE);
+
+cleanup:
+	if (sess->refreshed == ISC_FALSE) {
+		sync_shard_done(inst->sctx, ISC_FALSE);
+	} else if (!inst->exiting && sess->stop == ISC_FALSE
+		   /* finished poll is not a failure */
+		   && (sess->polling == ISC_FALSE || result != ISC_R_SUCCESS)) {
+		log_error("SyncRepl record shard %u for instance '%s' ended, "
+			  "restarting LDAP data synchronization",
+			  sess->shard, inst->db_name);
+		inst->sync_sessions[0].abort = ISC_TRUE;
+		ldap_sync_wakeup(&inst->sync_sessions[0]);
+	}
+	ldap_pool_putconnection(inst->pool, &conn);
+	str_destroy(&filter);
+	log_debug(1, "Ending SyncRepl record shard %u", sess->shard);
+
+	return (isc_threadresult_t)0;
+}
+
+/**
+ * Start threads for all record shards.
+ */
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+ldap_sync_shards_start(ldap_instance_t *inst) {
+	isc_result_t result = ISC_R_SUCCESS;
+	ldap_sync_session_t *sess;
+	unsigned int i;
+
+	sync_shards_reset(inst->sctx);
+	for (i = 1; i <= inst->sync_shards; i++) {
+		sess = &inst->sync_sessions[i];
+		INSIST(sess->thread == 0);
+		sess->stop = ISC_FALSE;
+		sess->refreshed = ISC_FALSE;
+		result = isc_thread_create(ldap_sync_shard, sess,
+					   &sess->thread);
+		if (result != ISC_R_SUCCESS) {
+			sess->thread = 0;
+			log_error_r("failed to create SyncRepl record shard "
+				    "thread");
+			break;
+		}
+	}
+
+	return result;
+}
+
+/**
+ * Stop all running record shards and wait until their threads end.
+ */
+static void ATTR_NONNULLS
+ldap_sync_shards_stop(ldap_instance_t *inst) {
+	ldap_sync_session_t *sess;
+	unsigned int i;
+
+	/* Shards might wait for session 0 which is not going to save
+	 * the state anymore. */
+	sync_shards_release(inst->sctx);
+	for (i = 1; i <= inst->sync_shards; i++) {
+		sess = &inst->sync_sessions[i];
+		if (sess->thread == 0)
+			continue;
+		sess->stop = ISC_TRUE;
+		ldap_sync_wakeup(sess);
+		RUNTIME_CHECK(isc_thread_join(sess->thread, NULL)
+			      == ISC_R_SUCCESS);
+		sess->thread = 0;
+	}
+}
+
+/**
+ * Keep alive all entries listed in syncIdSet with refreshDeletes = FALSE,
+ * i.e. entries which did not change since the cookie was issued.
+ * The whole set is processed in single metaDB version so the metaDB lock
+ * is not acquired for every entry. Unknown entries are reported but
+ * they do not prevent other entries from being kept alive.
+ */
+static void ATTR_NONNULLS
+ldap_sync_present_idset(ldap_sync_session_t *sess, BerVarray syncUUIDs) {
+	isc_result_t result;
+	ldap_instance_t *inst = sess->inst;
+	unsigned int i;
+
+	sess->presents = ISC_TRUE;
+	CHECK(mldap_newversion(inst->mldapdb));
+	for (i = 0; syncUUIDs[i].bv_val != NULL; i++) {
+		result = mldap_entry_touch(inst->mldapdb, &syncUUIDs[i]);
+		if (result != ISC_R_SUCCESS) {
+			log_error_r("unable to process entry from syncIdSet");
+			/* do not resume next SyncRepl session from
+			 * current cookie */
+			sess->failed = ISC_TRUE;
+		}
+	}
+	mldap_closeversion(inst->mldapdb, ISC_TRUE);
+	result = ISC_R_SUCCESS;
+
+cleanup:
+	if (result != ISC_R_SUCCESS) {
+		log_error_r("unable to process syncIdSet");
+		sess->failed = ISC_TRUE;
+	}
+}
+
+/**
+ * Finish refresh phase of a data session. Shards report that they are
+ * done and wait until session 0 releases them. Session 0 starts the shards
+ * and waits for them, finishes initial synchronization, deletes entries
+ * which were not seen during the refresh, saves the synchronization state
+ * and then lets the shards continue with persist phase.
+ *
+ * This is called when refreshDone is received in refreshAndPersist mode
+ * and when searchResultDone is received by a polling session.
+ */
+static void ATTR_NONNULLS
+ldap_sync_refresh_done(ldap_sync_t *ls, ldap_sync_session_t *sess) {
+	isc_result_t result;
+	ldap_instance_t *inst = sess->inst;
+	char entryUUID_buf[16];
+	struct berval entryUUID = { .bv_len = sizeof(entryUUID_buf),
+				    .bv_val = entryUUID_buf };
+	sync_state_t state;
+	isc_boolean_t initial;
+	isc_boolean_t sweep;
+
+	if (sess->shard > 0) {
+		/* Session 0 waits for all shards, then it does dead node
+		 * detection and saves the state. Persist phase must not
+		 * change anything until the state is saved. */
+		sess->refreshed = ISC_TRUE;
+		ldap_sync_cookie_keep(sess, ls);
+		sync_shard_done(inst->sctx, ISC_TRUE);
+		if (sess->polling == ISC_FALSE
+		    && sync_shard_release_wait(inst->sctx) != ISC_R_SUCCESS)
+			log_debug(1, "SyncRepl record shard %u was not "
+				  "released, instance is exiting",
+				  sess->shard);
+		return;
+	}
+
+	/* Records are synchronized by shards only after all zones exist. */
+	if (inst->sync_shards > 0) {
+		result = ldap_sync_shards_start(inst);
+		if (result == ISC_R_SUCCESS)
+			result = sync_shards_wait(inst->sctx, inst->sync_shards);
+		if (result != ISC_R_SUCCESS) {
+			log_error_r("SyncRepl record shards for instance '%s' "
+				    "failed", inst->db_name);
+			sess->abort = ISC_TRUE;
+			goto cleanup;
+		}
+	}
+
+	result = ldap_sync_sweep_needed(inst, &sweep);
+	if (result != ISC_R_SUCCESS) {
+		log_info("SyncRepl sessions for instance '%s' did not agree "
+			 "on refresh method, restarting with full refresh",
+			 inst->db_name);
+		sync_cookie_clear(inst->sctx);
+		sess->abort = ISC_TRUE;
+		goto cleanup;
+	}
+
+	sync_state_get(inst->sctx, &state);
+	initial = ISC_TF(state == sync_datainit);
+	if (initial == ISC_TRUE) {
+		result = sync_barrier_wait(inst->sctx, inst);
+		if (result != ISC_R_SUCCESS) {
+			log_error_r("%s: sync_barrier_wait() failed for "
+				    "instance '%s'", __func__, inst->db_name);
+			goto cleanup;
+		}
+	}
+
+	if (sweep == ISC_FALSE) {
+		log_debug(1, "SyncRepl refresh used delete phase, "
+			  "skipping dead node detection");
+	} else {
+		for (result = mldap_iter_deadnodes_start(inst->mldapdb,
+							 &entryUUID);
+		     result == ISC_R_SUCCESS;
+		     result = mldap_iter_deadnodes_next(inst->mldapdb,
+							&entryUUID)) {
+			ldap_sync_search_entry(ls, NULL, &entryUUID,
+					       LDAP_SYNC_CAPI_DELETE);
+
+		}
+		INSIST(result == ISC_R_NOMORE);
+	}
+
+	sess->refreshed = ISC_TRUE;
+	ldap_sync_cookie_keep(sess, ls);
+	/* Polls are too frequent to save the state every time, the state
+	 * is saved again when the instance is unloaded. */
+	if (sess->polling == ISC_TRUE && initial == ISC_FALSE)
+		goto cleanup;
+	result = ldap_sync_state_save(inst);
+	if (result != ISC_R_SUCCESS)
+		log_error_r("unable to save SyncRepl state for instance '%s'",
+			    inst->db_name);
+
+cleanup:
+	/* Failed shards are stopped by the watcher. */
+	if (inst->sync_shards > 0)
+		sync_shards_release(inst->sctx);
+}
+
 /**
  * Called when specific intermediate/final messages are returned
  * by ldap_sync_init()/ldap_sync_poll().
@@ -4391,45 +6067,36 @@ int ldap_sync_intermediate (
 	BerVarray			syncUUIDs,
 	ldap_sync_refresh_t		phase ) {
 
-	isc_result_t	result;
-	ldap_instance_t *inst = ls->ls_private;
-	metadb_iter_t *mldap_iter = NULL;
-	char entryUUID_buf[16];
-	struct berval entryUUID = { .bv_len = sizeof(entryUUID_buf),
-				    .bv_val = entryUUID_buf };
-	sync_state_t state;
+	ldap_sync_session_t *sess = ls->ls_private;
+	ldap_instance_t *inst = sess->inst;
+	unsigned int i;
 
 	UNUSED(msg);
-	UNUSED(syncUUIDs);
 
 	if (inst->exiting)
 		goto cleanup;
 
 	log_debug(1, "ldap_sync_intermediate 0x%x", phase);
-	if (phase != LDAP_SYNC_CAPI_DONE)
-		goto cleanup;
+	if (phase == LDAP_SYNC_CAPI_PRESENTS)
+		sess->presents = ISC_TRUE;
 
-	sync_state_get(inst->sctx, &state);
-	if (state == sync_datainit) {
-		result = sync_barrier_wait(inst->sctx, inst);
-		if (result != ISC_R_SUCCESS) {
-			log_error_r("%s: sync_barrier_wait() failed for "
-				    "instance '%s'", __func__, inst->db_name);
-			goto cleanup;
-		}
+	if (phase == LDAP_SYNC_CAPI_PRESENTS_IDSET) {
+		if (syncUUIDs != NULL)
+			ldap_sync_present_idset(sess, syncUUIDs);
+		goto cleanup;
+	} else if (phase == LDAP_SYNC_CAPI_DELETES_IDSET) {
+		for (i = 0;
+		     syncUUIDs != NULL && syncUUIDs[i].bv_val != NULL;
+		     i++)
+			ldap_sync_search_entry(ls, NULL, &syncUUIDs[i],
+					       LDAP_SYNC_CAPI_DELETE);
+		goto cleanup;
 	}
 
-	for (result = mldap_iter_deadnodes_start(inst->mldapdb, &mldap_iter,
-						 &entryUUID);
-	     result == ISC_R_SUCCESS;
-	     result = mldap_iter_deadnodes_next(inst->mldapdb, &mldap_iter,
-					        &entryUUID)) {
-		ldap_sync_search_entry(ls, NULL, &entryUUID,
-				       LDAP_SYNC_CAPI_DELETE);
+	if (phase != LDAP_SYNC_CAPI_DONE)
+		goto cleanup;
 
-	}
-	if (result != ISC_R_SUCCESS && result != ISC_R_NOMORE)
-		log_error_r("mldap_iter_deadnodes_* failed, run rndc reload");
+	ldap_sync_refresh_done(ls, sess);
 
 cleanup:
 	return LDAP_SUCCESS;
@@ -4439,24 +6106,33 @@ cleanup:
  * Called when a searchResultDone is returned
  * by ldap_sync_init()/ldap_sync_poll().
  * In refreshAndPersist, this can only occur if the search for any reason
- * is being terminated by the server.
+ * is being terminated by the server. In refreshOnly, this ends the refresh.
  */
 int ATTR_NONNULLS ATTR_CHECKRESULT ldap_sync_search_result (
 	ldap_sync_t			*ls,
 	LDAPMessage			*msg,
 	int				refreshDeletes ) {
 	isc_result_t	result;
-	ldap_instance_t *inst = ls->ls_private;
+	ldap_sync_session_t *sess = ls->ls_private;
+	ldap_instance_t *inst = sess->inst;
 	sync_state_t state;
 
 	UNUSED(msg);
-	UNUSED(refreshDeletes);
 
 	log_debug(1, "ldap_sync_search_result");
 
 	if (inst->exiting)
 		goto cleanup;
 
+	/* refreshOnly mode does not send refreshDone, the cookie
+	 * from syncDoneValue is already stored in ls->ls_cookie */
+	if (sess->polling == ISC_TRUE) {
+		if (!refreshDeletes)
+			sess->presents = ISC_TRUE;
+		ldap_sync_refresh_done(ls, sess);
+		goto cleanup;
+	}
+
 	/* This place can be reached only if:
 	 * a) initial config synchronization is done
 	 * b) config is re-synchronized after reconnect to LDAP */
@@ -4501,9 +6177,9 @@ ldap_sync_cleanup(ldap_sync_t **ldap_syncp) {
  * @param[in]  filter  LDAP filter to be used in SyncRepl session
  */
 static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
-ldap_sync_prepare(ldap_instance_t *inst, settings_set_t *settings,
-		  const char *filter, ldap_connection_t *conn,
-		  ldap_sync_t **ldap_syncp) {
+ldap_sync_prepare(ldap_instance_t *inst, ldap_sync_session_t *sess,
+		  settings_set_t *settings, const char *filter,
+		  ldap_connection_t *conn, ldap_sync_t **ldap_syncp) {
 	isc_result_t result;
 	const char *base = NULL;
 	ldap_sync_t *ldap_sync = NULL;
@@ -4511,8 +6187,10 @@ ldap_sync_prepare(ldap_instance_t *inst, settings_set_t *settings,
 	REQUIRE(inst != NULL);
 	REQUIRE(ldap_syncp != NULL && *ldap_syncp == NULL);
 
-	/* Remove stale zone & journal files. */
-	CHECK(cleanup_files(inst));
+	/* Remove stale zone & journal files. Record shards run in parallel
+	 * with session 0 which is responsible for zones. */
+	if (sess->shard == 0)
+		CHECK(cleanup_files(inst));
 
 	if(conn->handle == NULL)
 		CLEANUP_WITH(ISC_R_NOTCONNECTED);
@@ -4542,7 +6220,7 @@ ldap_sync_prepare(ldap_instance_t *inst, settings_set_t *settings,
 	ldap_sync->ls_search_reference = ldap_sync_search_reference;
 	ldap_sync->ls_intermediate = ldap_sync_intermediate;
 	ldap_sync->ls_search_result = ldap_sync_search_result;
-	ldap_sync->ls_private = inst;
+	ldap_sync->ls_private = sess;
 
 	result = ISC_R_SUCCESS;
 	*ldap_syncp = ldap_sync;
@@ -4560,13 +6238,18 @@ cleanup:
  *
  * @post Conn is unbound and invalid. The connection needs to be re-established.
  *
+ * @param[in]  sess          Session state, its index selects the cookie.
  * @param[in]  conn          Valid and bound LDAP connection.
  * @param[in]  filter_objcs  LDAP filter specifying objects which should
  *                           be retrieved during this session. The supplied
  *                           filter will be ORed filter specifying configuration
  *                           objects which always need to be retrieved.
+ *                           Record shards use the filter as it is.
  * @param[in]  mode          LDAP_SYNC_REFRESH_AND_PERSIST
  *                           or LDAP_SYNC_REFRESH_ONLY
+ * @param[in]  resume        Start refresh from the cookie stored in sync ctx
+ *                           (if any) and store cookie from this session
+ *                           for the next one.
  *
  * @retval ISC_R_SUCCESS      LDAP_SYNC_REFRESH_ONLY mode finished,
  *                            all events were sent (not necessarily processed)
@@ -4574,11 +6257,14 @@ cleanup:
  * @retval others             Errors, some events might or might not be sent.
  */
 static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
-ldap_sync_doit(ldap_instance_t *inst, ldap_connection_t *conn,
-	       const char * const filter_objcs, int mode) {
+ldap_sync_doit(ldap_instance_t *inst, ldap_sync_session_t *sess,
+	       ldap_connection_t *conn, const char * const filter_objcs,
+	       int mode, isc_boolean_t resume) {
 	isc_result_t result;
 	int ret;
 	ldap_sync_t *ldap_sync = NULL;
+	Sockbuf *sb = NULL;
+	int fd = -1;
 	const char *err_hint = "";
 	char filter[1024];
 	const char config_template[] =
@@ -4591,7 +6277,10 @@ ldap_sync_doit(ldap_instance_t *inst, ldap_connection_t *conn,
 
 	/* request idnsServerConfig object only if server_id is specified */
 	CHECK(setting_get_str("server_id", inst->server_ldap_settings, &server_id));
-	if (strlen(server_id) == 0)
+	if (sess->shard > 0)
+		CHECK(isc_string_printf(filter, sizeof(filter), "%s",
+					filter_objcs));
+	else if (strlen(server_id) == 0)
 		CHECK(isc_string_printf(filter, sizeof(filter), config_template,
 				        "", "", "", filter_objcs));
 	else
@@ -4600,18 +6289,52 @@ ldap_sync_doit(ldap_instance_t *inst, ldap_connection_t *conn,
 				        "    (idnsServerId=", server_id, "))",
 					filter_objcs));
 
-	result = ldap_sync_prepare(inst, inst->server_ldap_settings,
+	result = ldap_sync_prepare(inst, sess, inst->server_ldap_settings,
 				   filter, conn, &ldap_sync);
 	if (result != ISC_R_SUCCESS) {
 		log_error_r("ldap_sync_prepare() failed, retrying "
 			    "in 1 second");
-		sane_sleep(inst, 1);
+		(void)ldap_sync_sleep(sess, 1);
 		goto cleanup;
 	}
 
+	sess->abort = ISC_FALSE;
+	sess->resumed = ISC_FALSE;
+	sess->presents = ISC_FALSE;
+	sess->refreshed = ISC_FALSE;
+	sess->failed = ISC_FALSE;
+	sess->polling = ISC_TF(resume == ISC_TRUE
+			       && mode == LDAP_SYNC_REFRESH_ONLY);
+	if (resume == ISC_TRUE) {
+		result = sync_cookie_get(inst->sctx, sess->shard,
+					 &ldap_sync->ls_cookie);
+		if (result == ISC_R_SUCCESS) {
+			sess->resumed = ISC_TRUE;
+			log_debug(1, "resuming SyncRepl session from "
+				  "stored cookie");
+		} else if (result != ISC_R_NOTFOUND) {
+			goto cleanup;
+		}
+		result = ISC_R_SUCCESS;
+	}
+
+	/* Let ldap_sync_wakeup() interrupt refresh inside libldap. */
+	ret = ldap_get_option(ldap_sync->ls_ld, LDAP_OPT_DESC, &fd);
+	if (ret != LDAP_OPT_SUCCESS || fd < 0) {
+		conn->handle = NULL;
+		CLEANUP_WITH(ISC_R_NOTCONNECTED);
+	}
+	if (ldap_sync_fd_set(sess, fd) == ISC_TRUE)
+		CLEANUP_WITH(sess->abort ? ISC_R_CANCELED : ISC_R_SUCCESS);
+
 	ret = ldap_sync_init(ldap_sync, mode);
 	/* TODO: error handling, set tainted flag & do full reload? */
-	if (ret != LDAP_SUCCESS) {
+	if (ret != LDAP_SUCCESS && (inst->exiting || sess->stop
+				    || sess->abort)) {
+		/* Socket was shut down by ldap_sync_wakeup(). */
+		conn->handle = NULL;
+		CLEANUP_WITH(sess->abort ? ISC_R_CANCELED : ISC_R_SUCCESS);
+	} else if (ret != LDAP_SUCCESS) {
 		if (ret == LDAP_UNAVAILABLE_CRITICAL_EXTENSION)
 			err_hint = ": is RFC 4533 supported by LDAP server?";
 		else
@@ -4619,100 +6342,211 @@ ldap_sync_doit(ldap_instance_t *inst, ldap_connection_t *conn,
 
 		log_ldap_error(ldap_sync->ls_ld, "unable to start SyncRepl "
 				"session%s", err_hint);
+		if (sess->resumed == ISC_TRUE) {
+			/* e.g. LDAP_SYNC_REFRESH_REQUIRED: cookie is too old */
+			log_info("next SyncRepl session for instance '%s' "
+				 "will do full refresh", inst->db_name);
+			sync_cookie_clear(inst->sctx);
+		}
 		conn->handle = NULL;
 		CLEANUP_WITH(ISC_R_NOTCONNECTED);
 	}
 
-	while (!inst->exiting && ret == LDAP_SUCCESS
+	/* Refresh is done. Wait for changes outside of libldap
+	 * and let ldap_sync_poll() only read what is already received. */
+	ldap_sync->ls_timeout = 0;
+	ret = ldap_get_option(ldap_sync->ls_ld, LDAP_OPT_SOCKBUF, &sb);
+	if (ret != LDAP_OPT_SUCCESS) {
+		conn->handle = NULL;
+		CLEANUP_WITH(ISC_R_NOTCONNECTED);
+	}
+	while (!inst->exiting && !sess->stop && !sess->abort
+	       && ret == LDAP_SUCCESS
 	       && mode == LDAP_SYNC_REFRESH_AND_PERSIST) {
+		/* libldap might have buffered data already */
+		if (ber_sockbuf_ctrl(sb, LBER_SB_OPT_DATA_READY, NULL) == 0) {
+			result = ldap_sync_wait(sess, fd, -1);
+			if (result == ISC_R_CANCELED)
+				continue;
+			else if (result != ISC_R_SUCCESS)
+				goto cleanup;
+		}
 		ret = ldap_sync_poll(ldap_sync);
-		if (!inst->exiting && ret != LDAP_SUCCESS) {
+		if (!inst->exiting && !sess->stop && !sess->abort
+		    && ret != LDAP_SUCCESS) {
 			log_ldap_error(ldap_sync->ls_ld,
 				       "ldap_sync_poll() failed");
 			/* force reconnect in sync_prepare */
 			conn->handle = NULL;
 		}
 	}
+	if (sess->abort == ISC_TRUE)
+		result = ISC_R_CANCELED;
 
 cleanup:
+	(void)ldap_sync_fd_set(sess, -1);
+	/* Entries received after shutdown started were not processed
+	 * so the latest cookie cannot be used. */
+	if (ldap_sync != NULL && resume == ISC_TRUE && !inst->exiting
+	    && sess->refreshed == ISC_TRUE)
+		ldap_sync_cookie_keep(sess, ldap_sync);
 	ldap_sync_cleanup(&ldap_sync);
 	return result;
 }
 
 /*
  * NOTE:
- * Every blocking call in syncrepl_watcher thread must be preemptible.
+ * Every blocking call in syncrepl_watcher thread must be preemptible
+ * by ldap_sync_wakeup().
  */
 static isc_threadresult_t
 ldap_syncrepl_watcher(isc_threadarg_t arg)
 {
 	ldap_instance_t *inst = (ldap_instance_t *)arg;
 	ldap_connection_t *conn = NULL;
-	int ret;
 	isc_result_t result;
-	sigset_t sigset;
 	isc_uint32_t reconnect_interval;
 	sync_state_t state;
+	isc_boolean_t warm_start;
+	isc_boolean_t warm = ISC_FALSE;
+	const char *config_objcs = NULL;
+	const char *data_objcs = NULL;
+	ldap_sync_session_t *sess = &inst->sync_sessions[0];
+	isc_uint32_t poll_interval;
+	isc_boolean_t polled = ISC_FALSE;
 
 	log_debug(1, "Entering ldap_syncrepl_watcher");
 
-	install_usr1handler();
-
-	/*
-	 * By default, BIND sets threads to accept signals only via
-	 * sigwait(). However we need to use SIGUSR1 to interrupt
-	 * watcher from waiting inside ldap_result so enable
-	 * asynchronous delivering of SIGUSR1.
-	 */
-	sigemptyset(&sigset);
-	sigaddset(&sigset, SIGUSR1);
-	ret = pthread_sigmask(SIG_UNBLOCK, &sigset, NULL);
-	/* pthread_sigmask fails only due invalid args */
-	RUNTIME_CHECK(ret == 0);
-
 	/* Pick connection, one is reserved purely for this thread */
 	CHECK(ldap_pool_getconnection(inst->pool, &conn));
 
+	CHECK(setting_get_uint("sync_poll_interval", inst->local_settings,
+			       &poll_interval));
+
+	CHECK(setting_get_bool("warm_start", inst->local_settings,
+			       &warm_start));
+	if (warm_start == ISC_TRUE) {
+		result = ldap_sync_state_load(inst);
+		if (result == ISC_R_SUCCESS)
+			log_info("LDAP instance '%s': warm start, zones will be "
+				 "restored from snapshots", inst->db_name);
+		else if (result == ISC_R_FILENOTFOUND)
+			log_info("LDAP instance '%s': no saved synchronization "
+				 "state found, warm start is not possible",
+				 inst->db_name);
+		else
+			log_error_r("LDAP instance '%s': unable to load saved "
+				    "synchronization state, warm start is "
+				    "not possible", inst->db_name);
+	}
+
 	while (!inst->exiting) {
 		sync_state_get(inst->sctx, &state);
 		if (state != sync_finished) {
+			/* Events from failed attempt depend on the old state. */
+			if (sync_concurr_limit_drain(inst->sctx)
+			    != ISC_R_SUCCESS)
+				log_error("unable to wait for processing of "
+					  "LDAP changes from failed "
+					  "synchronization attempt");
 			sync_state_reset(inst->sctx);
 			CHECK(sync_task_add(inst->sctx, inst->task));
+			polled = ISC_FALSE;
 		}
 		/* synchronize configuration first so configuration variables
-		 * are already available during data processing */
-		result = ldap_sync_doit(inst, conn, "", LDAP_SYNC_REFRESH_ONLY);
-		if (result != ISC_R_SUCCESS) {
-			log_error_r("LDAP configuration synchronization failed");
-			goto retry;
-		}
+		 * are already available during data processing;
+		 * zones have to be created before snapshots can be loaded.
+		 * Configuration objects are part of every poll so
+		 * configuration is re-synchronized only after failures. */
+		warm = ldap_warm_start_get(inst);
+		if (warm == ISC_TRUE && state != sync_finished)
+			config_objcs = "  (objectClass=idnsZone)"
+				       "  (objectClass=idnsForwardZone)";
+		else
+			config_objcs = "";
+		if (polled == ISC_FALSE) {
+			result = ldap_sync_doit(inst, sess, conn, config_objcs,
+						LDAP_SYNC_REFRESH_ONLY,
+						ISC_FALSE);
+			if (result != ISC_R_SUCCESS) {
+				log_error_r("LDAP configuration "
+					    "synchronization failed");
+				goto retry;
+			}
 
-		result = ldap_connect(inst, conn, ISC_TRUE);
-		if (result != ISC_R_SUCCESS) {
-			log_error_r("reconnection to LDAP failed");
-			goto retry;
+			result = ldap_connect(inst, conn, ISC_TRUE);
+			if (result != ISC_R_SUCCESS) {
+				log_error_r("reconnection to LDAP failed");
+				goto retry;
+			}
+
+			/* Some snapshot was not loaded and restored data
+			 * were discarded by warm_start_discard(),
+			 * configuration has to be synchronized again
+			 * to fill empty metaLDAP. */
+			if (warm == ISC_TRUE
+			    && ldap_warm_start_get(inst) == ISC_FALSE) {
+				log_info("LDAP instance '%s': restarting "
+					 "synchronization without warm start",
+					 inst->db_name);
+				continue;
+			}
 		}
 
 		/* finally synchronize the data */
 		sync_state_get(inst->sctx, &state);
-		if (state != sync_finished)
+		if (state != sync_finished) {
 			CHECK(sync_task_add(inst->sctx, inst->task));
+			if (warm == ISC_TRUE)
+				CHECK(zone_tasks_add(inst));
+		}
 		mldap_cur_generation_bump(inst->mldapdb);
-		log_info("LDAP data for instance '%s' are being synchronized, "
-			 "please ignore message 'all zones loaded'",
-			 inst->db_name);
-		result = ldap_sync_doit(inst, conn,
-				        "(|(objectClass=idnsZone)"
-					"  (objectClass=idnsForwardZone)"
-					"  (objectClass=idnsRecord))",
-					LDAP_SYNC_REFRESH_AND_PERSIST);
-		if (result != ISC_R_SUCCESS) {
+		if (polled == ISC_TRUE)
+			log_debug(1, "polling LDAP for changes of data "
+				  "for instance '%s'", inst->db_name);
+		else
+			log_info("LDAP data for instance '%s' are being "
+				 "synchronized, please ignore message "
+				 "'all zones loaded'", inst->db_name);
+		polled = ISC_FALSE;
+		/* records are synchronized by shards, if configured */
+		if (inst->sync_shards > 0)
+			data_objcs = "(|(objectClass=idnsZone)"
+				     "  (objectClass=idnsForwardZone))";
+		else
+			data_objcs = "(|(objectClass=idnsZone)"
+				     "  (objectClass=idnsForwardZone)"
+				     "  (objectClass=idnsRecord))";
+		result = ldap_sync_doit(inst, sess, conn, data_objcs,
+					(poll_interval > 0)
+					? LDAP_SYNC_REFRESH_ONLY
+					: LDAP_SYNC_REFRESH_AND_PERSIST,
+					ISC_TRUE);
+		ldap_sync_shards_stop(inst);
+		if (result == ISC_R_CANCELED && !inst->exiting) {
+			/* some record shard failed, start again immediately */
+			result = ldap_connect(inst, conn, ISC_TRUE);
+			if (result != ISC_R_SUCCESS)
+				log_error_r("reconnection to LDAP failed");
+			goto retry;
+		} else if (result != ISC_R_SUCCESS) {
 			log_error_r("LDAP data synchronization failed");
 			goto retry;
 		}
 
 		CHECK_EXIT;
 
+		if (poll_interval > 0) {
+			/* the next poll resumes from cookies of this one */
+			if (!ldap_sync_sleep(sess, poll_interval))
+				CLEANUP_WITH(ISC_R_SHUTTINGDOWN);
+			result = ldap_connect(inst, conn, ISC_TRUE);
+			if (result == ISC_R_SUCCESS)
+				polled = ISC_TRUE;
+			else
+				log_error_r("reconnection to LDAP failed");
+		}
+
 retry:
 		/* Try to connect. */
 		while (conn->handle == NULL) {
@@ -4724,7 +6558,7 @@ retry:
 			log_error("ldap_syncrepl will reconnect in %d second%s",
 				  reconnect_interval,
 				  reconnect_interval == 1 ? "": "s");
-			if (!sane_sleep(inst, reconnect_interval))
+			if (!ldap_sync_sleep(sess, reconnect_interval))
 				CLEANUP_WITH(ISC_R_SHUTTINGDOWN);
 			handle_connection_error(inst, conn, ISC_TRUE);
 		}
@@ -4733,6 +6567,7 @@ retry:
 
 cleanup:
 	log_debug(1, "Ending ldap_syncrepl_watcher");
+	ldap_sync_shards_stop(inst);
 	ldap_pool_putconnection(inst->pool, &conn);
 
 	return (isc_threadresult_t)0;
@@ -26,20 +26,6 @@ isc_result_t ldapdb_rdatalist_findrdatatype(ldapdb_rdatalist_t *rdatalist,
  * Returns ISC_R_SUCCESS or ISC_R_NOTFOUND
  */
 
-void ldapdb_rdatalist_destroy(isc_mem_t *mctx, ldapdb_rdatalist_t *rdatalist) ATTR_NONNULLS;
-/*
- * ldapdb_rdatalist_destroy
- *
- * Free rdatalist list and free all associated rdata buffers.
- */
-
-void free_rdatalist(isc_mem_t *mctx, dns_rdatalist_t *rdlist) ATTR_NONNULLS;
-/*
- * free_rdatalist
- *
- * Free all dynamically allocated memory inside rdlist.
- */
-
 isc_result_t
 new_ldap_instance(isc_mem_t *mctx, const char *db_name, const char *parameters,
 		  const char *file, unsigned long line,
@@ -86,6 +72,10 @@ zone_register_t * ldap_instance_getzr(ldap_instance_t *ldap_inst) ATTR_NONNULLS;
 
 isc_result_t activate_zones(isc_task_t *task, ldap_instance_t *inst) ATTR_NONNULLS;
 
+isc_result_t activate_zones_warm(isc_task_t *task, ldap_instance_t *inst) ATTR_NONNULLS;
+
+void warm_start_discard(isc_task_t *task, ldap_instance_t *inst) ATTR_NONNULLS;
+
 isc_task_t * ldap_instance_gettask(ldap_instance_t *ldap_inst);
 
 isc_boolean_t ldap_instance_isexiting(ldap_instance_t *ldap_inst) ATTR_NONNULLS ATTR_CHECKRESULT;
@@ -85,6 +85,29 @@ metadb_destroy(metadb_t **mdbp) {
 	*mdbp = NULL;
 }
 
+/**
+ * Write content of the current metaDB version into file in text
+ * master format. The file is replaced atomically.
+ */
+isc_result_t
+metadb_dump(metadb_t *mdb, const char *filename) {
+	REQUIRE(mdb != NULL);
+
+	return dns_db_dump2(mdb->rbtdb, NULL, filename, dns_masterformat_text);
+}
+
+/**
+ * Load content of metaDB from file in text master format.
+ *
+ * @pre MetaDB is empty, i.e. it was just created by metadb_new().
+ */
+isc_result_t
+metadb_load(metadb_t *mdb, const char *filename) {
+	REQUIRE(mdb != NULL);
+
+	return dns_db_load2(mdb->rbtdb, filename, dns_masterformat_text);
+}
+
 /**
  * Open new metaDB version for writing.
  *
@@ -372,6 +395,24 @@ cleanup:
 	return result;
 }
 
+/**
+ * Delete all values of given RR type from metaDB node.
+ * Node without the RR type is not an error.
+ *
+ * @pre Node was created by metadb_writenode_create()
+ *      or metadb_writenode_open().
+ */
+isc_result_t
+metadb_rdataset_delete(metadb_node_t *node, dns_rdatatype_t rrtype) {
+	isc_result_t result;
+
+	result = dns_db_deleterdataset(node->rbtdb, node->dbnode,
+				       node->version, rrtype, 0);
+	if (result == DNS_R_UNCHANGED)
+		result = ISC_R_SUCCESS;
+	return result;
+}
+
 /**
  * Get rdataset of given type from metaDB.
  *
@@ -45,6 +45,12 @@ metadb_new(isc_mem_t *mctx, metadb_t **dbp) ATTR_CHECKRESULT ATTR_NONNULLS;
 void
 metadb_destroy(metadb_t **dbp);
 
+isc_result_t ATTR_CHECKRESULT ATTR_NONNULLS
+metadb_dump(metadb_t *mdb, const char *filename);
+
+isc_result_t ATTR_CHECKRESULT ATTR_NONNULLS
+metadb_load(metadb_t *mdb, const char *filename);
+
 isc_result_t ATTR_CHECKRESULT ATTR_NONNULLS
 metadb_newversion(metadb_t *mdb);
 
@@ -73,6 +79,9 @@ isc_result_t ATTR_CHECKRESULT ATTR_NONNULLS
 metadb_rdataset_get(metadb_node_t *node, dns_rdatatype_t rrtype,
 		    dns_rdataset_t *rdataset);
 
+isc_result_t ATTR_CHECKRESULT ATTR_NONNULLS
+metadb_rdataset_delete(metadb_node_t *node, dns_rdatatype_t rrtype);
+
 void ATTR_NONNULLS
 metadb_node_close(metadb_node_t **nodep);
 
@@ -10,6 +10,8 @@
 #include <uuid/uuid.h>
 
 #include <isc/boolean.h>
+#include <isc/ht.h>
+#include <isc/mutex.h>
 #include <isc/net.h>
 #include <isc/refcount.h>
 #include <isc/result.h>
@@ -20,6 +22,7 @@
 #include <dns/dbiterator.h>
 #include <dns/enumclass.h>
 #include <dns/name.h>
+#include <dns/rbt.h>
 #include <dns/types.h>
 #include <dns/update.h>
 
@@ -45,32 +48,297 @@ static dns_name_t uuid_rootname =
 	{ NULL, NULL }
 };
 
+/* name "generation.ldap." */
+static unsigned char generation_name_ndata[]
+	= { 10, 'g', 'e', 'n', 'e', 'r', 'a', 't', 'i', 'o', 'n',
+	    4, 'l', 'd', 'a', 'p', 0 };
+static unsigned char generation_name_offsets[] = { 0, 11, 16 };
+static dns_name_t generation_name =
+{
+	DNS_NAME_MAGIC,
+	generation_name_ndata,
+	sizeof(generation_name_ndata),
+	sizeof(generation_name_offsets),
+	DNS_NAMEATTR_READONLY | DNS_NAMEATTR_ABSOLUTE,
+	generation_name_offsets,
+	NULL,
+	{ (void *)-1, (void *)-1 },
+	{ NULL, NULL }
+};
+
+/**
+ * In-memory index of metaLDAP entries by generation number.
+ * Entries from the current generation are in list live, entries from older
+ * generations are in list stale, so dead nodes can be found without walking
+ * through the whole metaLDAP. Generation bump just moves the live list
+ * to the end of the stale list.
+ *
+ * The index reflects committed metaLDAP versions only, changes done in
+ * an open version are kept in mldapdb_t->pending until the version is closed.
+ */
+typedef struct mldap_genent	mldap_genent_t;
+struct mldap_genent {
+	unsigned char		uuid[16];
+	isc_uint32_t		generation;
+	LINK(mldap_genent_t)	link;
+};
+
+typedef struct mldap_index	mldap_index_t;
+struct mldap_index {
+	dns_rbt_t		*rbt;	/**< UUID name -> mldap_genent_t */
+	LIST(mldap_genent_t)	live;
+	LIST(mldap_genent_t)	stale;
+	/** next entry returned by mldap_iter_deadnodes_next() */
+	mldap_genent_t		*sweep_next;
+	isc_uint32_t		sweep_generation;
+};
+
+typedef struct mldap_indexop	mldap_indexop_t;
+struct mldap_indexop {
+	unsigned char		uuid[16];
+	isc_boolean_t		delete;
+	isc_uint32_t		generation;
+	LINK(mldap_indexop_t)	link;
+};
+
 struct mldapdb {
 	isc_mem_t	*mctx;
 	metadb_t	*mdb;
 	isc_refcount_t	generation;
+
+	/** Guards index, failed and generation bumps. */
+	isc_mutex_t	index_lock;
+	mldap_index_t	*index;
+	/** UUIDs of entries whose change was not applied,
+	 *  see mldap_entry_failed(). */
+	isc_ht_t	*failed;
+	/** Serializes writers. SyncRepl sessions write metaLDAP
+	 *  concurrently but metaDB allows only one open version. */
+	isc_mutex_t	write_lock;
+	/** Index changes from open version, guarded by write_lock. */
+	LIST(mldap_indexop_t)	pending;
 };
 
+void
+ldap_uuid_to_mname(struct berval *beruuid, dns_name_t *nameuuid);
+
+/* Callback for dns_rbt_create(). */
+static void
+mldap_genent_free(void *data, void *arg) {
+	isc_mem_t *mctx = arg;
+	mldap_genent_t *ent = data;
+
+	SAFE_MEM_PUT_PTR(mctx, ent);
+}
+
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+mldap_index_new(isc_mem_t *mctx, mldap_index_t **indexp) {
+	isc_result_t result;
+	mldap_index_t *index = NULL;
+
+	REQUIRE(indexp != NULL && *indexp == NULL);
+
+	CHECKED_MEM_GET_PTR(mctx, index);
+	ZERO_PTR(index);
+	INIT_LIST(index->live);
+	INIT_LIST(index->stale);
+	CHECK(dns_rbt_create(mctx, mldap_genent_free, mctx, &index->rbt));
+
+	*indexp = index;
+	return ISC_R_SUCCESS;
+
+cleanup:
+	SAFE_MEM_PUT_PTR(mctx, index);
+	return result;
+}
+
+static void ATTR_NONNULLS
+mldap_index_destroy(isc_mem_t *mctx, mldap_index_t **indexp) {
+	mldap_index_t *index = *indexp;
+
+	if (index == NULL)
+		return;
+
+	/* entries are freed by mldap_genent_free() */
+	dns_rbt_destroy(&index->rbt);
+	SAFE_MEM_PUT_PTR(mctx, index);
+	*indexp = NULL;
+}
+
+/**
+ * Remove index entry from its list.
+ * Entries are in list live if and only if they are from current generation.
+ */
+static void ATTR_NONNULLS
+mldap_index_unlink(mldap_index_t *index, mldap_genent_t *ent,
+		   isc_uint32_t cur_generation) {
+	if (index->sweep_next == ent)
+		index->sweep_next = NEXT(ent, link);
+	if (ent->generation == cur_generation)
+		UNLINK(index->live, ent, link);
+	else
+		UNLINK(index->stale, ent, link);
+}
+
+/**
+ * Add or update index entry for given UUID.
+ */
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+mldap_index_set(isc_mem_t *mctx, mldap_index_t *index, unsigned char *uuid,
+		isc_uint32_t generation, isc_uint32_t cur_generation) {
+	isc_result_t result;
+	mldap_genent_t *ent = NULL;
+	struct berval beruuid = { .bv_len = 16, .bv_val = (char *)uuid };
+	DECLARE_BUFFERED_NAME(mname);
+
+	INIT_BUFFERED_NAME(mname);
+	ldap_uuid_to_mname(&beruuid, &mname);
+
+	result = dns_rbt_findname(index->rbt, &mname, 0, NULL, (void **)&ent);
+	if (result == ISC_R_SUCCESS) {
+		mldap_index_unlink(index, ent, cur_generation);
+	} else if (result == ISC_R_NOTFOUND || result == DNS_R_PARTIALMATCH) {
+		CHECKED_MEM_GET_PTR(mctx, ent);
+		ZERO_PTR(ent);
+		memcpy(ent->uuid, uuid, sizeof(ent->uuid));
+		INIT_LINK(ent, link);
+		result = dns_rbt_addname(index->rbt, &mname, ent);
+		if (result != ISC_R_SUCCESS) {
+			SAFE_MEM_PUT_PTR(mctx, ent);
+			goto cleanup;
+		}
+	} else {
+		goto cleanup;
+	}
+
+	ent->generation = generation;
+	if (generation == cur_generation)
+		APPEND(index->live, ent, link);
+	else
+		APPEND(index->stale, ent, link);
+
+cleanup:
+	return result;
+}
+
+static void ATTR_NONNULLS
+mldap_index_delete(mldap_index_t *index, unsigned char *uuid,
+		   isc_uint32_t cur_generation) {
+	mldap_genent_t *ent = NULL;
+	struct berval beruuid = { .bv_len = 16, .bv_val = (char *)uuid };
+	DECLARE_BUFFERED_NAME(mname);
+
+	INIT_BUFFERED_NAME(mname);
+	ldap_uuid_to_mname(&beruuid, &mname);
+
+	if (dns_rbt_findname(index->rbt, &mname, 0, NULL, (void **)&ent)
+	    != ISC_R_SUCCESS)
+		return;
+
+	mldap_index_unlink(index, ent, cur_generation);
+	RUNTIME_CHECK(dns_rbt_deletename(index->rbt, &mname, ISC_FALSE)
+		      == ISC_R_SUCCESS);
+}
+
+/**
+ * Remember index change done in open metaLDAP version.
+ */
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+mldap_index_pending(mldapdb_t *mldap, struct berval *uuid,
+		    isc_boolean_t delete) {
+	isc_result_t result;
+	mldap_indexop_t *op = NULL;
+
+	REQUIRE(uuid->bv_len == sizeof(op->uuid));
+
+	CHECKED_MEM_GET_PTR(mldap->mctx, op);
+	memcpy(op->uuid, uuid->bv_val, sizeof(op->uuid));
+	op->delete = delete;
+	op->generation = mldap_cur_generation_get(mldap);
+	INIT_LINK(op, link);
+	APPEND(mldap->pending, op, link);
+
+cleanup:
+	return result;
+}
+
+/**
+ * Apply or drop index changes from the version which is being closed.
+ */
+static void ATTR_NONNULLS
+mldap_index_commit(mldapdb_t *mldap, isc_boolean_t commit) {
+	isc_result_t result;
+	mldap_indexop_t *op;
+	isc_uint32_t cur_generation;
+
+	if (commit == ISC_TRUE && !EMPTY(mldap->pending)) {
+		LOCK(&mldap->index_lock);
+		cur_generation = mldap_cur_generation_get(mldap);
+		for (op = HEAD(mldap->pending);
+		     op != NULL;
+		     op = NEXT(op, link)) {
+			/* new state of the entry has its own fingerprint */
+			(void)isc_ht_delete(mldap->failed, op->uuid,
+					    sizeof(op->uuid));
+			if (op->delete == ISC_TRUE) {
+				mldap_index_delete(mldap->index, op->uuid,
+						   cur_generation);
+				continue;
+			}
+			result = mldap_index_set(mldap->mctx, mldap->index,
+						 op->uuid, op->generation,
+						 cur_generation);
+			if (result != ISC_R_SUCCESS)
+				log_error_r("unable to index metaLDAP entry, "
+					    "dead entries might not be "
+					    "detected, run rndc reload");
+		}
+		UNLOCK(&mldap->index_lock);
+	}
+
+	while ((op = HEAD(mldap->pending)) != NULL) {
+		UNLINK(mldap->pending, op, link);
+		SAFE_MEM_PUT_PTR(mldap->mctx, op);
+	}
+}
+
 
 isc_result_t
 mldap_new(isc_mem_t *mctx, mldapdb_t **mldapp) {
 	isc_result_t result;
 	mldapdb_t *mldap = NULL;
+	isc_boolean_t lock_ready = ISC_FALSE;
+	isc_boolean_t write_lock_ready = ISC_FALSE;
 
 	REQUIRE(mldapp != NULL && *mldapp == NULL);
 
 	CHECKED_MEM_GET_PTR(mctx, mldap);
 	ZERO_PTR(mldap);
 	isc_mem_attach(mctx, &mldap->mctx);
+	INIT_LIST(mldap->pending);
 
 	CHECK(isc_refcount_init(&mldap->generation, 0));
+	CHECK(isc_mutex_init(&mldap->index_lock));
+	lock_ready = ISC_TRUE;
+	CHECK(isc_mutex_init(&mldap->write_lock));
+	write_lock_ready = ISC_TRUE;
+	CHECK(mldap_index_new(mctx, &mldap->index));
+	CHECK(isc_ht_init(&mldap->failed, mctx, 8));
 	CHECK(metadb_new(mctx, &mldap->mdb));
 
 	*mldapp = mldap;
 	return result;
 
 cleanup:
-	metadb_destroy(&mldap->mdb);
+	if (mldap->mdb != NULL)
+		metadb_destroy(&mldap->mdb);
+	mldap_index_destroy(mctx, &mldap->index);
+	if (mldap->failed != NULL)
+		isc_ht_destroy(&mldap->failed);
+	if (lock_ready == ISC_TRUE)
+		DESTROYLOCK(&mldap->index_lock);
+	if (write_lock_ready == ISC_TRUE)
+		DESTROYLOCK(&mldap->write_lock);
 	MEM_PUT_AND_DETACH(mldap);
 	return result;
 }
@@ -85,29 +353,52 @@ mldap_destroy(mldapdb_t **mldapp) {
 	if (mldap == NULL)
 		return;
 
+	INSIST(EMPTY(mldap->pending));
 	metadb_destroy(&mldap->mdb);
+	mldap_index_destroy(mldap->mctx, &mldap->index);
+	isc_ht_destroy(&mldap->failed);
+	DESTROYLOCK(&mldap->index_lock);
+	DESTROYLOCK(&mldap->write_lock);
 	MEM_PUT_AND_DETACH(mldap);
 
 	*mldapp = NULL;
 }
 
+/**
+ * Open new metaLDAP version for writing.
+ *
+ * Blocks until version opened by other writer is closed.
+ * Each successful call has to be paired with mldap_closeversion().
+ */
 isc_result_t
 mldap_newversion(mldapdb_t *mldap) {
-	return metadb_newversion(mldap->mdb);
+	isc_result_t result;
+
+	LOCK(&mldap->write_lock);
+	result = metadb_newversion(mldap->mdb);
+	if (result != ISC_R_SUCCESS)
+		UNLOCK(&mldap->write_lock);
+	return result;
 }
 
 void
 mldap_closeversion(mldapdb_t *mldap, isc_boolean_t commit) {
-	return metadb_closeversion(mldap->mdb, commit);
+	mldap_index_commit(mldap, commit);
+	metadb_closeversion(mldap->mdb, commit);
+	UNLOCK(&mldap->write_lock);
 }
 
 /**
  * Atomically increment MetaLDAP generation number.
+ * All entries in the index become stale.
  */
 void mldap_cur_generation_bump(mldapdb_t *mldap) {
 	REQUIRE(mldap != NULL);
 
+	LOCK(&mldap->index_lock);
 	isc_refcount_increment0(&mldap->generation, NULL);
+	ISC_LIST_APPENDLIST(mldap->index->stale, mldap->index->live, link);
+	UNLOCK(&mldap->index_lock);
 }
 
 /*
@@ -273,6 +564,151 @@ cleanup:
 	return result;
 }
 
+/**
+ * Fingerprint of LDAP entry content is stored inside DHCID record type
+ */
+static isc_result_t
+mldap_fingerprint_store(ldap_entry_t *entry, metadb_node_t *node) {
+	isc_region_t region = { .base = entry->fingerprint,
+				.length = sizeof(entry->fingerprint) };
+	dns_rdata_t rdata;
+
+	dns_rdata_init(&rdata);
+	dns_rdata_fromregion(&rdata, dns_rdataclass_in, dns_rdatatype_dhcid,
+			     &region);
+
+	return metadb_rdata_store(&rdata, node);
+}
+
+/**
+ * Remember that change of LDAP entry was not applied so its fingerprint
+ * stored in metaLDAP does not describe data in DNS. Next change
+ * of the entry will be processed even if its content matches
+ * the fingerprint. The mark is removed when a new state of the entry
+ * is committed to metaLDAP.
+ *
+ * It does not open metaLDAP version so it can be called from any task.
+ */
+void
+mldap_entry_failed(mldapdb_t *mldap, struct berval *uuid) {
+	isc_result_t result;
+
+	REQUIRE(uuid->bv_len == 16);
+
+	LOCK(&mldap->index_lock);
+	result = isc_ht_add(mldap->failed, (unsigned char *)uuid->bv_val,
+			    uuid->bv_len, NULL);
+	UNLOCK(&mldap->index_lock);
+	if (result != ISC_R_SUCCESS && result != ISC_R_EXISTS)
+		log_error_r("unable to mark LDAP entry as failed, "
+			    "its next change might be ignored");
+}
+
+static isc_boolean_t ATTR_NONNULLS ATTR_CHECKRESULT
+mldap_entry_isfailed(mldapdb_t *mldap, struct berval *uuid) {
+	void *dummy = NULL;
+	isc_result_t result;
+
+	LOCK(&mldap->index_lock);
+	result = isc_ht_find(mldap->failed, (unsigned char *)uuid->bv_val,
+			     uuid->bv_len, &dummy);
+	UNLOCK(&mldap->index_lock);
+	return ISC_TF(result == ISC_R_SUCCESS);
+}
+
+/**
+ * Remove fingerprints of entries marked by mldap_entry_failed() from
+ * the open version so they are not saved into the state file.
+ */
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+mldap_failed_forget(mldapdb_t *mldap) {
+	isc_result_t result;
+	isc_ht_iter_t *iter = NULL;
+	metadb_node_t *node = NULL;
+	unsigned char *key = NULL;
+	size_t keysize;
+	struct berval uuid;
+	DECLARE_BUFFERED_NAME(mname);
+
+	LOCK(&mldap->index_lock);
+	CHECK(isc_ht_iter_create(mldap->failed, &iter));
+	for (result = isc_ht_iter_first(iter);
+	     result == ISC_R_SUCCESS;
+	     result = isc_ht_iter_next(iter)) {
+		isc_ht_iter_currentkey(iter, &key, &keysize);
+		uuid.bv_val = (char *)key;
+		uuid.bv_len = keysize;
+		INIT_BUFFERED_NAME(mname);
+		ldap_uuid_to_mname(&uuid, &mname);
+		result = metadb_writenode_open(mldap->mdb, &mname, &node);
+		if (result == ISC_R_NOTFOUND)
+			continue;
+		else if (result != ISC_R_SUCCESS)
+			goto cleanup;
+		result = metadb_rdataset_delete(node, dns_rdatatype_dhcid);
+		metadb_node_close(&node);
+		if (result != ISC_R_SUCCESS)
+			goto cleanup;
+	}
+	if (result == ISC_R_NOMORE)
+		result = ISC_R_SUCCESS;
+
+cleanup:
+	if (iter != NULL)
+		isc_ht_iter_destroy(&iter);
+	UNLOCK(&mldap->index_lock);
+	return result;
+}
+
+/**
+ * Compare fingerprint of given LDAP entry with fingerprint of the entry
+ * stored in metaLDAP.
+ *
+ * @param[out] unchangedp ISC_TRUE if the fingerprints are equal,
+ *                        ISC_FALSE if they differ, if metaLDAP
+ *                        does not contain the entry or its fingerprint
+ *                        or if the last change of the entry failed.
+ */
+isc_result_t
+mldap_entry_unchanged(mldapdb_t *mldap, ldap_entry_t *entry,
+		      isc_boolean_t *unchangedp) {
+	isc_result_t result;
+	metadb_node_t *node = NULL;
+	dns_rdataset_t rdataset;
+	dns_rdata_t rdata;
+	isc_region_t region;
+
+	REQUIRE(unchangedp != NULL);
+
+	dns_rdata_init(&rdata);
+	dns_rdataset_init(&rdataset);
+	*unchangedp = ISC_FALSE;
+
+	if (mldap_entry_isfailed(mldap, entry->uuid) == ISC_TRUE)
+		return ISC_R_SUCCESS;
+
+	result = mldap_entry_read(mldap, entry->uuid, &node);
+	if (result == ISC_R_SUCCESS)
+		result = metadb_rdataset_get(node, dns_rdatatype_dhcid,
+					     &rdataset);
+	if (result == ISC_R_NOTFOUND)
+		CLEANUP_WITH(ISC_R_SUCCESS);
+	else if (result != ISC_R_SUCCESS)
+		goto cleanup;
+
+	dns_rdataset_current(&rdataset, &rdata);
+	dns_rdata_toregion(&rdata, &region);
+	*unchangedp = ISC_TF(region.length == sizeof(entry->fingerprint)
+			     && memcmp(region.base, entry->fingerprint,
+				       region.length) == 0);
+
+cleanup:
+	if (dns_rdataset_isassociated(&rdataset))
+		dns_rdataset_disassociate(&rdataset);
+	metadb_node_close(&node);
+	return result;
+}
+
 /**
  * FQDN and zone name are stored inside RP record type
  */
@@ -338,6 +774,7 @@ cleanup:
 
 /**
  * Store information from LDAP entry into meta-database.
+ * The entry has to be parsed from LDAP so its fingerprint is valid.
  */
 isc_result_t
 mldap_entry_create(ldap_entry_t *entry, mldapdb_t *mldap, metadb_node_t **nodep) {
@@ -354,6 +791,8 @@ mldap_entry_create(ldap_entry_t *entry, mldapdb_t *mldap, metadb_node_t **nodep)
 
 	CHECK(mldap_class_store(entry->class, node));
 	CHECK(mldap_generation_store(mldap, node));
+	CHECK(mldap_fingerprint_store(entry, node));
+	CHECK(mldap_index_pending(mldap, entry->uuid, ISC_FALSE));
 
 	*nodep = node;
 
@@ -378,6 +817,35 @@ mldap_entry_read(mldapdb_t *mldap, struct berval *uuid, metadb_node_t **nodep) {
 	return metadb_readnode_open(mldap->mdb, &mname, nodep);
 }
 
+/**
+ * Mark existing metaLDAP entry as alive in current generation
+ * so mldap_iter_deadnodes_* will not consider it dead.
+ * All notes about metadb_writenode_open() apply equally here.
+ *
+ * @retval ISC_R_NOTFOUND Entry with given UUID is not in metaLDAP.
+ */
+isc_result_t
+mldap_entry_touch(mldapdb_t *mldap, struct berval *uuid) {
+	isc_result_t result;
+	metadb_node_t *node = NULL;
+	ldap_entryclass_t class;
+	DECLARE_BUFFERED_NAME(mname);
+
+	INIT_BUFFERED_NAME(mname);
+
+	ldap_uuid_to_mname(uuid, &mname);
+
+	CHECK(metadb_writenode_open(mldap->mdb, &mname, &node));
+	/* empty node can be left behind by mldap_entry_delete() */
+	CHECK(mldap_class_get(node, &class));
+	CHECK(mldap_generation_store(mldap, node));
+	CHECK(mldap_index_pending(mldap, uuid, ISC_FALSE));
+
+cleanup:
+	metadb_node_close(&node);
+	return result;
+}
+
 /**
  * Delete metaLDAP entry.
  * All notes about metadb_writenode_open() apply equally here.
@@ -394,146 +862,273 @@ mldap_entry_delete(mldapdb_t *mldap, struct berval *uuid) {
 
 	CHECK(metadb_writenode_open(mldap->mdb, &mname, &node));
 	CHECK(metadb_node_delete(&node));
+	CHECK(mldap_index_pending(mldap, uuid, ISC_TRUE));
 
 cleanup:
 	return result;
 }
 
 /**
- * Start iteration over UUID's of dead nodes stored in uuid.ldap. sub-tree
- * of metaLDAP.
+ * Start iteration over UUID's of dead nodes in metaLDAP.
  *
  * Dead node is a node with generation number lower than global generation
- * number in in metaLDAP.
+ * number in in metaLDAP. Dead nodes are taken from the generation index
+ * so the iteration does not walk through live nodes.
+ * Only one iteration can run at any time.
  *
  * @param[in]  mldap
- * @param[out] iterp
  * @param[out] uuid  Pre-allocated struct berval of size == 16 bytes.
  *                   LDAP entry UUID of the first dead node will be filled in.
  *
  * @retval ISC_R_SUCCESS LDAP entry UUID of the first dead node in database
- *                       is in uuid variable. Resulting iterp can be used for
- *                       subsequent mldap_iter_deadnodes_next() calls.
+ *                       is in uuid variable. Use mldap_iter_deadnodes_next()
+ *                       to continue the iteration.
  * @retval ISC_R_NOMORE  There is no dead node in metaLDAP.
- *                       Iterp and uuid are invalid.
- * @retval other         Various errors.
+ *                       Uuid is invalid.
  *
  * @warning MetaLDAP generation number cannot change during iteration.
  *          This is safety check to prevent hard-to-debug inconsistencies.
+ *          Dead nodes can be deleted and other nodes can be modified
+ *          during iteration.
  */
 isc_result_t
-mldap_iter_deadnodes_start(mldapdb_t *mldap, metadb_iter_t **iterp,
-			   struct berval *uuid) {
-	isc_result_t result;
-	metadb_iter_t *iter = NULL;
-
-	REQUIRE(iterp != NULL && *iterp == NULL);
-
-	CHECK(metadb_iterator_create(mldap->mdb, &iter));
-	CHECKED_MEM_GET(mldap->mctx, iter->state, sizeof(isc_uint32_t));
-	result = dns_dbiterator_seek(iter->iter, &uuid_rootname);
-	if (result == ISC_R_NOTFOUND) /* metaLDAP is empty */
-		CLEANUP_WITH(ISC_R_NOMORE);
-	else if (result != ISC_R_SUCCESS)
-		goto cleanup;
+mldap_iter_deadnodes_start(mldapdb_t *mldap, struct berval *uuid) {
+	LOCK(&mldap->index_lock);
 	/* store current generation value for sanity checking */
-	*(isc_uint32_t *)iter->state = mldap_cur_generation_get(mldap);
-
-	CHECK(mldap_iter_deadnodes_next(mldap, &iter, uuid));
-
-	*iterp = iter;
-	return result;
+	mldap->index->sweep_generation = mldap_cur_generation_get(mldap);
+	mldap->index->sweep_next = HEAD(mldap->index->stale);
+	UNLOCK(&mldap->index_lock);
 
-cleanup:
-	if (iter != NULL) {
-		SAFE_MEM_PUT(mldap->mctx, iter->state, sizeof(isc_uint32_t));
-		iter->state = NULL;
-		metadb_iterator_destroy(&iter);
-	}
-
-	return result;
+	return mldap_iter_deadnodes_next(mldap, uuid);
 }
 
 /**
- * Continue iteration over UUID's of dead nodes stored in uuid.ldap. sub-tree
- * of metaLDAP.
+ * Continue iteration over UUID's of dead nodes in metaLDAP.
  *
  * @param[in]     mldap
- * @param[in,out] iterp
  * @param[out]    uuid  Pre-allocated struct berval of size == 16 bytes.
  *                      LDAP entry UUID of the next dead node will be filled in.
  *
  * @retval ISC_R_SUCCESS LDAP entry UUID of the next dead node in database
- *                       is in uuid variable. Resulting iterp can be used for
- *                       subsequent mldap_iter_deadnodes_next() calls.
- * @retval ISC_R_NOMORE  End of iteration. Iterp and uuid are no longer valid.
- * @retval other         Various errors.
+ *                       is in uuid variable.
+ * @retval ISC_R_NOMORE  End of iteration. Uuid is no longer valid.
  *
  * @warning MetaLDAP generation number cannot change during iteration.
  *          This is safety check to prevent hard-to-debug inconsistencies.
  */
 isc_result_t
-mldap_iter_deadnodes_next(mldapdb_t *mldap, metadb_iter_t **iterp,
-		   struct berval *uuid) {
+mldap_iter_deadnodes_next(mldapdb_t *mldap, struct berval *uuid) {
 	isc_result_t result;
-	dns_dbnode_t *rbt_node = NULL;
+	mldap_genent_t *ent;
+
+	REQUIRE(uuid != NULL);
+	REQUIRE(uuid->bv_len == 16 && uuid->bv_val != NULL);
+
+	LOCK(&mldap->index_lock);
+	/* sanity check: generation number cannot change during iteration */
+	INSIST(mldap->index->sweep_generation
+	       == mldap_cur_generation_get(mldap));
+
+	ent = mldap->index->sweep_next;
+	if (ent == NULL)
+		CLEANUP_WITH(ISC_R_NOMORE);
+	INSIST(isc_serial_lt(ent->generation,
+			     mldap->index->sweep_generation));
+	memcpy(uuid->bv_val, ent->uuid, sizeof(ent->uuid));
+	mldap->index->sweep_next = NEXT(ent, link);
+	result = ISC_R_SUCCESS;
+
+cleanup:
+	UNLOCK(&mldap->index_lock);
+	return result;
+}
+
+/**
+ * Build generation index for all entries stored in uuid.ldap. sub-tree
+ * of given metaDB.
+ */
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+mldap_index_load(isc_mem_t *mctx, metadb_t *mdb, isc_uint32_t cur_generation,
+		 mldap_index_t **indexp) {
+	isc_result_t result;
+	mldap_index_t *index = NULL;
 	metadb_iter_t *iter = NULL;
-	isc_uint32_t node_generation;
-	isc_uint32_t cur_generation;
+	dns_dbnode_t *rbt_node = NULL;
 	metadb_node_t metadb_node;
+	isc_uint32_t node_generation;
+	uuid_t uuid;
 	DECLARE_BUFFERED_NAME(name);
 	isc_region_t name_region;
 
-	REQUIRE(uuid != NULL);
-	REQUIRE(uuid->bv_len == 16 && uuid->bv_val != NULL);
-
-	INIT_BUFFERED_NAME(name);
-	iter = *iterp;
+	CHECK(mldap_index_new(mctx, &index));
+	CHECK(metadb_iterator_create(mdb, &iter));
 
 	/* create fake metaDB node for use with metaDB interface */
 	metadb_node.mctx = iter->mctx;
 	metadb_node.version = iter->version;
 	metadb_node.rbtdb = iter->rbtdb;
 
-	/* skip nodes which do not belong to UUID sub-tree or are 'fresh' */
-	while (ISC_TRUE) {
+	INIT_BUFFERED_NAME(name);
+	for (result = dns_dbiterator_seek(iter->iter, &uuid_rootname);
+	     result == ISC_R_SUCCESS;
+	     result = dns_dbiterator_next(iter->iter)) {
 		if (rbt_node != NULL)
 			dns_db_detachnode(iter->rbtdb, &rbt_node);
 		dns_name_reset(&name);
-
-		CHECK(dns_dbiterator_next(iter->iter));
 		CHECK(dns_dbiterator_current(iter->iter, &rbt_node, &name));
-		if (dns_name_issubdomain(&name, &uuid_rootname) == ISC_FALSE)
+		if (dns_name_issubdomain(&name, &uuid_rootname) == ISC_FALSE
+		    || dns_name_countlabels(&name)
+		       != dns_name_countlabels(&uuid_rootname) + 1)
 			continue;
 		metadb_node.dbnode = rbt_node;
 
-		INSIST(mldap_generation_get(&metadb_node, &node_generation)
-		       == ISC_R_SUCCESS);
-		cur_generation = mldap_cur_generation_get(mldap);
-		/* sanity check: generation number cannot change during iteration */
-		INSIST(*(isc_uint32_t *)(*iterp)->state == cur_generation);
-
-		if (isc_serial_lt(node_generation, cur_generation))
-			break; /* this node is from previous mLDAP generation */
+		/* empty node can be left behind by mldap_entry_delete() */
+		result = mldap_generation_get(&metadb_node, &node_generation);
+		if (result == ISC_R_NOTFOUND)
+			continue;
+		else if (result != ISC_R_SUCCESS)
+			goto cleanup;
+
+		/* parse UUID from DNS name
+		 * "$e4113e03-03b4-11e5-b478-c78116fa7f8b\004uuid\004ldap"
+		 * - first byte of any label is length
+		 * - names derived from UUID has to have constant length */
+		DNS_NAME_TOREGION(&name, &name_region);
+		INSIST(name_region.length == 37 + sizeof(uuid_rootname_ndata));
+		INSIST(name_region.base[0] == 36);
+		name_region.base[37] = '\0';
+		INSIST(uuid_parse((const char *)name_region.base + 1, uuid)
+		       == 0);
+		CHECK(mldap_index_set(mctx, index, uuid, node_generation,
+				      cur_generation));
 	}
-	DNS_NAME_TOREGION(&name, &name_region);
-	/* parse UUID from DNS name
-	 * "$e4113e03-03b4-11e5-b478-c78116fa7f8b\004uuid\004ldap"
-	 * - first byte of any label is length
-	 * - names derived from UUID has to have constant length */
-	INSIST(name_region.length == 37 + sizeof(uuid_rootname_ndata));
-	INSIST(name_region.base[0] == 36);
-	name_region.base[37] = '\0';
-	INSIST(uuid_parse((const char *)name_region.base + 1,
-			  *(uuid_t *)(uuid->bv_val)) == 0);
+	if (result != ISC_R_NOTFOUND && result != ISC_R_NOMORE)
+		goto cleanup;
+
+	*indexp = index;
+	index = NULL;
+	result = ISC_R_SUCCESS;
 
 cleanup:
 	if (rbt_node != NULL)
 		dns_db_detachnode(iter->rbtdb, &rbt_node);
-	if (result != ISC_R_SUCCESS) {
-		SAFE_MEM_PUT(iter->mctx, iter->state, sizeof(isc_uint32_t));
-		iter->state = NULL;
-		metadb_iterator_destroy(iterp);
-	}
+	if (iter != NULL)
+		metadb_iterator_destroy(&iter);
+	mldap_index_destroy(mctx, &index);
+	return result;
+}
+
+/**
+ * Write metaLDAP content including current generation number into file.
+ * The generation number is stored in node "generation.ldap." which is outside
+ * of uuid.ldap. sub-tree.
+ *
+ * @warning MetaLDAP cannot be modified by other threads during save.
+ */
+isc_result_t
+mldap_save(mldapdb_t *mldap, const char *filename) {
+	isc_result_t result;
+	metadb_node_t *node = NULL;
+	isc_boolean_t mldap_open = ISC_FALSE;
+
+	REQUIRE(mldap != NULL);
+	REQUIRE(filename != NULL);
+
+	CHECK(mldap_newversion(mldap));
+	mldap_open = ISC_TRUE;
+	CHECK(metadb_writenode_create(mldap->mdb, &generation_name, &node));
+	CHECK(mldap_generation_store(mldap, node));
+	metadb_node_close(&node);
+	CHECK(mldap_failed_forget(mldap));
+	mldap_closeversion(mldap, ISC_TRUE);
+	mldap_open = ISC_FALSE;
+
+	CHECK(metadb_dump(mldap->mdb, filename));
+
+cleanup:
+	metadb_node_close(&node);
+	if (mldap_open == ISC_TRUE)
+		mldap_closeversion(mldap, ISC_FALSE);
+	if (result != ISC_R_SUCCESS)
+		log_error_r("unable to save metaLDAP into file '%s'", filename);
+	return result;
+}
+
+/**
+ * Forget all entries in metaLDAP. Generation number is not changed.
+ *
+ * @pre No version is open and no other thread uses metaLDAP.
+ */
+isc_result_t
+mldap_reset(mldapdb_t *mldap) {
+	isc_result_t result;
+	metadb_t *mdb = NULL;
+	mldap_index_t *index = NULL;
+
+	REQUIRE(mldap != NULL);
+
+	CHECK(metadb_new(mldap->mctx, &mdb));
+	CHECK(mldap_index_new(mldap->mctx, &index));
+
+	LOCK(&mldap->index_lock);
+	mldap_index_destroy(mldap->mctx, &mldap->index);
+	mldap->index = index;
+	index = NULL;
+	UNLOCK(&mldap->index_lock);
+	metadb_destroy(&mldap->mdb);
+	mldap->mdb = mdb;
+	mdb = NULL;
+
+cleanup:
+	mldap_index_destroy(mldap->mctx, &index);
+	if (mdb != NULL)
+		metadb_destroy(&mdb);
+	return result;
+}
+
+/**
+ * Replace metaLDAP content with data saved by mldap_save().
+ * MetaLDAP is not modified if the file cannot be loaded.
+ *
+ * @pre MetaLDAP was not used yet, i.e. generation number is 0.
+ */
+isc_result_t
+mldap_load(mldapdb_t *mldap, const char *filename) {
+	isc_result_t result;
+	metadb_t *mdb = NULL;
+	metadb_node_t *node = NULL;
+	mldap_index_t *index = NULL;
+	isc_uint32_t generation;
+
+	REQUIRE(mldap != NULL);
+	REQUIRE(filename != NULL);
+	REQUIRE(mldap_cur_generation_get(mldap) == 0);
+
+	CHECK(metadb_new(mldap->mctx, &mdb));
+	CHECK(metadb_load(mdb, filename));
+	CHECK(metadb_readnode_open(mdb, &generation_name, &node));
+	CHECK(mldap_generation_get(node, &generation));
+	metadb_node_close(&node);
+	CHECK(mldap_index_load(mldap->mctx, mdb, generation, &index));
+
+	LOCK(&mldap->index_lock);
+	isc_refcount_destroy(&mldap->generation);
+	RUNTIME_CHECK(isc_refcount_init(&mldap->generation, generation)
+		      == ISC_R_SUCCESS);
+	mldap_index_destroy(mldap->mctx, &mldap->index);
+	mldap->index = index;
+	index = NULL;
+	UNLOCK(&mldap->index_lock);
+	metadb_destroy(&mldap->mdb);
+	mldap->mdb = mdb;
+	mdb = NULL;
+
+cleanup:
+	metadb_node_close(&node);
+	mldap_index_destroy(mldap->mctx, &index);
+	if (mdb != NULL)
+		metadb_destroy(&mdb);
+	if (result != ISC_R_SUCCESS)
+		log_error_r("unable to load metaLDAP from file '%s'", filename);
 	return result;
 }
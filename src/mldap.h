@@ -30,6 +30,16 @@ mldap_entry_read(mldapdb_t *mldap, struct berval *uuid, metadb_node_t **nodep);
 isc_result_t ATTR_CHECKRESULT ATTR_NONNULLS
 mldap_entry_create(ldap_entry_t *entry, mldapdb_t *mldap, metadb_node_t **nodep);
 
+isc_result_t ATTR_CHECKRESULT ATTR_NONNULLS
+mldap_entry_touch(mldapdb_t *mldap, struct berval *uuid);
+
+void ATTR_NONNULLS
+mldap_entry_failed(mldapdb_t *mldap, struct berval *uuid);
+
+isc_result_t ATTR_CHECKRESULT ATTR_NONNULLS
+mldap_entry_unchanged(mldapdb_t *mldap, ldap_entry_t *entry,
+		      isc_boolean_t *unchangedp);
+
 isc_result_t ATTR_CHECKRESULT ATTR_NONNULLS
 mldap_entry_delete(mldapdb_t *mldap, struct berval *uuid);
 
@@ -49,11 +59,18 @@ isc_uint32_t ATTR_CHECKRESULT ATTR_NONNULLS
 mldap_cur_generation_get(mldapdb_t *mldap);
 
 isc_result_t ATTR_CHECKRESULT ATTR_NONNULLS
-mldap_iter_deadnodes_start(mldapdb_t *mldap, metadb_iter_t **iterp,
-			   struct berval *uuid);
+mldap_iter_deadnodes_start(mldapdb_t *mldap, struct berval *uuid);
+
+isc_result_t ATTR_CHECKRESULT ATTR_NONNULLS
+mldap_iter_deadnodes_next(mldapdb_t *mldap, struct berval *uuid);
+
+isc_result_t ATTR_CHECKRESULT ATTR_NONNULLS
+mldap_save(mldapdb_t *mldap, const char *filename);
+
+isc_result_t ATTR_CHECKRESULT ATTR_NONNULLS
+mldap_load(mldapdb_t *mldap, const char *filename);
 
 isc_result_t ATTR_CHECKRESULT ATTR_NONNULLS
-mldap_iter_deadnodes_next(mldapdb_t *mldap, metadb_iter_t **iterp,
-		   struct berval *uuid);
+mldap_reset(mldapdb_t *mldap);
 
 #endif /* SRC_MLDAP_H_ */
@@ -0,0 +1,746 @@
+/*
+ * Copyright (C) 2016  bind-dyndb-ldap authors; see COPYING for license
+ */
+
+#include <isc/ht.h>
+#include <isc/mem.h>
+#include <isc/mutex.h>
+#include <isc/result.h>
+#include <isc/util.h>
+
+#include <string.h>
+#include <strings.h>
+
+#include <dns/name.h>
+
+#include "ldap_entry.h"
+#include "log.h"
+#include "rr_template.h"
+#include "settings.h"
+#include "str.h"
+#include "util.h"
+
+/* Hash table size is 2^RR_TEMPLATE_HT_BITS. */
+#define RR_TEMPLATE_HT_BITS	8
+
+/* Templates compiled after this limit are used once and thrown away. */
+#define RR_TEMPLATE_CACHE_MAX	4096
+
+static const char rr_template_attr_prefix[] = "idnsTemplateAttribute;";
+
+/*
+ * Literal part of the template optionally followed by reference
+ * to a variable. The last segment never references a variable.
+ */
+typedef struct rr_template_seg {
+	const char	*literal;
+	size_t		literal_len;
+	const char	*variable;
+} rr_template_seg_t;
+
+/*
+ * Compiled template is allocated as one block: header, array of segments,
+ * copy of the original text and NUL-terminated variable names.
+ * It is not modified after compilation.
+ */
+typedef struct rr_template rr_template_t;
+struct rr_template {
+	size_t			size;
+	const char		*text;
+	unsigned int		nsegs;
+	LINK(rr_template_t)	link;
+	rr_template_seg_t	segs[];
+};
+
+struct rr_templatecache {
+	isc_mem_t		*mctx;
+	isc_mutex_t		lock;
+	/* template text including terminating NUL -> rr_template_t */
+	isc_ht_t		*ht;
+	LIST(rr_template_t)	templates;
+	unsigned int		count;
+};
+
+typedef struct rr_templatevar	rr_templatevar_t;
+typedef struct rr_templateref	rr_templateref_t;
+typedef struct rr_templateentry	rr_templateentry_t;
+
+/* Substitution variable and all template entries which reference it. */
+struct rr_templatevar {
+	char			*name;
+	LIST(rr_templateref_t)	refs;
+};
+
+/* Reference from template entry to one variable. */
+struct rr_templateref {
+	rr_templatevar_t	*var;
+	rr_templateentry_t	*owner;
+	LINK(rr_templateref_t)	varlink;
+	LINK(rr_templateref_t)	ownerlink;
+};
+
+struct rr_templateentry {
+	ldap_entry_t			*entry;
+	LIST(rr_templateref_t)		refs;
+	LINK(rr_templateentry_t)	link;
+};
+
+struct rr_templateindex {
+	isc_mem_t			*mctx;
+	isc_mutex_t			lock;
+	/* entryUUID -> rr_templateentry_t */
+	isc_ht_t			*entries;
+	/* variable name -> rr_templatevar_t */
+	isc_ht_t			*vars;
+	LIST(rr_templateentry_t)	all;
+};
+
+static isc_boolean_t
+rr_template_isvarchar(const char c) {
+	return ISC_TF((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+		      || (c >= '0' && c <= '9') || c == '-' || c == '_');
+}
+
+/**
+ * Return length of variable reference \{variable_name\} at the beginning
+ * of text or 0 if text does not start with a variable reference.
+ */
+static size_t ATTR_NONNULLS
+rr_template_varlen(const char *text) {
+	const char *p;
+
+	if (text[0] != '\\' || text[1] != '{')
+		return 0;
+	for (p = text + 2; rr_template_isvarchar(*p); p++)
+		;
+	if (p == text + 2 || p[0] != '\\' || p[1] != '}')
+		return 0;
+
+	return p + 2 - text;
+}
+
+/**
+ * Find the next variable reference starting at offset *idx or after it.
+ * Reference which is preceded by backslash (i.e. \\{) is not matched
+ * unless it starts exactly at offset start, where the previous match ended.
+ *
+ * @retval ISC_TRUE  *idx is offset of the reference and *len its length.
+ * @retval ISC_FALSE No reference was found.
+ */
+static isc_boolean_t ATTR_NONNULLS
+rr_template_nextvar(const char *text, size_t start, size_t *idx, size_t *len)
+{
+	size_t i;
+
+	for (i = *idx; text[i] != '\0'; i++) {
+		if (i != start && text[i - 1] == '\\')
+			continue;
+		*len = rr_template_varlen(text + i);
+		if (*len > 0) {
+			*idx = i;
+			return ISC_TRUE;
+		}
+	}
+
+	return ISC_FALSE;
+}
+
+static void ATTR_NONNULLS
+rr_template_free(isc_mem_t *mctx, rr_template_t **tmplp) {
+	rr_template_t *tmpl = *tmplp;
+
+	if (tmpl == NULL)
+		return;
+
+	isc_mem_put(mctx, tmpl, tmpl->size);
+	*tmplp = NULL;
+}
+
+/**
+ * Split template into literal parts and variable names.
+ * Matching rules are the same as for regular expression
+ * \(^\|[^\]\)\\{\([a-zA-Z0-9_-]\+\)\\} applied repeatedly from the end
+ * of the previous match.
+ */
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+rr_template_compile(isc_mem_t *mctx, const char *text, rr_template_t **tmplp)
+{
+	isc_result_t result;
+	rr_template_t *tmpl = NULL;
+	rr_template_seg_t *seg;
+	size_t text_len = strlen(text);
+	size_t start, idx, len;
+	unsigned int nsegs = 1;
+	char *text_copy;
+	char *names;
+	size_t size;
+
+	REQUIRE(tmplp != NULL && *tmplp == NULL);
+
+	for (start = idx = 0;
+	     rr_template_nextvar(text, start, &idx, &len) == ISC_TRUE;
+	     start = idx = idx + len)
+		nsegs++;
+
+	/* variable names are shorter than the text */
+	size = sizeof(*tmpl) + nsegs * sizeof(tmpl->segs[0])
+	       + 2 * (text_len + 1);
+	CHECKED_MEM_GET(mctx, tmpl, size);
+	tmpl->size = size;
+	tmpl->nsegs = nsegs;
+	INIT_LINK(tmpl, link);
+	text_copy = (char *)(tmpl->segs + nsegs);
+	memcpy(text_copy, text, text_len + 1);
+	tmpl->text = text_copy;
+	names = text_copy + text_len + 1;
+
+	seg = tmpl->segs;
+	for (start = idx = 0;
+	     rr_template_nextvar(text, start, &idx, &len) == ISC_TRUE;
+	     start = idx = idx + len) {
+		seg->literal = tmpl->text + start;
+		seg->literal_len = idx - start;
+		/* strip \{ and \} */
+		memcpy(names, text + idx + 2, len - 4);
+		names[len - 4] = '\0';
+		seg->variable = names;
+		names += len - 3;
+		seg++;
+	}
+	seg->literal = tmpl->text + start;
+	seg->literal_len = text_len - start;
+	seg->variable = NULL;
+	INSIST(seg == tmpl->segs + nsegs - 1);
+
+	*tmplp = tmpl;
+	return ISC_R_SUCCESS;
+
+cleanup:
+	return result;
+}
+
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+rr_template_render(const rr_template_t *tmpl, const settings_set_t *set,
+		   ld_string_t *output)
+{
+	isc_result_t result;
+	const rr_template_seg_t *seg;
+	setting_t *setting;
+
+	str_clear(output);
+	for (seg = tmpl->segs; seg < tmpl->segs + tmpl->nsegs; seg++) {
+		CHECK(str_cat_char_len(output, seg->literal,
+				       seg->literal_len));
+		if (seg->variable == NULL)
+			break;
+
+		/* find value for given variable name in settings tree */
+		setting = NULL;
+		result = setting_find(seg->variable, set, isc_boolean_true,
+				      isc_boolean_true, &setting);
+		if (result != ISC_R_SUCCESS) {
+			log_debug(3, "setting '%s' is not defined so it "
+				  "cannot be substituted into template '%s'",
+				  seg->variable, tmpl->text);
+			CLEANUP_WITH(ISC_R_IGNORE);
+		}
+		if (setting->type != ST_STRING) {
+			log_bug("setting '%s' it not string so it cannot be "
+				"substituted", seg->variable);
+			CLEANUP_WITH(ISC_R_NOTIMPLEMENTED);
+		}
+		CHECK(str_cat_char(output, setting->value.value_char));
+	}
+
+	return ISC_R_SUCCESS;
+
+cleanup:
+	return result;
+}
+
+isc_result_t
+rr_templatecache_create(isc_mem_t *mctx, rr_templatecache_t **cachep)
+{
+	isc_result_t result;
+	rr_templatecache_t *cache = NULL;
+
+	REQUIRE(cachep != NULL && *cachep == NULL);
+
+	CHECKED_MEM_GET_PTR(mctx, cache);
+	ZERO_PTR(cache);
+	INIT_LIST(cache->templates);
+	result = isc_mutex_init(&cache->lock);
+	if (result != ISC_R_SUCCESS) {
+		SAFE_MEM_PUT_PTR(mctx, cache);
+		goto cleanup;
+	}
+	result = isc_ht_init(&cache->ht, mctx, RR_TEMPLATE_HT_BITS);
+	if (result != ISC_R_SUCCESS) {
+		DESTROYLOCK(&cache->lock);
+		SAFE_MEM_PUT_PTR(mctx, cache);
+		goto cleanup;
+	}
+	isc_mem_attach(mctx, &cache->mctx);
+
+	*cachep = cache;
+
+cleanup:
+	return result;
+}
+
+void
+rr_templatecache_destroy(rr_templatecache_t **cachep)
+{
+	rr_templatecache_t *cache;
+	rr_template_t *tmpl;
+
+	REQUIRE(cachep != NULL);
+
+	cache = *cachep;
+	if (cache == NULL)
+		return;
+
+	while ((tmpl = HEAD(cache->templates)) != NULL) {
+		UNLINK(cache->templates, tmpl, link);
+		rr_template_free(cache->mctx, &tmpl);
+	}
+	isc_ht_destroy(&cache->ht);
+	DESTROYLOCK(&cache->lock);
+	MEM_PUT_AND_DETACH(cache);
+
+	*cachep = NULL;
+}
+
+/**
+ * Find compiled template in cache or compile and cache it.
+ *
+ * @param[out] privatep ISC_TRUE if the template was not stored in the cache
+ *                      and caller has to free it.
+ */
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+rr_templatecache_get(rr_templatecache_t *cache, const char *text,
+		     rr_template_t **tmplp, isc_boolean_t *privatep)
+{
+	isc_result_t result;
+	rr_template_t *tmpl = NULL;
+	rr_template_t *cached = NULL;
+	unsigned char *key = (unsigned char *)text;
+	unsigned int keysize = strlen(text) + 1;
+
+	REQUIRE(tmplp != NULL && *tmplp == NULL);
+
+	LOCK(&cache->lock);
+	result = isc_ht_find(cache->ht, key, keysize, (void **)&cached);
+	UNLOCK(&cache->lock);
+	if (result == ISC_R_SUCCESS) {
+		*privatep = ISC_FALSE;
+		*tmplp = cached;
+		return ISC_R_SUCCESS;
+	}
+
+	/* Compile without the lock, another thread might do the same. */
+	CHECK(rr_template_compile(cache->mctx, text, &tmpl));
+
+	LOCK(&cache->lock);
+	if (isc_ht_find(cache->ht, key, keysize, (void **)&cached)
+	    == ISC_R_SUCCESS) {
+		rr_template_free(cache->mctx, &tmpl);
+		tmpl = cached;
+		*privatep = ISC_FALSE;
+	} else if (cache->count < RR_TEMPLATE_CACHE_MAX
+		   && isc_ht_add(cache->ht, key, keysize, tmpl)
+		      == ISC_R_SUCCESS) {
+		APPEND(cache->templates, tmpl, link);
+		cache->count++;
+		*privatep = ISC_FALSE;
+	} else {
+		*privatep = ISC_TRUE;
+	}
+	UNLOCK(&cache->lock);
+
+	*tmplp = tmpl;
+	return ISC_R_SUCCESS;
+
+cleanup:
+	return result;
+}
+
+/**
+ * Replace occurrences of \{variable_name\} with respective strings from
+ * settings tree. Remaining parts of the original string are just copied
+ * into the output.
+ *
+ * Double-escaped strings \\{ \\} do not trigger substitution.
+ * Nested references will expand only innermost variable: \{\{var1\}\}
+ * Non-matching parentheses and other garbage will be copied verbatim
+ * without trigerring an error.
+ *
+ * @retval  ISC_R_SUCCESS  Output string is valid.
+ * @retval  ISC_R_IGNORE   Some variables used in the template are not defined
+ *                         in settings tree. Substitution was terminated
+ *                         prematurely and output is not valid.
+ * @retval  others         Unexpected errors.
+ */
+isc_result_t
+rr_template_substitute(rr_templatecache_t *cache, const char *text,
+		       const settings_set_t *set, ld_string_t *output)
+{
+	isc_result_t result;
+	rr_template_t *tmpl = NULL;
+	isc_boolean_t private = ISC_FALSE;
+
+	CHECK(rr_templatecache_get(cache, text, &tmpl, &private));
+	result = rr_template_render(tmpl, set, output);
+
+cleanup:
+	if (private == ISC_TRUE)
+		rr_template_free(cache->mctx, &tmpl);
+	return result;
+}
+
+isc_result_t
+rr_templateindex_create(isc_mem_t *mctx, rr_templateindex_t **indexp)
+{
+	isc_result_t result;
+	rr_templateindex_t *index = NULL;
+
+	REQUIRE(indexp != NULL && *indexp == NULL);
+
+	CHECKED_MEM_GET_PTR(mctx, index);
+	ZERO_PTR(index);
+	INIT_LIST(index->all);
+	result = isc_mutex_init(&index->lock);
+	if (result != ISC_R_SUCCESS)
+		goto cleanup;
+	result = isc_ht_init(&index->entries, mctx, RR_TEMPLATE_HT_BITS);
+	if (result != ISC_R_SUCCESS) {
+		DESTROYLOCK(&index->lock);
+		goto cleanup;
+	}
+	result = isc_ht_init(&index->vars, mctx, RR_TEMPLATE_HT_BITS);
+	if (result != ISC_R_SUCCESS) {
+		isc_ht_destroy(&index->entries);
+		DESTROYLOCK(&index->lock);
+		goto cleanup;
+	}
+	isc_mem_attach(mctx, &index->mctx);
+
+	*indexp = index;
+	return ISC_R_SUCCESS;
+
+cleanup:
+	SAFE_MEM_PUT_PTR(mctx, index);
+	return result;
+}
+
+/**
+ * Remove entry from the index including all its variable references.
+ * Variables without references are removed too.
+ *
+ * @return LDAP entry owned by the removed index entry.
+ *
+ * @pre index->lock is locked.
+ */
+static ldap_entry_t * ATTR_NONNULLS
+rr_templateindex_delete(rr_templateindex_t *index, rr_templateentry_t *te)
+{
+	ldap_entry_t *entry = te->entry;
+	rr_templateref_t *ref;
+	rr_templatevar_t *var;
+
+	while ((ref = HEAD(te->refs)) != NULL) {
+		var = ref->var;
+		UNLINK(te->refs, ref, ownerlink);
+		UNLINK(var->refs, ref, varlink);
+		SAFE_MEM_PUT_PTR(index->mctx, ref);
+		if (EMPTY(var->refs)) {
+			RUNTIME_CHECK(isc_ht_delete(index->vars,
+					(unsigned char *)var->name,
+					strlen(var->name)) == ISC_R_SUCCESS);
+			isc_mem_free(index->mctx, var->name);
+			SAFE_MEM_PUT_PTR(index->mctx, var);
+		}
+	}
+	RUNTIME_CHECK(isc_ht_delete(index->entries,
+				    (unsigned char *)entry->uuid->bv_val,
+				    entry->uuid->bv_len) == ISC_R_SUCCESS);
+	UNLINK(index->all, te, link);
+	SAFE_MEM_PUT_PTR(index->mctx, te);
+
+	return entry;
+}
+
+void
+rr_templateindex_destroy(rr_templateindex_t **indexp)
+{
+	rr_templateindex_t *index;
+	rr_templateentry_t *te;
+	ldap_entry_t *entry;
+
+	REQUIRE(indexp != NULL);
+
+	index = *indexp;
+	if (index == NULL)
+		return;
+
+	while ((te = HEAD(index->all)) != NULL) {
+		entry = rr_templateindex_delete(index, te);
+		ldap_entry_destroy(&entry);
+	}
+	isc_ht_destroy(&index->vars);
+	isc_ht_destroy(&index->entries);
+	DESTROYLOCK(&index->lock);
+	MEM_PUT_AND_DETACH(index);
+
+	*indexp = NULL;
+}
+
+/**
+ * Add reference from the entry to variable unless it exists already.
+ *
+ * @pre index->lock is locked.
+ */
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+rr_templateindex_addref(rr_templateindex_t *index, rr_templateentry_t *te,
+			const char *name)
+{
+	isc_result_t result;
+	rr_templateref_t *ref = NULL;
+	rr_templatevar_t *var = NULL;
+	isc_boolean_t var_new = ISC_FALSE;
+	isc_boolean_t var_added = ISC_FALSE;
+
+	for (ref = HEAD(te->refs); ref != NULL; ref = NEXT(ref, ownerlink))
+		if (strcmp(ref->var->name, name) == 0)
+			return ISC_R_SUCCESS;
+
+	result = isc_ht_find(index->vars, (unsigned char *)name, strlen(name),
+			     (void **)&var);
+	if (result == ISC_R_NOTFOUND) {
+		CHECKED_MEM_GET_PTR(index->mctx, var);
+		ZERO_PTR(var);
+		INIT_LIST(var->refs);
+		var_new = ISC_TRUE;
+		CHECKED_MEM_STRDUP(index->mctx, name, var->name);
+		CHECK(isc_ht_add(index->vars, (unsigned char *)var->name,
+				 strlen(var->name), var));
+		var_added = ISC_TRUE;
+	} else if (result != ISC_R_SUCCESS) {
+		goto cleanup;
+	}
+
+	CHECKED_MEM_GET_PTR(index->mctx, ref);
+	ZERO_PTR(ref);
+	ref->var = var;
+	ref->owner = te;
+	INIT_LINK(ref, varlink);
+	INIT_LINK(ref, ownerlink);
+	APPEND(var->refs, ref, varlink);
+	APPEND(te->refs, ref, ownerlink);
+	return ISC_R_SUCCESS;
+
+cleanup:
+	/* new variable cannot have any references yet */
+	if (var_new == ISC_TRUE) {
+		if (var_added == ISC_TRUE)
+			RUNTIME_CHECK(isc_ht_delete(index->vars,
+					(unsigned char *)var->name,
+					strlen(var->name)) == ISC_R_SUCCESS);
+		if (var->name != NULL)
+			isc_mem_free(index->mctx, var->name);
+		SAFE_MEM_PUT_PTR(index->mctx, var);
+	}
+	return result;
+}
+
+/**
+ * Add references to all variables used by templates in the entry.
+ *
+ * @pre index->lock is locked.
+ */
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+rr_templateindex_addrefs(rr_templateindex_t *index, rr_templatecache_t *cache,
+			 rr_templateentry_t *te)
+{
+	isc_result_t result = ISC_R_SUCCESS;
+	ldap_attribute_t *attr;
+	ldap_value_t *val;
+	rr_template_t *tmpl = NULL;
+	isc_boolean_t private = ISC_FALSE;
+	unsigned int i;
+
+	for (attr = HEAD(te->entry->attrs);
+	     attr != NULL;
+	     attr = NEXT(attr, link)) {
+		if (strncasecmp(rr_template_attr_prefix, attr->name,
+				sizeof(rr_template_attr_prefix) - 1) != 0)
+			continue;
+		for (val = HEAD(attr->values);
+		     val != NULL;
+		     val = NEXT(val, link)) {
+			CHECK(rr_templatecache_get(cache, val->value, &tmpl,
+						   &private));
+			for (i = 0; i < tmpl->nsegs; i++)
+				if (tmpl->segs[i].variable != NULL)
+					CHECK(rr_templateindex_addref(index,
+						te, tmpl->segs[i].variable));
+			if (private == ISC_TRUE)
+				rr_template_free(cache->mctx, &tmpl);
+			tmpl = NULL;
+		}
+	}
+
+cleanup:
+	if (private == ISC_TRUE)
+		rr_template_free(cache->mctx, &tmpl);
+	return result;
+}
+
+/**
+ * Remember state of template entry processed by update_record().
+ * Previous state of the same entry is replaced. Entries without
+ * any variable references are not stored.
+ *
+ * Failure only means that records from the entry will not be refreshed
+ * when variables change so it is logged and not returned.
+ *
+ * @param[in,out] entryp Entry with LDAP_ENTRYCLASS_TEMPLATE and UUID.
+ *                       Index takes ownership of the entry.
+ */
+void
+rr_templateindex_store(rr_templateindex_t *index, rr_templatecache_t *cache,
+		       ldap_entry_t **entryp)
+{
+	isc_result_t result;
+	ldap_entry_t *entry = *entryp;
+	ldap_entry_t *old = NULL;
+	rr_templateentry_t *te = NULL;
+
+	REQUIRE(entry->uuid != NULL);
+	REQUIRE(entry->template_refresh == ISC_FALSE);
+
+	*entryp = NULL;
+
+	LOCK(&index->lock);
+	result = isc_ht_find(index->entries,
+			     (unsigned char *)entry->uuid->bv_val,
+			     entry->uuid->bv_len, (void **)&te);
+	if (result == ISC_R_SUCCESS)
+		old = rr_templateindex_delete(index, te);
+	te = NULL;
+
+	CHECKED_MEM_GET_PTR(index->mctx, te);
+	ZERO_PTR(te);
+	te->entry = entry;
+	INIT_LIST(te->refs);
+	INIT_LINK(te, link);
+	result = isc_ht_add(index->entries,
+			    (unsigned char *)entry->uuid->bv_val,
+			    entry->uuid->bv_len, te);
+	if (result != ISC_R_SUCCESS) {
+		SAFE_MEM_PUT_PTR(index->mctx, te);
+		goto cleanup;
+	}
+	APPEND(index->all, te, link);
+	entry = NULL;
+
+	CHECK(rr_templateindex_addrefs(index, cache, te));
+	if (EMPTY(te->refs))
+		entry = rr_templateindex_delete(index, te);
+
+cleanup:
+	if (result != ISC_R_SUCCESS) {
+		if (te != NULL && entry == NULL)
+			entry = rr_templateindex_delete(index, te);
+		log_error_r("%s: templates will not be refreshed when "
+			    "substitution variables change",
+			    ldap_entry_logname(entry));
+	}
+	UNLOCK(&index->lock);
+	ldap_entry_destroy(&old);
+	ldap_entry_destroy(&entry);
+}
+
+/**
+ * Forget template entry with given UUID. If fqdn is not NULL, the entry
+ * is forgotten only if it has the same DNS name. This prevents deletion
+ * of renamed entry which was already stored under the new name.
+ */
+void
+rr_templateindex_remove(rr_templateindex_t *index, struct berval *uuid,
+			dns_name_t *fqdn)
+{
+	rr_templateentry_t *te = NULL;
+	ldap_entry_t *entry = NULL;
+
+	LOCK(&index->lock);
+	if (isc_ht_find(index->entries, (unsigned char *)uuid->bv_val,
+			uuid->bv_len, (void **)&te) == ISC_R_SUCCESS
+	    && (fqdn == NULL || dns_name_equal(&te->entry->fqdn, fqdn)))
+		entry = rr_templateindex_delete(index, te);
+	UNLOCK(&index->lock);
+
+	ldap_entry_destroy(&entry);
+}
+
+/**
+ * Remove template entry with given UUID from the index and pass its
+ * ownership to the caller. Caller should store the entry again
+ * after processing.
+ *
+ * @retval ISC_R_SUCCESS  Entry was taken.
+ * @retval ISC_R_NOTFOUND Entry was deleted or it is not a template anymore.
+ */
+isc_result_t
+rr_templateindex_take(rr_templateindex_t *index, struct berval *uuid,
+		      ldap_entry_t **entryp)
+{
+	isc_result_t result;
+	rr_templateentry_t *te = NULL;
+
+	REQUIRE(*entryp == NULL);
+
+	LOCK(&index->lock);
+	result = isc_ht_find(index->entries, (unsigned char *)uuid->bv_val,
+			     uuid->bv_len, (void **)&te);
+	if (result == ISC_R_SUCCESS)
+		*entryp = rr_templateindex_delete(index, te);
+	UNLOCK(&index->lock);
+
+	return result;
+}
+
+/**
+ * Create refresh entries for all template entries which reference
+ * given variable, see ldap_entry_templaterefresh().
+ *
+ * @param[out] refreshes List of new entries. Caller has to destroy them
+ *                       even if this function fails.
+ */
+isc_result_t
+rr_templateindex_refresh(rr_templateindex_t *index, const char *variable,
+			 ldap_entrylist_t *refreshes)
+{
+	isc_result_t result;
+	rr_templatevar_t *var = NULL;
+	rr_templateref_t *ref;
+	ldap_entry_t *refresh;
+
+	LOCK(&index->lock);
+	result = isc_ht_find(index->vars, (unsigned char *)variable,
+			     strlen(variable), (void **)&var);
+	if (result == ISC_R_NOTFOUND)
+		CLEANUP_WITH(ISC_R_SUCCESS);
+	else if (result != ISC_R_SUCCESS)
+		goto cleanup;
+
+	for (ref = HEAD(var->refs); ref != NULL; ref = NEXT(ref, varlink)) {
+		refresh = NULL;
+		CHECK(ldap_entry_templaterefresh(ref->owner->entry, &refresh));
+		APPEND(*refreshes, refresh, link);
+	}
+
+cleanup:
+	UNLOCK(&index->lock);
+	return result;
+}
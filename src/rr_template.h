@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2016  bind-dyndb-ldap authors; see COPYING for license
+ */
+
+#ifndef _LD_RR_TEMPLATE_H_
+#define _LD_RR_TEMPLATE_H_
+
+#include <isc/mem.h>
+
+#include "ldap_entry.h"
+#include "settings.h"
+#include "str.h"
+#include "types.h"
+#include "util.h"
+
+/*
+ * Cache of compiled idnsTemplateAttribute values. Each template is split
+ * into literal parts and variable references only once and then rendered
+ * with values from settings tree. Cache is shared by all threads.
+ */
+typedef struct rr_templatecache	rr_templatecache_t;
+
+isc_result_t
+rr_templatecache_create(isc_mem_t *mctx,
+			rr_templatecache_t **cachep) ATTR_NONNULLS ATTR_CHECKRESULT;
+
+void
+rr_templatecache_destroy(rr_templatecache_t **cachep) ATTR_NONNULLS;
+
+isc_result_t
+rr_template_substitute(rr_templatecache_t *cache, const char *text,
+		       const settings_set_t *set,
+		       ld_string_t *output) ATTR_NONNULLS ATTR_CHECKRESULT;
+
+/*
+ * Index of template entries by substitution variables they reference.
+ * Index owns the last processed state of each template entry so records
+ * can be rendered again when a variable changes. Index is thread-safe.
+ */
+typedef struct rr_templateindex	rr_templateindex_t;
+
+isc_result_t
+rr_templateindex_create(isc_mem_t *mctx,
+			rr_templateindex_t **indexp) ATTR_NONNULLS ATTR_CHECKRESULT;
+
+void
+rr_templateindex_destroy(rr_templateindex_t **indexp) ATTR_NONNULLS;
+
+void
+rr_templateindex_store(rr_templateindex_t *index, rr_templatecache_t *cache,
+		       ldap_entry_t **entryp) ATTR_NONNULLS;
+
+void
+rr_templateindex_remove(rr_templateindex_t *index, struct berval *uuid,
+			dns_name_t *fqdn) ATTR_NONNULL(1,2);
+
+isc_result_t
+rr_templateindex_take(rr_templateindex_t *index, struct berval *uuid,
+		      ldap_entry_t **entryp) ATTR_NONNULLS ATTR_CHECKRESULT;
+
+isc_result_t
+rr_templateindex_refresh(rr_templateindex_t *index, const char *variable,
+			 ldap_entrylist_t *refreshes) ATTR_NONNULLS ATTR_CHECKRESULT;
+
+#endif /* !_LD_RR_TEMPLATE_H_ */
@@ -4,6 +4,7 @@
 
 #include <isc/util.h>
 #include <isc/mem.h>
+#include <isc/once.h>
 #include <isc/task.h>
 #include <isc/result.h>
 #include <isc/string.h>
@@ -13,6 +14,7 @@
 #include <dns/name.h>
 
 #include <ctype.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
@@ -27,32 +29,48 @@
 
 isc_boolean_t verbose_checks = ISC_FALSE; /* log each failure in CHECK() macro */
 
-/** Built-in defaults. */
+/**
+ * Built-in defaults. This array lists all known settings and position
+ * of each setting is its ID, see setting_id(). It has to be sorted
+ * by name and it has to contain every setting used in any set of settings.
+ * Settings without built-in default are listed with no_default_*.
+ */
 static const setting_t settings_default[] = {
-	{ "default_ttl",		default_uint(86400)		}, /* Seconds */
-	{ "uri",			no_default_string		}, /* User have to set this */
-	{ "connections",		default_uint(2)			},
-	{ "reconnect_interval",		default_uint(60)		},
-	{ "zone_refresh",		default_string("")		}, /* No longer supported */
-	{ "timeout",			default_uint(10)		},
-	{ "cache_ttl",			default_string("")		}, /* No longer supported */
-	{ "timeout",			default_uint(10)		},
-	{ "base",	 		no_default_string		}, /* User have to set this */
+	{ "active",			no_default_boolean		},
+	{ "allow_query",		no_default_string		},
+	{ "allow_transfer",		no_default_string		},
 	{ "auth_method",		default_string("none")		},
+	{ "auth_method_enum",		no_default_uint			},
+	{ "base",	 		no_default_string		}, /* User have to set this */
 	{ "bind_dn",			default_string("")		},
-	{ "password",			default_string("")		},
+	{ "cache_ttl",			default_string("")		}, /* No longer supported */
+	{ "connections",		default_uint(2)			},
+	{ "default_ttl",		default_uint(86400)		}, /* Seconds */
+	{ "directory",			default_string("")		},
+	{ "dyn_update",			default_boolean(ISC_FALSE)	},
+	{ "fake_mname",			default_string("")		},
+	{ "forward_policy",		no_default_string		},
+	{ "forwarders",			no_default_string		},
+	{ "krb5_keytab",		default_string("")		},
 	{ "krb5_principal",		default_string("")		},
-	{ "sasl_mech",			default_string("GSSAPI")	},
-	{ "sasl_user",			default_string("")		},
+	{ "ldap_hostname",		default_string("")		},
+	{ "nsec3param",			no_default_string		},
+	{ "password",			default_string("")		},
+	{ "psearch",			default_string("")		}, /* No longer supported */
+	{ "reconnect_interval",		default_uint(60)		},
 	{ "sasl_auth_name",		default_string("")		},
-	{ "sasl_realm",			default_string("")		},
+	{ "sasl_mech",			default_string("GSSAPI")	},
 	{ "sasl_password",		default_string("")		},
-	{ "krb5_keytab",		default_string("")		},
-	{ "fake_mname",			default_string("")		},
-	{ "psearch",			default_string("")		}, /* No longer supported */
-	{ "ldap_hostname",		default_string("")		},
+	{ "sasl_realm",			default_string("")		},
+	{ "sasl_user",			default_string("")		},
+	{ "serial_autoincrement",	default_string("")		},
+	{ "server_id",			default_string("")		},
+	{ "substitutionvariable_ipalocation", no_default_string	},
+	{ "sync_poll_interval",		default_uint(0)			}, /* Seconds */
 	{ "sync_ptr",			default_boolean(ISC_FALSE)	},
-	{ "dyn_update",			default_boolean(ISC_FALSE)	},
+	{ "sync_queue_limit",		default_uint(67108864)		}, /* Bytes */
+	{ "sync_shards",		default_uint(1)			},
+	{ "timeout",			default_uint(10)		},
 	/* Empty string as default update_policy declares zone as 'dynamic'
 	 * for dns_zone_isdynamic() to prevent unwanted
 	 * zone_postload() calls and warnings about serial and so on.
@@ -60,22 +78,185 @@ static const setting_t settings_default[] = {
 	 * SSU table defined by empty string contains no rules =>
 	 * dns_ssutable_checkrules() will return deny. */
 	{ "update_policy",		default_string("")		},
-	{ "serial_autoincrement",	default_string("")		},
+	{ "uri",			no_default_string		}, /* User have to set this */
 	{ "verbose_checks",		default_boolean(ISC_FALSE)	},
-	{ "directory",			default_string("")		},
-	{ "server_id",			default_string("")		},
+	{ "warm_start",			default_boolean(ISC_FALSE)	},
+	{ "zone_refresh",		default_string("")		}, /* No longer supported */
 	end_of_settings
 };
 
+/** Number of known settings, IDs are 0 .. SETTING_COUNT - 1. */
+#define SETTING_COUNT	(sizeof(settings_default) / sizeof(settings_default[0]) - 1)
+
 /** Settings set for built-in defaults. */
 const settings_set_t settings_default_set = {
 	NULL,
 	"built-in defaults",
 	NULL,
 	NULL,
-	(setting_t *) &settings_default[0]
+	&settings_default[0],
+	NULL,
+	NULL
+};
+
+/**
+ * Verify that settings_default[] is sorted, setting_id() relies on it.
+ */
+static void
+settings_default_check(void) {
+	unsigned int i;
+
+	for (i = 1; i < SETTING_COUNT; i++)
+		INSIST(strcmp(settings_default[i - 1].name,
+			      settings_default[i].name) < 0);
+}
+
+/**
+ * Translate setting name to its ID.
+ *
+ * @retval ID  Position of the setting in settings_default[].
+ * @retval -1  Setting with given name does not exist.
+ */
+static int ATTR_NONNULLS ATTR_CHECKRESULT
+setting_id(const char *name) {
+	int low = 0;
+	int high = SETTING_COUNT - 1;
+	int mid;
+	int cmp;
+
+	while (low <= high) {
+		mid = (low + high) / 2;
+		cmp = strcmp(name, settings_default[mid].name);
+		if (cmp == 0)
+			return mid;
+		else if (cmp < 0)
+			high = mid - 1;
+		else
+			low = mid + 1;
+	}
+
+	return -1;
+}
+
+/**
+ * Get position of setting with given ID in array of defaults of the set.
+ *
+ * @retval position
+ * @retval -1       Setting is not part of the set.
+ */
+static int ATTR_NONNULLS ATTR_CHECKRESULT
+setting_pos(const settings_set_t *set, int id) {
+	/* built-in defaults are indexed directly by IDs */
+	if (set->slots == NULL)
+		return id;
+
+	return (int)set->slots[id] - 1;
+}
+
+/**
+ * Get position of setting with given name in array of defaults of the set.
+ *
+ * @retval position
+ * @retval -1       Setting is not part of the set or it does not exist.
+ */
+static int ATTR_NONNULLS ATTR_CHECKRESULT
+setting_pos_byname(const settings_set_t *set, const char *name) {
+	int id;
+
+	id = setting_id(name);
+	if (id < 0)
+		return -1;
+
+	return setting_pos(set, id);
+}
+
+/**
+ * Published version of a setting. Versions are immutable: each change
+ * creates new version which replaces the previous one atomically.
+ * Replaced versions are kept until settings_set_reclaim() is called
+ * at a point where no reader can use them, so readers can use values
+ * (including strings) without locking.
+ *
+ * New version is published only if the value really changes, see set_value()
+ * and setting_unset(), so callers which store the same value repeatedly
+ * do not accumulate versions.
+ */
+typedef struct setting_version setting_version_t;
+struct setting_version {
+	setting_t		setting; /**< has to be the first member */
+	setting_version_t	*older;  /**< version replaced by this one */
 };
 
+/**
+ * Get current value of setting on given position in the set: the latest
+ * published version or default value from the array the set was created from.
+ */
+static setting_t * ATTR_NONNULLS ATTR_CHECKRESULT
+setting_bypos(const settings_set_t *set, int pos) {
+	setting_t *setting = NULL;
+
+	if (set->values != NULL)
+		setting = __atomic_load_n(&set->values[pos], __ATOMIC_ACQUIRE);
+	if (setting != NULL)
+		return setting;
+
+	return (setting_t *)&set->first_setting[pos];
+}
+
+/**
+ * Create new unpublished version of setting on given position
+ * as a copy of its current value. Caller owns the copy until
+ * setting_publish() is called.
+ *
+ * @pre set->lock is locked.
+ */
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+setting_version_create(const settings_set_t *set, int pos,
+		       setting_t **settingp) {
+	isc_result_t result;
+	setting_version_t *version = NULL;
+
+	REQUIRE(settingp != NULL && *settingp == NULL);
+
+	CHECKED_MEM_GET_PTR(set->mctx, version);
+	version->setting = *setting_bypos(set, pos);
+	/* string is owned by the older version */
+	version->setting.is_dynamic = ISC_FALSE;
+	version->older = (setting_version_t *)set->values[pos];
+
+	*settingp = &version->setting;
+	return ISC_R_SUCCESS;
+
+cleanup:
+	return result;
+}
+
+/**
+ * Free single version of setting, older versions are not affected.
+ */
+static void ATTR_NONNULLS
+setting_version_free(isc_mem_t *mctx, setting_t **settingp) {
+	setting_version_t *version = (setting_version_t *)*settingp;
+
+	if (version->setting.is_dynamic)
+		isc_mem_free(mctx, version->setting.value.value_char);
+	SAFE_MEM_PUT_PTR(mctx, version);
+	*settingp = NULL;
+}
+
+/**
+ * Make new version of setting visible to readers.
+ *
+ * @pre set->lock is locked.
+ */
+static void ATTR_NONNULLS
+setting_publish(const settings_set_t *set, int pos, setting_t *setting) {
+	INSIST(((setting_version_t *)setting)->older ==
+	       (setting_version_t *)set->values[pos]);
+
+	__atomic_store_n(&set->values[pos], setting, __ATOMIC_RELEASE);
+}
+
 /**
  * @param[in] name Setting name.
  * @param[in] set Set of settings to start search in.
@@ -83,6 +264,10 @@ const settings_set_t settings_default_set = {
  *                      not found in set passed by caller.
  * @param[in] filled_only Consider settings without value as non-existent.
  * @param[out] found Pointer to found setting_t. Ignored if found is NULL.
+ *                   Found setting must not be modified. It stays valid
+ *                   even if the setting is changed in the meantime,
+ *                   until settings_set_reclaim() or settings_set_free()
+ *                   is called.
  *
  * @pre found == NULL || (found != NULL && *found == NULL)
  *
@@ -93,29 +278,31 @@ isc_result_t
 setting_find(const char *name, const settings_set_t *set,
 	     isc_boolean_t recursive, isc_boolean_t filled_only,
 	     setting_t **found) {
+	int id;
+	int pos;
+	setting_t *setting;
 
 	REQUIRE(name != NULL);
 	REQUIRE(found == NULL || *found == NULL);
 
+	id = setting_id(name);
+	if (id < 0)
+		return ISC_R_NOTFOUND;
+
 	while (set != NULL) {
 		log_debug(20, "examining set of settings '%s'", set->name);
-		for (setting_t *setting = set->first_setting;
-				setting->name;
-				setting++) {
-
-			if (strcmp(name, setting->name) == 0) {
-				if (setting->filled || !filled_only) {
-					if (found != NULL)
-						*found = setting;
-					log_debug(20, "setting '%s' was found "
-						      "in set '%s'", name,
-						      set->name);
-					return ISC_R_SUCCESS;
-				} else {
-					break; /* continue with parent set */
-				}
+		pos = setting_pos(set, id);
+		if (pos >= 0) {
+			setting = setting_bypos(set, pos);
+			if (setting->filled || !filled_only) {
+				if (found != NULL)
+					*found = setting;
+				log_debug(20, "setting '%s' was found "
+					      "in set '%s'", name,
+					      set->name);
+				return ISC_R_SUCCESS;
 			}
-
+			/* continue with parent set */
 		}
 		if (recursive)
 			set = set->parent_set;
@@ -217,14 +404,15 @@ setting_get_bool(const char *const name, const settings_set_t *const set,
  * @retval others         Other errors from isc_parse_uint32().
  */
 static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
-set_value(isc_mem_t *mctx, const settings_set_t *set, setting_t *setting,
+set_value(isc_mem_t *mctx, const settings_set_t *set, int pos,
 	  const char *value)
 {
 	isc_result_t result;
 	isc_uint32_t numeric_value;
 	isc_uint32_t len;
+	setting_t *setting = NULL;
+	setting_t *new_setting = NULL;
 
-	REQUIRE(setting != NULL);
 	REQUIRE(value != NULL);
 	REQUIRE(set != NULL);
 
@@ -232,6 +420,10 @@ set_value(isc_mem_t *mctx, const settings_set_t *set, setting_t *setting,
 	REQUIRE(set->lock != NULL);
 	LOCK(set->lock);
 
+	/* Compare with current value first so unchanged settings
+	 * do not get new version. */
+	setting = setting_bypos(set, pos);
+
 	/* Check and convert new values. */
 	switch (setting->type) {
 	case ST_STRING:
@@ -278,11 +470,11 @@ set_value(isc_mem_t *mctx, const settings_set_t *set, setting_t *setting,
 		break;
 	}
 
+	CHECK(setting_version_create(set, pos, &new_setting));
+	setting = new_setting;
 	switch (setting->type) {
 	case ST_STRING:
 		len = strlen(value) + 1;
-		if (setting->is_dynamic)
-			isc_mem_free(mctx, setting->value.value_char);
 		CHECKED_MEM_ALLOCATE(mctx, setting->value.value_char, len);
 		setting->is_dynamic = ISC_TRUE;
 		CHECK(isc_string_copy(setting->value.value_char, len, value));
@@ -301,9 +493,13 @@ set_value(isc_mem_t *mctx, const settings_set_t *set, setting_t *setting,
 		break;
 	}
 	setting->filled = 1;
+	setting_publish(set, pos, new_setting);
+	new_setting = NULL;
 	result = ISC_R_SUCCESS;
 
 cleanup:
+	if (new_setting != NULL)
+		setting_version_free(mctx, &new_setting);
 	UNLOCK(set->lock);
 	return result;
 }
@@ -329,24 +525,24 @@ isc_result_t
 setting_set(const char *const name, const settings_set_t *set,
 	    const char *const value)
 {
-	isc_result_t result;
-	setting_t *setting = NULL;
+	int pos;
 
-	CHECK(setting_find(name, set, ISC_FALSE, ISC_FALSE, &setting));
-
-	return set_value(set->mctx, set, setting, value);
+	pos = setting_pos_byname(set, name);
+	if (pos < 0) {
+		log_bug("setting '%s' was not found in set of settings '%s'",
+			name, set->name);
+		return ISC_R_NOTFOUND;
+	}
 
-cleanup:
-	log_bug("setting '%s' was not found in set of settings '%s'", name,
-		set->name);
-	return result;
+	return set_value(set->mctx, set, pos, value);
 }
 
 /**
  * Un-set value in given set of settings (non-recursively, parent sets are
  * not affected in any way). Function will fail if setting with given name is
  * not a part of set of settings.
- * Mutual exclusion is ensured by isc_task_beginexclusive().
+ * Mutual exclusion with other writers is ensured by set->lock,
+ * readers are not blocked.
  *
  * @warning
  * Failure in this function usually points to logic error.
@@ -361,20 +557,28 @@ isc_result_t
 setting_unset(const char *const name, const settings_set_t *set)
 {
 	isc_result_t result;
+	int pos;
 	setting_t *setting = NULL;
 
-	CHECK(setting_find(name, set, ISC_FALSE, ISC_FALSE, &setting));
-
-	if (!setting->filled)
-		return ISC_R_IGNORE;
+	pos = setting_pos_byname(set, name);
+	if (pos < 0) {
+		log_bug("setting '%s' was not found in set of settings '%s'",
+			name, set->name);
+		return ISC_R_NOTFOUND;
+	}
 
+	/* catch attempts to modify built-in defaults */
+	REQUIRE(set->lock != NULL);
 	LOCK(set->lock);
 
+	if (!setting_bypos(set, pos)->filled)
+		CLEANUP_WITH(ISC_R_IGNORE);
+
+	CHECK(setting_version_create(set, pos, &setting));
 	switch (setting->type) {
 	case ST_STRING:
-		if (setting->is_dynamic)
-			isc_mem_free(set->mctx, setting->value.value_char);
-		setting->is_dynamic = ISC_FALSE;
+		/* value is owned by the older version */
+		setting->value.value_char = NULL;
 		break;
 
 	case ST_UNSIGNED_INTEGER:
@@ -386,13 +590,11 @@ setting_unset(const char *const name, const settings_set_t *set)
 		break;
 	}
 	setting->filled = 0;
+	setting_publish(set, pos, setting);
+	result = ISC_R_SUCCESS;
 
 cleanup:
 	UNLOCK(set->lock);
-	if (result == ISC_R_NOTFOUND)
-		log_bug("setting '%s' was not found in set of settings '%s'",
-			name, set->name);
-
 	return result;
 }
 
@@ -446,9 +648,12 @@ cleanup:
 }
 
 /**
- * Allocate new set of settings, fill it with values from specified default set
+ * Allocate new set of settings based on specified default set
  * and (optionally) link the new set of settings to its parent set.
  *
+ * Array with defaults is not copied, new set refers to it and stores only
+ * values which were changed later. The array has to exist as long as the set.
+ *
  * @param[in] default_settings   Array with pre-filled setting structures.
  * @param[in] default_set_length Default set length in bytes.
  * @param[in] set_name		 Human readable name for this set of settings.
@@ -456,28 +661,23 @@ cleanup:
  * @pre target != NULL && *target == NULL
  * @pre default_settings != NULL
  * @pre default_set_length > 0, default_set_length <= sizeof(default_settings)
+ * @pre All setting names are listed in settings_default[].
  *
  * @retval ISC_R_SUCCESS
  * @retval ISC_R_NOMEMORY
+ * @retval ISC_R_UNEXPECTED Unknown setting name in default_settings.
  *
  * @note How to create local_settings which overrides default_settings:
  * @code
- * const setting_t default_settings[] = {
- *	{ "connections",	default_uint(2)		},
- * }
- * const settings_set_t default_settings_set = {
- *	NULL,
- *	NULL,
- *	(setting_t *) &default_settings[0]
- * };
- * const setting_t local_settings[] = {
+ * static const setting_t local_settings_default[] = {
  *	{ "connections",	no_default_uint		},
- * }
+ *	end_of_settings
+ * };
  *
  * settings_set_t *local_settings = NULL;
- * result = settings_set_create(mctx, default_settings,
- * 				sizeof(default_settings), &default_settings_set,
- *				&local_settings);
+ * result = settings_set_create(mctx, local_settings_default,
+ * 				sizeof(local_settings_default), "local",
+ * 				&settings_default_set, &local_settings);
  * @endcode
  */
 isc_result_t
@@ -487,12 +687,18 @@ settings_set_create(isc_mem_t *mctx, const setting_t default_settings[],
 		    settings_set_t **target) {
 	isc_result_t result = ISC_R_FAILURE;
 	settings_set_t *new_set = NULL;
+	unsigned int count;
+	int id;
+	static isc_once_t default_check_once = ISC_ONCE_INIT;
 
 	REQUIRE(target != NULL && *target == NULL);
 	REQUIRE(default_settings != NULL);
 	REQUIRE(default_set_length > 0);
 
-	CHECKED_MEM_ALLOCATE(mctx, new_set, default_set_length);
+	RUNTIME_CHECK(isc_once_do(&default_check_once, settings_default_check)
+		      == ISC_R_SUCCESS);
+
+	CHECKED_MEM_GET_PTR(mctx, new_set);
 	ZERO_PTR(new_set);
 	isc_mem_attach(mctx, &new_set->mctx);
 
@@ -501,13 +707,29 @@ settings_set_create(isc_mem_t *mctx, const setting_t default_settings[],
 	INSIST(result == ISC_R_SUCCESS);
 
 	new_set->parent_set = parent_set;
-
-	CHECKED_MEM_ALLOCATE(mctx, new_set->first_setting, default_set_length);
-	memcpy(new_set->first_setting, default_settings, default_set_length);
+	new_set->first_setting = default_settings;
 
 	CHECKED_MEM_ALLOCATE(mctx, new_set->name, strlen(set_name) + 1);
 	strcpy(new_set->name, set_name);
 
+	CHECKED_MEM_ALLOCATE(mctx, new_set->slots, SETTING_COUNT);
+	memset(new_set->slots, 0, SETTING_COUNT);
+	for (count = 0; default_settings[count].name != NULL; count++) {
+		id = setting_id(default_settings[count].name);
+		if (id < 0) {
+			log_bug("setting '%s' in set of settings '%s' "
+				"is not listed in built-in defaults",
+				default_settings[count].name, set_name);
+			CLEANUP_WITH(ISC_R_UNEXPECTED);
+		}
+		INSIST(count < UCHAR_MAX);
+		new_set->slots[id] = count + 1;
+	}
+
+	CHECKED_MEM_ALLOCATE(mctx, new_set->values,
+			     (count + 1) * sizeof(*new_set->values));
+	memset(new_set->values, 0, (count + 1) * sizeof(*new_set->values));
+
 	*target = new_set;
 	result = ISC_R_SUCCESS;
 
@@ -527,6 +749,8 @@ void
 settings_set_free(settings_set_t **set) {
 	isc_mem_t *mctx = NULL;
 	setting_t *s = NULL;
+	setting_version_t *older = NULL;
+	unsigned int i;
 
 	if (set == NULL || *set == NULL)
 		return;
@@ -539,20 +763,87 @@ settings_set_free(settings_set_t **set) {
 			SAFE_MEM_PUT_PTR(mctx, (*set)->lock);
 		}
 
-		for (s = (*set)->first_setting; s->name != NULL; s++) {
-			if (s->is_dynamic)
-				isc_mem_free(mctx, s->value.value_char);
+		if ((*set)->values != NULL) {
+			for (i = 0; (*set)->first_setting[i].name != NULL; i++) {
+				s = (*set)->values[i];
+				while (s != NULL) {
+					older = ((setting_version_t *)s)->older;
+					setting_version_free(mctx, &s);
+					s = (setting_t *)older;
+				}
+			}
+			isc_mem_free(mctx, (*set)->values);
 		}
-		if ((*set)->first_setting != NULL)
-			isc_mem_free(mctx, (*set)->first_setting);
-		isc_mem_free(mctx, (*set)->name);
-		isc_mem_free(mctx, *set);
+		if ((*set)->slots != NULL)
+			isc_mem_free(mctx, (*set)->slots);
+		if ((*set)->name != NULL)
+			isc_mem_free(mctx, (*set)->name);
+		SAFE_MEM_PUT_PTR(mctx, *set);
 		isc_mem_detach(&mctx);
 	}
 
 	*set = NULL;
 }
 
+/**
+ * Check if some setting in the set has replaced versions which can be freed
+ * by settings_set_reclaim().
+ */
+isc_boolean_t
+settings_set_reclaimable(const settings_set_t *set) {
+	setting_version_t *version;
+	isc_boolean_t reclaimable = ISC_FALSE;
+	unsigned int i;
+
+	REQUIRE(set->lock != NULL);
+
+	LOCK(set->lock);
+	for (i = 0; set->first_setting[i].name != NULL; i++) {
+		version = (setting_version_t *)set->values[i];
+		if (version != NULL && version->older != NULL) {
+			reclaimable = ISC_TRUE;
+			break;
+		}
+	}
+	UNLOCK(set->lock);
+
+	return reclaimable;
+}
+
+/**
+ * Free versions of settings which were replaced by newer versions,
+ * only the latest version of each setting is kept.
+ *
+ * @pre No reader uses setting or value obtained from the set before
+ *      the latest change, e.g. all tasks reading the set are paused
+ *      by isc_task_beginexclusive() and no other thread reads the set.
+ */
+void
+settings_set_reclaim(const settings_set_t *set) {
+	setting_t *s = NULL;
+	setting_version_t *version;
+	setting_version_t *older;
+	unsigned int i;
+
+	REQUIRE(set->lock != NULL);
+
+	LOCK(set->lock);
+	for (i = 0; set->first_setting[i].name != NULL; i++) {
+		version = (setting_version_t *)set->values[i];
+		if (version == NULL)
+			continue;
+		/* the latest version owns its string, see set_value() */
+		s = (setting_t *)version->older;
+		version->older = NULL;
+		while (s != NULL) {
+			older = ((setting_version_t *)s)->older;
+			setting_version_free(set->mctx, &s);
+			s = (setting_t *)older;
+		}
+	}
+	UNLOCK(set->lock);
+}
+
 /**
  * Append textlen bytes from text to isc_buffer pointed to by closure.
  *
@@ -582,7 +873,8 @@ static isc_result_t
 settings_set_fill(const cfg_obj_t *config, settings_set_t *set)
 {
 	isc_result_t result;
-	setting_t *setting;
+	const setting_t *setting;
+	int pos;
 	isc_buffer_t *buf_value = NULL;
 	const cfg_obj_t *cfg_value;
 	const char *str_value;
@@ -592,9 +884,9 @@ settings_set_fill(const cfg_obj_t *config, settings_set_t *set)
 	CHECK(isc_buffer_allocate(set->mctx, &buf_value, ISC_BUFFER_INCR));
 	isc_buffer_setautorealloc(buf_value, ISC_TRUE);
 
-	for (setting = set->first_setting;
+	for (pos = 0, setting = set->first_setting;
 	     setting->name != NULL;
-	     setting++) {
+	     pos++, setting++) {
 		cfg_value = NULL;
 		result = cfg_map_get(config, setting->name, &cfg_value);
 		if (result == ISC_R_NOTFOUND)
@@ -609,7 +901,7 @@ settings_set_fill(const cfg_obj_t *config, settings_set_t *set)
 			isc_buffer_putmem(buf_value, (unsigned char *)"\0", 1);
 			str_value = isc_buffer_base(buf_value);
 		}
-		result = set_value(set->mctx, set, setting, str_value);
+		result = set_value(set->mctx, set, pos, str_value);
 		if (result != ISC_R_SUCCESS && result != ISC_R_IGNORE)
 			goto cleanup;
 		isc_buffer_clear(buf_value);
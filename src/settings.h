@@ -43,8 +43,14 @@ struct settings_set {
 	isc_mem_t		*mctx;
 	char			*name;
 	const settings_set_t	*parent_set;
-	isc_mutex_t		*lock;  /**< locks only values */
-	setting_t		*first_setting;
+	isc_mutex_t		*lock;  /**< serializes writers,
+					     readers do not lock */
+	const setting_t		*first_setting; /**< shared defaults */
+	unsigned char		*slots;	/**< setting ID -> position + 1,
+					     NULL: ID is the position */
+	setting_t		**values; /**< latest published values by
+					       position, NULL: value from
+					       defaults */
 };
 
 /*
@@ -82,6 +88,12 @@ settings_set_create(isc_mem_t *mctx, const setting_t default_settings[],
 void
 settings_set_free(settings_set_t **set) ATTR_NONNULLS;
 
+isc_boolean_t
+settings_set_reclaimable(const settings_set_t *set) ATTR_NONNULLS ATTR_CHECKRESULT;
+
+void
+settings_set_reclaim(const settings_set_t *set) ATTR_NONNULLS;
+
 isc_result_t
 setting_set_parse_conf(isc_mem_t *mctx, const char *name,
 		       cfg_type_t *cfg_type_conf, const char *parameters,
@@ -2,27 +2,130 @@
  * Copyright (C) 2013-2014  bind-dyndb-ldap authors; see COPYING for license
  */
 
+#include <ldap.h>
 #include <unistd.h>
 
 #include <isc/condition.h>
 #include <isc/event.h>
+#include <isc/ht.h>
 #include <isc/mutex.h>
 #include <isc/task.h>
 #include <isc/time.h>
 #include <isc/util.h>
 
+#include <dns/name.h>
+#include <dns/rbt.h>
+
+#include "ldap_entry.h"
 #include "ldap_helper.h"
 #include "util.h"
-#include "semaphore.h"
 #include "syncrepl.h"
 
 #define LDAPDB_EVENT_SYNCREPL_BARRIER	(LDAPDB_EVENTCLASS + 2)
 #define LDAPDB_EVENT_SYNCREPL_FINISH	(LDAPDB_EVENTCLASS + 3)
 
-/** How many unprocessed LDAP events from syncrepl can be in event queue.
- *  Adding new events into the queue is blocked until some events
- *  are processed. */
-#define LDAP_CONCURRENCY_LIMIT 100
+/** Lower bound for amount of memory occupied by unprocessed LDAP events
+ *  from syncrepl. Adding new events into the queue is blocked until some
+ *  events are processed. */
+#define SYNC_QUEUE_MIN		(1024 * 1024)
+
+/** How often is the queue limit re-computed from observed drain rate. */
+#define SYNC_QUEUE_INTERVAL_US	1000000
+
+/** Queue limit is set to amount of data tasks can process in this time. */
+#define SYNC_QUEUE_LATENCY_MS	1000
+
+/** Maximal number of record events processed as one batch. */
+#define SYNC_BATCH_MAX		1000
+
+/** Size of entryUUID index of open batches as power of two. */
+#define SYNC_UUIDS_BITS		10
+
+/**
+ * Memory budget for unprocessed syncrepl events.
+ *
+ * Each event reserves estimated size of its LDAP entry before it is queued
+ * and releases it when processed. Reading from LDAP is blocked only when
+ * queued events exceed limit configured in sync_queue_limit option.
+ *
+ * Amount of data in events sent to tasks is limited by the current window.
+ * The window starts at #SYNC_QUEUE_MIN and adapts to rate at which tasks
+ * process events but never exceeds the limit.
+ *
+ * Events for records are additionally accounted per DNS zone. Events of
+ * a zone sent to its task can occupy at most window / active zones.
+ * Events which do not fit into the window or into the share of their
+ * zone are parked in pending list of the zone and sent when other events
+ * are processed, zones take turns. Zones blocked only by the window wait
+ * in the ready list, zones blocked by their share wait in the waiting list
+ * until events of the zone are processed or shares grow, so dispatching
+ * never scans zones which cannot send anything. A mass change in one zone
+ * thus never stops reading of changes for other zones. Order of events is not changed
+ * so events for the same zone are still processed in FIFO order.
+ *
+ * Pending events and events in batches which were not started yet
+ * are indexed by entryUUID. Newer change of an entry replaces the older
+ * one in place because only the last state of the entry matters,
+ * see sync_batch_add().
+ */
+typedef struct sync_zonequeue sync_zonequeue_t;
+struct sync_zonequeue {
+	size_t				queued;	/**< bytes in unprocessed
+						     events for the zone */
+	unsigned int			events;	/**< number of unprocessed
+						     events for the zone */
+	size_t				sent;	/**< bytes in events sent
+						     to zone task */
+	isc_task_t			*task;	/**< task of the zone */
+	ldap_syncreplevent_t		*batch;	/**< event sent to zone task
+						     which was not started
+						     yet */
+	unsigned int			batch_len; /**< number of events
+							in the batch */
+	LIST(ldap_syncreplevent_t)	pending; /**< events which were
+						      not sent yet */
+	isc_boolean_t			ready;	/**< zone is in ready list,
+						     not in waiting list */
+	LINK(sync_zonequeue_t)		link;	/**< in list of zones with
+						     pending events */
+};
+
+typedef struct sync_queue sync_queue_t;
+struct sync_queue {
+	isc_mutex_t			mutex;
+	isc_condition_t			cond;	/**< for signal when
+						     an event was processed */
+	size_t				limit;	/**< configured maximum */
+	size_t				window;	/**< current limit */
+	size_t				queued;	/**< bytes in unprocessed
+						     events */
+	size_t				sent;	/**< bytes in events sent
+						     to tasks */
+	size_t				drained; /**< bytes processed in
+						      current interval */
+	isc_boolean_t			blocked; /**< some event did not fit
+						      into the window in
+						      current interval */
+	isc_boolean_t			idle;	/**< tasks run out of events
+						     while window was full */
+	isc_time_t			interval_start;
+	dns_rbt_t			*zones;	/**< zone name ->
+						     sync_zonequeue_t */
+	unsigned int			zones_active; /**< zones with
+							   unprocessed
+							   events */
+	LIST(sync_zonequeue_t)		ready;	/**< zones with pending
+						     events which may fit
+						     into their share */
+	LIST(sync_zonequeue_t)		waiting; /**< zones with pending
+						      events which do not
+						      fit into their share */
+	isc_ht_t			*uuids;	/**< entryUUID -> event
+						     in open batch */
+	unsigned int			epoch;	/**< epoch of new events */
+	unsigned int			epoch_events[2]; /**< unprocessed events
+							      by epoch */
+};
 
 typedef struct task_element task_element_t;
 struct task_element {
@@ -30,11 +133,12 @@ struct task_element {
 	ISC_LINK(task_element_t)	link;
 };
 
-/** Timeout for thread synchronization. Conditions are re-checked every three
- * seconds to see if inst->exiting is true or not.
+/** Timeout for thread synchronization. Waiting threads are woken up
+ * by sync_ctx_wakeup() when inst->exiting is set, conditions are re-checked
+ * every three seconds only as a safety net.
  *
- * The expectation is that no event will wait in queue for three seconds so
- * polling will happen once only and only during BIND shutdown. */
+ * Functions which wait for progress of event processing give up when
+ * no event was processed during this time. */
 static const isc_interval_t shutdown_timeout = { 3, 0 };
 
 /**
@@ -75,6 +179,12 @@ static const isc_interval_t shutdown_timeout = { 3, 0 };
  * 	    is directly or indirectly executed from ldap_sync_{init,poll}
  * 	    functions and is synchronous.
  *
+ * Zone and config events are processed asynchronously by inst->task
+ * in FIFO order so reading from LDAP is not blocked by zone loading.
+ * Records depend on their zone and on configuration so events for records
+ * are sent only after all zone and config events they depend on
+ * were processed, see sync_event_wait().
+ *
  * @see ldap_sync_search_result()
  * @see ldap_sync_intermediate()
  * @see ldap_sync_search_entry()
@@ -82,9 +192,8 @@ static const isc_interval_t shutdown_timeout = { 3, 0 };
 struct sync_ctx {
 	isc_refcount_t			task_cnt; /**< provides atomic access */
 	isc_mem_t			*mctx;
-	/** limit number of unprocessed LDAP events in queue
-	 *  (memory consumption is one of problems) */
-	semaphore_t			concurr_limit;
+	/** limit memory occupied by unprocessed LDAP events in queue */
+	sync_queue_t			queue;
 
 	isc_mutex_t			mutex;	/**< guards rest of the structure */
 	isc_condition_t			cond;	/**< for signal when task_cnt == 0 */
@@ -93,8 +202,26 @@ struct sync_ctx {
 	ISC_LIST(task_element_t)	tasks;	/**< list of tasks processing
 						     events from initial
 						     synchronization phase */
-	isc_uint32_t			next_id;  /**< next sequential id */
-	isc_uint32_t			last_id;  /**< last processed event */
+	dns_rbt_t			*pending_zones; /**< zone name ->
+							     number of
+							     unprocessed zone
+							     events */
+	unsigned int			pending_configs; /**< number of
+							      unprocessed
+							      config events */
+	struct berval			cookies[SYNC_SHARDS_MAX + 1];
+						  /**< RFC 4533 cookies from
+						       the last data sessions
+						       which completed refresh,
+						       indexed by session */
+	unsigned int			shards_done; /**< record shards which
+							  completed refresh */
+	isc_boolean_t			shards_failed; /**< some record shard
+							    ended before
+							    refresh was done */
+	isc_boolean_t			shards_released; /**< record shards
+							      can start
+							      persist phase */
 };
 
 /**
@@ -129,6 +256,9 @@ finish(isc_task_t *task, isc_event_t *event) {
 
 	bev = (sync_barrierev_t *)event;
 	log_debug(1, "sync_barrier_wait(): finish reached");
+	/* SyncRepl session is waiting for the barrier so nothing else
+	 * modifies metaLDAP now. */
+	warm_start_discard(task, bev->inst);
 	LOCK(&bev->sctx->mutex);
 	switch (bev->sctx->state) {
 		case sync_configbarrier:
@@ -150,6 +280,8 @@ finish(isc_task_t *task, isc_event_t *event) {
 	UNLOCK(&bev->sctx->mutex);
 	if (new_state == sync_finished)
 		activate_zones(task, bev->inst);
+	else if (new_state == sync_datainit)
+		activate_zones_warm(task, bev->inst);
 
 	if (result != ISC_R_SUCCESS)
 		log_error_r("syncrepl finish() failed");
@@ -251,6 +383,46 @@ sync_barrierev_create(sync_ctx_t *sctx, ldap_instance_t *inst,
 	return ISC_R_SUCCESS;
 }
 
+/**
+ * Free syncrepl event which was not sent to any task.
+ */
+static void ATTR_NONNULLS
+sync_event_free(ldap_syncreplevent_t *ev) {
+	isc_mem_t *mctx = ev->mctx;
+
+	if (ev->prevdn != NULL)
+		isc_mem_free(mctx, ev->prevdn);
+	ldap_entry_destroy(&ev->entry);
+	isc_event_free((isc_event_t **)&ev);
+	isc_mem_detach(&mctx);
+}
+
+/* Callback for dns_rbt_create(). */
+static void
+sync_zonequeue_free(void *data, void *arg) {
+	isc_mem_t *mctx = arg;
+	sync_zonequeue_t *zq = data;
+	ldap_syncreplevent_t *ev;
+
+	/* Events can be pending only during shutdown. */
+	while ((ev = HEAD(zq->pending)) != NULL) {
+		UNLINK(zq->pending, ev, link);
+		sync_event_free(ev);
+	}
+	if (zq->task != NULL)
+		isc_task_detach(&zq->task);
+	SAFE_MEM_PUT_PTR(mctx, zq);
+}
+
+/* Callback for dns_rbt_create(). */
+static void
+sync_pending_free(void *data, void *arg) {
+	isc_mem_t *mctx = arg;
+	unsigned int *pending = data;
+
+	SAFE_MEM_PUT_PTR(mctx, pending);
+}
+
 /**
  * Initialize synchronization context.
  *
@@ -268,6 +440,8 @@ sync_ctx_init(isc_mem_t *mctx, ldap_instance_t *inst, sync_ctx_t **sctxp) {
 	isc_boolean_t lock_ready = ISC_FALSE;
 	isc_boolean_t cond_ready = ISC_FALSE;
 	isc_boolean_t refcount_ready = ISC_FALSE;
+	isc_boolean_t queue_lock_ready = ISC_FALSE;
+	isc_boolean_t queue_cond_ready = ISC_FALSE;
 
 	REQUIRE(sctxp != NULL && *sctxp == NULL);
 
@@ -291,12 +465,34 @@ sync_ctx_init(isc_mem_t *mctx, ldap_instance_t *inst, sync_ctx_t **sctxp) {
 	sctx->state = sync_configinit;
 	CHECK(sync_task_add(sctx, ldap_instance_gettask(sctx->inst)));
 
-	CHECK(semaphore_init(&sctx->concurr_limit, LDAP_CONCURRENCY_LIMIT));
+	CHECK(isc_mutex_init(&sctx->queue.mutex));
+	queue_lock_ready = ISC_TRUE;
+	CHECK(isc_condition_init(&sctx->queue.cond));
+	queue_cond_ready = ISC_TRUE;
+	sctx->queue.limit = SYNC_QUEUE_MIN;
+	sctx->queue.window = SYNC_QUEUE_MIN;
+	INIT_LIST(sctx->queue.ready);
+	INIT_LIST(sctx->queue.waiting);
+	TIME_NOW(&sctx->queue.interval_start);
+	CHECK(dns_rbt_create(sctx->mctx, sync_zonequeue_free, sctx->mctx,
+			     &sctx->queue.zones));
+	CHECK(dns_rbt_create(sctx->mctx, sync_pending_free, sctx->mctx,
+			     &sctx->pending_zones));
+	CHECK(isc_ht_init(&sctx->queue.uuids, sctx->mctx, SYNC_UUIDS_BITS));
 
 	*sctxp = sctx;
 	return ISC_R_SUCCESS;
 
 cleanup:
+	if (sctx->pending_zones != NULL)
+		dns_rbt_destroy(&sctx->pending_zones);
+	if (sctx->queue.zones != NULL)
+		dns_rbt_destroy(&sctx->queue.zones);
+	if (queue_lock_ready == ISC_TRUE)
+		DESTROYLOCK(&sctx->queue.mutex);
+	if (queue_cond_ready == ISC_TRUE)
+		RUNTIME_CHECK(isc_condition_destroy(&sctx->queue.cond)
+			      == ISC_R_SUCCESS);
 	if (lock_ready == ISC_TRUE)
 		DESTROYLOCK(&sctx->mutex);
 	if (cond_ready == ISC_TRUE)
@@ -321,6 +517,8 @@ sync_ctx_free(sync_ctx_t **sctxp) {
 
 	sctx = *sctxp;
 
+	sync_cookie_clear(sctx);
+
 	/* detach all tasks in task list, decrement refcounter to zero and
 	 * deallocate whole task list */
 	LOCK(&sctx->mutex);
@@ -338,9 +536,32 @@ sync_ctx_free(sync_ctx_t **sctxp) {
 	UNLOCK(&sctx->mutex);
 
 	DESTROYLOCK(&(*sctxp)->mutex);
+	dns_rbt_destroy(&sctx->queue.zones);
+	dns_rbt_destroy(&sctx->pending_zones);
+	isc_ht_destroy(&sctx->queue.uuids);
+	RUNTIME_CHECK(isc_condition_destroy(&sctx->queue.cond)
+		      == ISC_R_SUCCESS);
+	DESTROYLOCK(&sctx->queue.mutex);
 	MEM_PUT_AND_DETACH(*sctxp);
 }
 
+/**
+ * Wake up all threads waiting in synchronization context so they
+ * can notice that the instance is exiting.
+ */
+void
+sync_ctx_wakeup(sync_ctx_t *sctx) {
+	REQUIRE(sctx != NULL);
+
+	LOCK(&sctx->mutex);
+	BROADCAST(&sctx->cond);
+	UNLOCK(&sctx->mutex);
+
+	LOCK(&sctx->queue.mutex);
+	BROADCAST(&sctx->queue.cond);
+	UNLOCK(&sctx->queue.mutex);
+}
+
 void
 sync_state_get(sync_ctx_t *sctx, sync_state_t *statep) {
 	REQUIRE(sctx != NULL);
@@ -540,71 +761,683 @@ cleanup:
 }
 
 /**
- * Wait until there is a free slot in syncrepl 'queue' - this limits number
- * of unprocessed ISC events to #LDAP_CONCURRENCY_LIMIT.
+ * Set maximal amount of memory occupied by unprocessed syncrepl events.
+ */
+void
+sync_concurr_limit_set(sync_ctx_t *sctx, size_t limit) {
+	sync_queue_t *queue;
+
+	REQUIRE(sctx != NULL);
+	REQUIRE(limit > 0);
+
+	queue = &sctx->queue;
+	LOCK(&queue->mutex);
+	queue->limit = limit;
+	queue->window = ISC_MIN(SYNC_QUEUE_MIN, limit);
+	BROADCAST(&queue->cond);
+	UNLOCK(&queue->mutex);
+}
+
+/**
+ * Move all zones waiting for their share to the ready list because shares
+ * of all zones grew.
+ *
+ * @pre queue->mutex is locked.
+ */
+static void ATTR_NONNULLS
+sync_queue_wakeup(sync_queue_t *queue) {
+	sync_zonequeue_t *zq;
+
+	for (zq = HEAD(queue->waiting); zq != NULL; zq = NEXT(zq, link))
+		zq->ready = ISC_TRUE;
+	ISC_LIST_APPENDLIST(queue->ready, queue->waiting, link);
+}
+
+/**
+ * Re-compute queue window from amount of data processed
+ * in the last interval.
+ *
+ * If some events did not fit into the window and tasks processed all events
+ * sent to them, the window was too small to keep tasks busy so it is doubled.
+ * If events did not fit and tasks were busy all the time, the window is set
+ * to amount of data tasks can process in #SYNC_QUEUE_LATENCY_MS.
+ * The window never shrinks while events are not limited by it.
+ *
+ * @pre queue->mutex is locked.
+ */
+static void ATTR_NONNULLS
+sync_queue_adjust(sync_queue_t *queue) {
+	isc_time_t now;
+	isc_uint64_t elapsed;
+	isc_uint64_t target;
+	size_t window;
+
+	TIME_NOW(&now);
+	elapsed = isc_time_microdiff(&now, &queue->interval_start);
+	if (elapsed < SYNC_QUEUE_INTERVAL_US)
+		return;
+
+	target = (isc_uint64_t)queue->drained * SYNC_QUEUE_LATENCY_MS * 1000
+		 / elapsed;
+	window = queue->window;
+	if (queue->blocked == ISC_TRUE && queue->idle == ISC_TRUE)
+		window = ISC_MAX(window * 2, target);
+	else if (queue->blocked == ISC_TRUE || target > window)
+		window = target;
+	window = ISC_MAX(window, ISC_MIN(SYNC_QUEUE_MIN, queue->limit));
+	window = ISC_MIN(window, queue->limit);
+
+	if (window != queue->window)
+		log_debug(1, "syncrepl queue window changed from %zu to %zu "
+			  "bytes, %zu bytes processed in %lu ms, "
+			  "%zu bytes queued, %zu bytes sent", queue->window,
+			  window, queue->drained,
+			  (unsigned long)(elapsed / 1000), queue->queued,
+			  queue->sent);
+	if (window > queue->window)
+		sync_queue_wakeup(queue);
+	queue->window = window;
+	queue->drained = 0;
+	queue->blocked = ISC_FALSE;
+	queue->idle = ISC_FALSE;
+	queue->interval_start = now;
+}
+
+/**
+ * Find per-zone accounting for given zone or create a new one.
+ *
+ * @pre queue->mutex is locked.
+ */
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+sync_zonequeue_get(sync_queue_t *queue, isc_mem_t *mctx, dns_name_t *zone,
+		   sync_zonequeue_t **zqp) {
+	isc_result_t result;
+	sync_zonequeue_t *zq = NULL;
+
+	result = dns_rbt_findname(queue->zones, zone, 0, NULL, (void **)&zq);
+	if (result == ISC_R_SUCCESS) {
+		*zqp = zq;
+		return result;
+	}
+
+	CHECKED_MEM_GET_PTR(mctx, zq);
+	ZERO_PTR(zq);
+	INIT_LIST(zq->pending);
+	INIT_LINK(zq, link);
+	result = dns_rbt_addname(queue->zones, zone, zq);
+	if (result != ISC_R_SUCCESS) {
+		SAFE_MEM_PUT_PTR(mctx, zq);
+		goto cleanup;
+	}
+	queue->zones_active++;
+	*zqp = zq;
+
+cleanup:
+	return result;
+}
+
+/**
+ * Remove per-zone accounting for zone without unprocessed events.
+ *
+ * @pre queue->mutex is locked.
+ */
+static void ATTR_NONNULLS
+sync_zonequeue_release(sync_queue_t *queue, dns_name_t *zone,
+		       sync_zonequeue_t *zq) {
+	if (zq->events > 0)
+		return;
+
+	RUNTIME_CHECK(dns_rbt_deletename(queue->zones, zone, ISC_FALSE)
+		      == ISC_R_SUCCESS);
+	INSIST(queue->zones_active > 0);
+	queue->zones_active--;
+	sync_queue_wakeup(queue);
+}
+
+/**
+ * Remove events in closed batch from entryUUID index.
+ *
+ * @pre queue->mutex is locked.
+ */
+static void ATTR_NONNULLS
+sync_batch_close(sync_queue_t *queue, ldap_syncreplevent_t *batch) {
+	ldap_syncreplevent_t *ev;
+	struct berval *uuid;
+	void *indexed = NULL;
+
+	for (ev = batch; ev != NULL;
+	     ev = (ev == batch) ? HEAD(batch->batch) : NEXT(ev, link)) {
+		uuid = ev->entry->uuid;
+		if (uuid == NULL)
+			continue;
+		/* Index can point to another event with the same UUID. */
+		if (isc_ht_find(queue->uuids, (unsigned char *)uuid->bv_val,
+				uuid->bv_len, &indexed) == ISC_R_SUCCESS
+		    && indexed == ev)
+			RUNTIME_CHECK(isc_ht_delete(queue->uuids,
+					(unsigned char *)uuid->bv_val,
+					uuid->bv_len) == ISC_R_SUCCESS);
+	}
+}
+
+/**
+ * Wait until there is enough free space in syncrepl 'queue' - this limits
+ * memory occupied by unprocessed ISC events to the configured limit.
+ * Event bigger than the whole limit is accepted into an empty queue.
+ *
+ * Template refresh requests are accounted but they never wait. They are
+ * sent by inst->task which has to keep processing config and zone events
+ * so the queue can drain. Their number is limited by number of records
+ * with templates which are held in memory anyway.
+ *
+ * Only events for zones and configuration are sent to task immediately.
+ * Events for records have to be passed to sync_batch_add() which sends
+ * them when they fit into the window and the share of their zone,
+ * see struct sync_queue.
  *
  * End of syncrepl event processing has to be signalled by
- * sync_concurr_limit_signal() call.
+ * sync_concurr_limit_signal() call with the same zone and event.
+ * Size of the event must not change in between unless the change is
+ * accounted by the queue, see sync_batch_replace().
+ *
+ * @param[in] zone Zone the event belongs to or NULL for events which
+ *                 are not accounted per zone.
  */
 isc_result_t
-sync_concurr_limit_wait(sync_ctx_t *sctx) {
+sync_concurr_limit_wait(sync_ctx_t *sctx, dns_name_t *zone,
+			ldap_syncreplevent_t *ev) {
 	isc_result_t result;
+	size_t size = ev->size;
 	isc_time_t abs_timeout;
+	sync_queue_t *queue;
+	sync_zonequeue_t *zq = NULL;
 
 	REQUIRE(sctx != NULL);
 
-	while (ldap_instance_isexiting(sctx->inst) == ISC_FALSE) {
+	queue = &sctx->queue;
+	LOCK(&queue->mutex);
+	while (ev->entry->template_refresh == ISC_FALSE
+	       && queue->queued > 0 && queue->queued + size > queue->limit) {
+		if (ldap_instance_isexiting(sctx->inst) == ISC_TRUE)
+			CLEANUP_WITH(ISC_R_SHUTTINGDOWN);
+
 		result = isc_time_nowplusinterval(&abs_timeout,
 						  &shutdown_timeout);
 		INSIST(result == ISC_R_SUCCESS);
 
-		result = semaphore_wait_timed(&sctx->concurr_limit,
-					      &shutdown_timeout);
-		if (result == ISC_R_SUCCESS)
-			goto cleanup;
+		WAITUNTIL(&queue->cond, &queue->mutex, &abs_timeout);
+	}
+	if (zone != NULL)
+		CHECK(sync_zonequeue_get(queue, sctx->mctx, zone, &zq));
+	queue->queued += size;
+	ev->epoch = queue->epoch;
+	queue->epoch_events[ev->epoch]++;
+	if (zq != NULL) {
+		zq->queued += size;
+		zq->events++;
+		ev->dispatched = ISC_FALSE;
+	} else {
+		/* Caller sends the event right away. */
+		queue->sent += size;
+		ev->dispatched = ISC_TRUE;
+	}
+	result = ISC_R_SUCCESS;
+
+cleanup:
+	UNLOCK(&queue->mutex);
+	return result;
+}
+
+/**
+ * Check if record event can be sent to zone task without exceeding
+ * the window or the share of its zone.
+ *
+ * @pre queue->mutex is locked.
+ */
+static isc_boolean_t ATTR_NONNULLS
+sync_queue_fits(sync_queue_t *queue, sync_zonequeue_t *zq, size_t size) {
+	INSIST(queue->zones_active > 0);
+
+	if (queue->sent > 0 && queue->sent + size > queue->window) {
+		queue->blocked = ISC_TRUE;
+		return ISC_FALSE;
 	}
+	if (zq->sent > 0
+	    && zq->sent + size > queue->window / queue->zones_active)
+		return ISC_FALSE;
+	return ISC_TRUE;
+}
 
-	result = ISC_R_SHUTTINGDOWN;
+/**
+ * Send record event to zone task or append it to the batch which
+ * was sent to the zone task but was not started yet.
+ *
+ * Events are appended only to the last event sent for the zone so order
+ * of events for the zone is preserved. Batch is closed when its
+ * processing starts or when it reaches #SYNC_BATCH_MAX events.
+ *
+ * @pre queue->mutex is locked.
+ */
+static void ATTR_NONNULLS
+sync_queue_send(sync_queue_t *queue, sync_zonequeue_t *zq,
+		ldap_syncreplevent_t *ev) {
+	isc_task_t *task = NULL;
+
+	ev->dispatched = ISC_TRUE;
+	queue->sent += ev->size;
+	zq->sent += ev->size;
+
+	if (zq->batch != NULL && zq->batch_len < SYNC_BATCH_MAX) {
+		APPEND(zq->batch->batch, ev, link);
+		zq->batch_len++;
+		return;
+	}
+
+	if (zq->batch != NULL)
+		sync_batch_close(queue, zq->batch);
+	zq->batch = ev;
+	zq->batch_len = 1;
+	/* Event handler detaches the task. */
+	isc_task_attach(zq->task, &task);
+	isc_task_send(task, (isc_event_t **)&ev);
+}
+
+/**
+ * Send pending events which fit into the queue now. Ready zones take turns,
+ * one event from each zone in a round. Zone whose next event does not fit
+ * into its share is moved to the waiting list. Dispatching stops at the first
+ * event which does not fit into the window so zones with big events
+ * are not starved by zones with small ones.
+ *
+ * Each step sends an event or removes a zone from the ready list,
+ * zones which cannot send anything are never scanned.
+ *
+ * @pre queue->mutex is locked.
+ */
+static void ATTR_NONNULLS
+sync_queue_dispatch(sync_queue_t *queue) {
+	sync_zonequeue_t *zq;
+	ldap_syncreplevent_t *ev;
+
+	while ((zq = HEAD(queue->ready)) != NULL) {
+		ev = HEAD(zq->pending);
+		if (queue->sent > 0 && queue->sent + ev->size > queue->window) {
+			queue->blocked = ISC_TRUE;
+			break;
+		}
+		UNLINK(queue->ready, zq, link);
+		if (sync_queue_fits(queue, zq, ev->size) == ISC_FALSE) {
+			zq->ready = ISC_FALSE;
+			APPEND(queue->waiting, zq, link);
+			continue;
+		}
+		UNLINK(zq->pending, ev, link);
+		if (!EMPTY(zq->pending))
+			APPEND(queue->ready, zq, link);
+		sync_queue_send(queue, zq, ev);
+	}
+}
+
+/**
+ * Signal that syncrepl event was processed and its space in queue
+ * can be freed. Pending events which fit into the freed space are sent
+ * to their tasks.
+ */
+void
+sync_concurr_limit_signal(sync_ctx_t *sctx, dns_name_t *zone,
+			  ldap_syncreplevent_t *ev) {
+	sync_queue_t *queue;
+	sync_zonequeue_t *zq = NULL;
+	size_t size = ev->size;
+
+	REQUIRE(sctx != NULL);
+
+	queue = &sctx->queue;
+	LOCK(&queue->mutex);
+	if (zone != NULL) {
+		RUNTIME_CHECK(dns_rbt_findname(queue->zones, zone, 0, NULL,
+					       (void **)&zq) == ISC_R_SUCCESS);
+		INSIST(zq->queued >= size && zq->events > 0);
+		zq->queued -= size;
+		zq->events--;
+		if (ev->dispatched == ISC_TRUE) {
+			INSIST(zq->sent >= size);
+			zq->sent -= size;
+			/* Share of the zone was released. */
+			if (!EMPTY(zq->pending) && zq->ready == ISC_FALSE) {
+				UNLINK(queue->waiting, zq, link);
+				zq->ready = ISC_TRUE;
+				APPEND(queue->ready, zq, link);
+			}
+		}
+		sync_zonequeue_release(queue, zone, zq);
+	}
+	INSIST(queue->queued >= size);
+	queue->queued -= size;
+	if (ev->dispatched == ISC_TRUE) {
+		INSIST(queue->sent >= size);
+		queue->sent -= size;
+		queue->drained += size;
+	}
+	INSIST(queue->epoch_events[ev->epoch] > 0);
+	queue->epoch_events[ev->epoch]--;
+	if (queue->sent == 0 && queue->blocked == ISC_TRUE)
+		queue->idle = ISC_TRUE;
+	sync_queue_adjust(queue);
+	sync_queue_dispatch(queue);
+	BROADCAST(&queue->cond);
+	UNLOCK(&queue->mutex);
+}
+
+/**
+ * Replace state of LDAP entry in event which was not started yet by newer
+ * state from another event. Entries and sizes are swapped so the newer
+ * event holds the older state afterwards.
+ *
+ * Resulting change type is ADD only if the older change was ADD,
+ * i.e. the name did not exist in the zone before the older change.
+ *
+ * @pre queue->mutex is locked.
+ */
+static void ATTR_NONNULLS
+sync_batch_replace(ldap_syncreplevent_t *older, ldap_syncreplevent_t *newer) {
+	ldap_entry_t *entry;
+	size_t size;
+	int chgtype;
+
+	if (newer->chgtype == LDAP_SYNC_CAPI_DELETE)
+		chgtype = LDAP_SYNC_CAPI_DELETE;
+	else if (older->chgtype == LDAP_SYNC_CAPI_ADD)
+		chgtype = LDAP_SYNC_CAPI_ADD;
+	else
+		chgtype = LDAP_SYNC_CAPI_MODIFY;
+
+	entry = older->entry;
+	older->entry = newer->entry;
+	newer->entry = entry;
+	size = older->size;
+	older->size = newer->size;
+	newer->size = size;
+	newer->chgtype = older->chgtype;
+	older->chgtype = chgtype;
+}
+
+/**
+ * Send record event to the task of its zone. Consecutive events for a zone
+ * are merged into batches, all events in a batch are applied to the zone
+ * as one database version, see sync_queue_send().
+ *
+ * Event which does not fit into the queue window or into the share
+ * of its zone is parked in pending list of the zone and it is sent
+ * later by sync_concurr_limit_signal(). Event is parked also when older
+ * events for the same zone are pending so FIFO order is preserved.
+ *
+ * If a pending event or an open batch contains change of the same LDAP
+ * entry with the same DNS name, the newer state replaces the older one
+ * at its original position. Each event sets all data for its DNS name
+ * so the older state would be overwritten anyway. Template refresh request
+ * is dropped instead because it does not carry any new state.
+ *
+ * @pre Event was accounted by sync_concurr_limit_wait() for the zone.
+ *
+ * @param[in] task Task of the zone.
+ *
+ * @retval ISC_R_SUCCESS  Event was sent, appended to a batch or parked,
+ *                        the queue owns it now.
+ * @retval ISC_R_EXISTS   Event replaced older change of the same entry
+ *                        or it was not needed. ev now holds the older
+ *                        entry state or its own template refresh request
+ *                        and has to be destroyed instead of being sent.
+ */
+isc_result_t
+sync_batch_add(sync_ctx_t *sctx, dns_name_t *zone, isc_task_t *task,
+	       ldap_syncreplevent_t *ev) {
+	isc_result_t result;
+	sync_queue_t *queue;
+	sync_zonequeue_t *zq = NULL;
+	struct berval *uuid = ev->entry->uuid;
+	ldap_syncreplevent_t *older = NULL;
+	char zone_buf[DNS_NAME_FORMATSIZE];
+
+	REQUIRE(sctx != NULL);
+
+	INIT_LINK(ev, link);
+	INIT_LIST(ev->batch);
+
+	queue = &sctx->queue;
+	LOCK(&queue->mutex);
+	RUNTIME_CHECK(dns_rbt_findname(queue->zones, zone, 0, NULL,
+				       (void **)&zq) == ISC_R_SUCCESS);
+	if (zq->task == NULL)
+		isc_task_attach(task, &zq->task);
+
+	if (uuid != NULL
+	    && isc_ht_find(queue->uuids, (unsigned char *)uuid->bv_val,
+			   uuid->bv_len, (void **)&older) == ISC_R_SUCCESS
+	    && dns_name_equal(&older->entry->zone_name, zone)
+	    && dns_name_equal(&older->entry->fqdn, &ev->entry->fqdn)) {
+		/* Queued change renders templates with current variables. */
+		if (ev->entry->template_refresh == ISC_FALSE) {
+			sync_batch_replace(older, ev);
+			/* Sizes were swapped, older one was sent. */
+			if (older->dispatched == ISC_TRUE) {
+				queue->sent = queue->sent - ev->size
+					      + older->size;
+				zq->sent = zq->sent - ev->size + older->size;
+			}
+		}
+		CLEANUP_WITH(ISC_R_EXISTS);
+	}
+
+	/* Event with the same UUID for another name stays indexed. */
+	if (uuid != NULL)
+		(void)isc_ht_add(queue->uuids, (unsigned char *)uuid->bv_val,
+				 uuid->bv_len, ev);
+	if (EMPTY(zq->pending)
+	    && sync_queue_fits(queue, zq, ev->size) == ISC_TRUE) {
+		sync_queue_send(queue, zq, ev);
+	} else {
+		if (EMPTY(zq->pending)) {
+			/* Dispatch moves it to waiting list if necessary. */
+			zq->ready = ISC_TRUE;
+			APPEND(queue->ready, zq, link);
+			dns_name_format(zone, zone_buf, sizeof(zone_buf));
+			log_debug(1, "syncrepl queue for zone '%s' is full: "
+				  "%u events, %zu bytes queued, %u zones "
+				  "active", zone_buf, zq->events, zq->queued,
+				  queue->zones_active);
+		}
+		APPEND(zq->pending, ev, link);
+	}
+	result = ISC_R_SUCCESS;
 
 cleanup:
+	UNLOCK(&queue->mutex);
 	return result;
 }
 
 /**
- * Signal that syncrepl event was processed and the slot in concurrency limit
- * can be freed.
+ * Close batch of events before its processing starts. No events can be
+ * appended to ev->batch or replaced after this call.
  */
 void
-sync_concurr_limit_signal(sync_ctx_t *sctx) {
+sync_batch_start(sync_ctx_t *sctx, dns_name_t *zone, ldap_syncreplevent_t *ev) {
+	sync_queue_t *queue;
+	sync_zonequeue_t *zq = NULL;
+
+	REQUIRE(sctx != NULL);
+
+	queue = &sctx->queue;
+	LOCK(&queue->mutex);
+	RUNTIME_CHECK(dns_rbt_findname(queue->zones, zone, 0, NULL,
+				       (void **)&zq) == ISC_R_SUCCESS);
+	if (zq->batch == ev) {
+		zq->batch = NULL;
+		zq->batch_len = 0;
+	}
+	sync_batch_close(queue, ev);
+	UNLOCK(&queue->mutex);
+}
+
+/**
+ * Wait until all events accounted in given epoch are processed.
+ * Wait is interrupted if no event was processed for shutdown_timeout.
+ *
+ * @pre queue->mutex is locked.
+ */
+static isc_result_t ATTR_NONNULLS ATTR_CHECKRESULT
+sync_queue_epoch_wait(sync_queue_t *queue, unsigned int epoch) {
+	isc_result_t result = ISC_R_SUCCESS;
+	isc_time_t abs_timeout;
+	unsigned int events;
+
+	while (queue->epoch_events[epoch] > 0) {
+		events = queue->epoch_events[epoch];
+		result = isc_time_nowplusinterval(&abs_timeout,
+						  &shutdown_timeout);
+		INSIST(result == ISC_R_SUCCESS);
+
+		result = WAITUNTIL(&queue->cond, &queue->mutex, &abs_timeout);
+		if (result == ISC_R_TIMEDOUT
+		    && queue->epoch_events[epoch] == events)
+			break;
+		result = ISC_R_SUCCESS;
+	}
+
+	return result;
+}
+
+/**
+ * Wait until all syncrepl events sent before this call are processed.
+ * Events sent concurrently by other sessions belong to the next epoch
+ * and are not waited for so the wait always ends. Wait is interrupted
+ * if no event was processed for shutdown_timeout so this works even
+ * during shutdown.
+ *
+ * @retval ISC_R_SUCCESS  All events sent before the call were processed.
+ * @retval ISC_R_TIMEDOUT Some events are still being processed.
+ */
+isc_result_t
+sync_concurr_limit_drain(sync_ctx_t *sctx) {
+	isc_result_t result;
+	sync_queue_t *queue;
+	unsigned int epoch;
+
 	REQUIRE(sctx != NULL);
 
-	semaphore_signal(&sctx->concurr_limit);
+	queue = &sctx->queue;
+	LOCK(&queue->mutex);
+	/* Previous epoch can still contain events if the last drain
+	 * timed out. They were sent before this call as well. */
+	CHECK(sync_queue_epoch_wait(queue, queue->epoch ^ 1));
+	epoch = queue->epoch;
+	queue->epoch ^= 1;
+	CHECK(sync_queue_epoch_wait(queue, epoch));
+
+cleanup:
+	UNLOCK(&queue->mutex);
+	return result;
 }
 
 /**
- * Send ISC event to specified task and optionally wait until given event
- * is processed.
+ * Send ISC event to specified task.
  *
- * End of event processing has to be signaled by
+ * Zone and config events are dependencies of record events
+ * and have to be tracked until they are processed, see sync_event_wait().
+ * End of processing of such event has to be signaled by
  * @see sync_event_signal() call.
+ *
+ * @param[in] dependency Event for zone or config object.
  */
 isc_result_t
 sync_event_send(sync_ctx_t *sctx, isc_task_t *task, ldap_syncreplevent_t **ev,
-		isc_boolean_t synchronous) {
-	isc_result_t result;
-	isc_time_t abs_timeout;
-	isc_uint32_t seqid;
-	isc_boolean_t locked = ISC_FALSE;
+		isc_boolean_t dependency) {
+	isc_result_t result = ISC_R_SUCCESS;
+	ldap_entry_t *entry = (*ev)->entry;
+	unsigned int *pending = NULL;
 
 	REQUIRE(sctx != NULL);
 
 	LOCK(&sctx->mutex);
-	locked = ISC_TRUE;
-	/* overflow is not a problem as long as the modulo is smaller than
-	 * constant used by sync_concurr_limit_wait() */
-	(*ev)->seqid = seqid = ++sctx->next_id % 0xffffffff;
+	if (dependency == ISC_FALSE) {
+		/* Record events are not tracked. */
+	} else if ((entry->class & (LDAP_ENTRYCLASS_CONFIG
+				    | LDAP_ENTRYCLASS_SERVERCONFIG)) != 0) {
+		sctx->pending_configs++;
+	} else {
+		result = dns_rbt_findname(sctx->pending_zones, &entry->fqdn,
+					  0, NULL, (void **)&pending);
+		if (result != ISC_R_SUCCESS) {
+			CHECKED_MEM_GET_PTR(sctx->mctx, pending);
+			*pending = 0;
+			result = dns_rbt_addname(sctx->pending_zones,
+						 &entry->fqdn, pending);
+			if (result != ISC_R_SUCCESS) {
+				SAFE_MEM_PUT_PTR(sctx->mctx, pending);
+				goto cleanup;
+			}
+		}
+		(*pending)++;
+	}
 	isc_task_send(task, (isc_event_t **)ev);
-	while (synchronous == ISC_TRUE && sctx->last_id != seqid) {
+
+cleanup:
+	UNLOCK(&sctx->mutex);
+	return result;
+}
+
+/**
+ * Signal that given zone or config event was processed.
+ */
+void
+sync_event_signal(sync_ctx_t *sctx, ldap_syncreplevent_t *ev) {
+	ldap_entry_t *entry;
+	unsigned int *pending = NULL;
+
+	REQUIRE(sctx != NULL);
+	REQUIRE(ev != NULL);
+
+	entry = ev->entry;
+	LOCK(&sctx->mutex);
+	if ((entry->class & (LDAP_ENTRYCLASS_CONFIG
+			     | LDAP_ENTRYCLASS_SERVERCONFIG)) != 0) {
+		INSIST(sctx->pending_configs > 0);
+		sctx->pending_configs--;
+	} else {
+		RUNTIME_CHECK(dns_rbt_findname(sctx->pending_zones,
+					       &entry->fqdn, 0, NULL,
+					       (void **)&pending)
+			      == ISC_R_SUCCESS);
+		INSIST(*pending > 0);
+		if (--(*pending) == 0)
+			RUNTIME_CHECK(dns_rbt_deletename(sctx->pending_zones,
+							 &entry->fqdn,
+							 ISC_FALSE)
+				      == ISC_R_SUCCESS);
+	}
+	BROADCAST(&sctx->cond);
+	UNLOCK(&sctx->mutex);
+}
+
+/**
+ * Wait until all config events and all events for given zone sent so far
+ * were processed. Events for other zones are not waited for.
+ *
+ * @retval ISC_R_SUCCESS      Dependencies of the zone were processed.
+ * @retval ISC_R_SHUTTINGDOWN Instance is being shut down.
+ */
+isc_result_t
+sync_event_wait(sync_ctx_t *sctx, dns_name_t *zone) {
+	isc_result_t result = ISC_R_SUCCESS;
+	isc_time_t abs_timeout;
+	void *pending = NULL;
+
+	REQUIRE(sctx != NULL);
+
+	LOCK(&sctx->mutex);
+	while (sctx->pending_configs > 0
+	       || dns_rbt_findname(sctx->pending_zones, zone, 0, NULL,
+				   &pending) == ISC_R_SUCCESS) {
 		if (ldap_instance_isexiting(sctx->inst) == ISC_TRUE)
 			CLEANUP_WITH(ISC_R_SHUTTINGDOWN);
 
@@ -614,24 +1447,205 @@ sync_event_send(sync_ctx_t *sctx, isc_task_t *task, ldap_syncreplevent_t **ev,
 		WAITUNTIL(&sctx->cond, &sctx->mutex, &abs_timeout);
 	}
 
-	result = ISC_R_SUCCESS;
+cleanup:
+	UNLOCK(&sctx->mutex);
+	return result;
+}
+
+/**
+ * Remember RFC 4533 cookie which describes synchronization point reached
+ * by the given data session. Next data session can resume from this point
+ * instead of doing full refresh.
+ *
+ * Empty cookie forgets the stored one.
+ *
+ * @param[in] session Index of the data session, 0 is the session started
+ *                    by the watcher thread and 1..N are record shards.
+ */
+isc_result_t
+sync_cookie_set(sync_ctx_t *sctx, unsigned int session,
+		const struct berval *cookie) {
+	isc_result_t result = ISC_R_SUCCESS;
+	char *val = NULL;
+	struct berval *stored;
+
+	REQUIRE(sctx != NULL);
+	REQUIRE(session <= SYNC_SHARDS_MAX);
+	REQUIRE(cookie != NULL);
+
+	if (cookie->bv_val != NULL && cookie->bv_len != 0) {
+		CHECKED_MEM_GET(sctx->mctx, val, cookie->bv_len);
+		memcpy(val, cookie->bv_val, cookie->bv_len);
+	}
+
+	LOCK(&sctx->mutex);
+	stored = &sctx->cookies[session];
+	SAFE_MEM_PUT(sctx->mctx, stored->bv_val, stored->bv_len);
+	stored->bv_val = val;
+	stored->bv_len = (val != NULL) ? cookie->bv_len : 0;
+	UNLOCK(&sctx->mutex);
 
 cleanup:
-	if (locked == ISC_TRUE)
-		UNLOCK(&sctx->mutex);
 	return result;
 }
 
 /**
- * Signal that given syncrepl event was processed.
+ * Forget RFC 4533 cookies of all sessions so the next data sessions will do
+ * full refresh.
  */
 void
-sync_event_signal(sync_ctx_t *sctx, ldap_syncreplevent_t *ev) {
+sync_cookie_clear(sync_ctx_t *sctx) {
+	unsigned int i;
+
+	REQUIRE(sctx != NULL);
+
+	LOCK(&sctx->mutex);
+	for (i = 0; i <= SYNC_SHARDS_MAX; i++) {
+		SAFE_MEM_PUT(sctx->mctx, sctx->cookies[i].bv_val,
+			     sctx->cookies[i].bv_len);
+		sctx->cookies[i].bv_val = NULL;
+		sctx->cookies[i].bv_len = 0;
+	}
+	UNLOCK(&sctx->mutex);
+}
+
+/**
+ * Get copy of the stored RFC 4533 cookie for given session. The copy
+ * is allocated by liblber so it can be handed over to ldap_sync_t and freed
+ * by ldap_sync_destroy() or ber_memfree().
+ *
+ * @param[out] cookie Empty struct berval.
+ *
+ * @retval ISC_R_SUCCESS  Cookie was copied to the cookie parameter.
+ * @retval ISC_R_NOTFOUND No cookie is stored, full refresh is required.
+ */
+isc_result_t
+sync_cookie_get(sync_ctx_t *sctx, unsigned int session,
+		struct berval *cookie) {
+	isc_result_t result;
+
+	REQUIRE(sctx != NULL);
+	REQUIRE(session <= SYNC_SHARDS_MAX);
+	REQUIRE(cookie != NULL && cookie->bv_val == NULL);
+
+	LOCK(&sctx->mutex);
+	if (sctx->cookies[session].bv_val == NULL)
+		result = ISC_R_NOTFOUND;
+	else if (ber_dupbv(cookie, &sctx->cookies[session]) == NULL)
+		result = ISC_R_NOMEMORY;
+	else
+		result = ISC_R_SUCCESS;
+	UNLOCK(&sctx->mutex);
+
+	return result;
+}
+
+/**
+ * Prepare for a new set of record shard sessions.
+ */
+void
+sync_shards_reset(sync_ctx_t *sctx) {
 	REQUIRE(sctx != NULL);
-	REQUIRE(ev != NULL);
 
 	LOCK(&sctx->mutex);
-	sctx->last_id = ev->seqid;
+	sctx->shards_done = 0;
+	sctx->shards_failed = ISC_FALSE;
+	sctx->shards_released = ISC_FALSE;
+	UNLOCK(&sctx->mutex);
+}
+
+/**
+ * Report that a record shard session either completed its refresh phase
+ * or ended before completing it.
+ */
+void
+sync_shard_done(sync_ctx_t *sctx, isc_boolean_t refreshed) {
+	REQUIRE(sctx != NULL);
+
+	LOCK(&sctx->mutex);
+	if (refreshed == ISC_TRUE)
+		sctx->shards_done++;
+	else
+		sctx->shards_failed = ISC_TRUE;
 	BROADCAST(&sctx->cond);
 	UNLOCK(&sctx->mutex);
 }
+
+/**
+ * Wait until refresh phase is completed by all record shard sessions.
+ *
+ * @retval ISC_R_SUCCESS      All shards completed refresh.
+ * @retval ISC_R_FAILURE      Some shard ended before completing refresh.
+ * @retval ISC_R_SHUTTINGDOWN Instance is being shut down.
+ */
+isc_result_t
+sync_shards_wait(sync_ctx_t *sctx, unsigned int shards) {
+	isc_result_t result;
+	isc_time_t abs_timeout;
+
+	REQUIRE(sctx != NULL);
+
+	LOCK(&sctx->mutex);
+	while (sctx->shards_done < shards && sctx->shards_failed == ISC_FALSE) {
+		if (ldap_instance_isexiting(sctx->inst) == ISC_TRUE)
+			CLEANUP_WITH(ISC_R_SHUTTINGDOWN);
+
+		result = isc_time_nowplusinterval(&abs_timeout, &shutdown_timeout);
+		INSIST(result == ISC_R_SUCCESS);
+
+		WAITUNTIL(&sctx->cond, &sctx->mutex, &abs_timeout);
+	}
+	result = (sctx->shards_failed == ISC_TRUE) ? ISC_R_FAILURE
+						   : ISC_R_SUCCESS;
+
+cleanup:
+	UNLOCK(&sctx->mutex);
+	return result;
+}
+
+/**
+ * Let record shards waiting in sync_shard_release_wait() continue.
+ */
+void
+sync_shards_release(sync_ctx_t *sctx) {
+	REQUIRE(sctx != NULL);
+
+	LOCK(&sctx->mutex);
+	sctx->shards_released = ISC_TRUE;
+	BROADCAST(&sctx->cond);
+	UNLOCK(&sctx->mutex);
+}
+
+/**
+ * Wait until sync_shards_release() is called. Record shard which completed
+ * refresh phase must not change metaLDAP or zones until the session
+ * started by the watcher thread finished dead node detection and saved
+ * the synchronization state. Otherwise saved zone snapshots would not
+ * match saved metaLDAP.
+ *
+ * @retval ISC_R_SUCCESS      Shards were released.
+ * @retval ISC_R_SHUTTINGDOWN Instance is being shut down.
+ */
+isc_result_t
+sync_shard_release_wait(sync_ctx_t *sctx) {
+	isc_result_t result = ISC_R_SUCCESS;
+	isc_time_t abs_timeout;
+
+	REQUIRE(sctx != NULL);
+
+	LOCK(&sctx->mutex);
+	while (sctx->shards_released == ISC_FALSE) {
+		if (ldap_instance_isexiting(sctx->inst) == ISC_TRUE)
+			CLEANUP_WITH(ISC_R_SHUTTINGDOWN);
+
+		result = isc_time_nowplusinterval(&abs_timeout, &shutdown_timeout);
+		INSIST(result == ISC_R_SUCCESS);
+
+		WAITUNTIL(&sctx->cond, &sctx->mutex, &abs_timeout);
+	}
+	result = ISC_R_SUCCESS;
+
+cleanup:
+	UNLOCK(&sctx->mutex);
+	return result;
+}
@@ -5,6 +5,10 @@
 #ifndef SYNCREPL_H_
 #define SYNCREPL_H_
 
+#include <ldap.h>
+
+#include <dns/types.h>
+
 /**
  * SyncRepl state is stored inside ldap_instance_t.
  * Attributes in ldap_instance_t are be modified in new_ldap_instance function,
@@ -12,6 +16,12 @@
  * Before modifying at other places, switch to single-thread mode via
  * isc_task_beginexclusive() and then return back via isc_task_endexclusive()!
  */
+/** Maximal number of parallel SyncRepl sessions for records,
+ *  see sync_shards option. */
+#define SYNC_SHARDS_MAX		16
+/** Maximal value of sync_poll_interval option (in seconds). */
+#define SYNC_POLL_INTERVAL_MAX	86400
+
 typedef struct sync_ctx		sync_ctx_t;
 typedef enum sync_state		sync_state_t;
 typedef struct sync_barrierev	sync_barrierev_t;
@@ -36,6 +46,9 @@ sync_ctx_init(isc_mem_t *mctx, ldap_instance_t *inst, sync_ctx_t **sctxp) ATTR_N
 void
 sync_ctx_free(sync_ctx_t **statep);
 
+void
+sync_ctx_wakeup(sync_ctx_t *sctx) ATTR_NONNULLS;
+
 void
 sync_state_get(sync_ctx_t *sctx, sync_state_t *statep) ATTR_NONNULLS;
 
@@ -51,17 +64,61 @@ sync_task_add(sync_ctx_t *sctx, isc_task_t *task) ATTR_NONNULLS ATTR_CHECKRESULT
 isc_result_t
 sync_barrier_wait(sync_ctx_t *sctx, ldap_instance_t *inst) ATTR_NONNULLS ATTR_CHECKRESULT;
 
+void
+sync_concurr_limit_set(sync_ctx_t *sctx, size_t limit) ATTR_NONNULLS;
+
+isc_result_t
+sync_concurr_limit_wait(sync_ctx_t *sctx, dns_name_t *zone,
+			ldap_syncreplevent_t *ev) ATTR_NONNULL(1,3) ATTR_CHECKRESULT;
+
+void
+sync_concurr_limit_signal(sync_ctx_t *sctx, dns_name_t *zone,
+			  ldap_syncreplevent_t *ev) ATTR_NONNULL(1,3);
+
 isc_result_t
-sync_concurr_limit_wait(sync_ctx_t *sctx) ATTR_NONNULLS ATTR_CHECKRESULT;
+sync_batch_add(sync_ctx_t *sctx, dns_name_t *zone, isc_task_t *task,
+	       ldap_syncreplevent_t *ev) ATTR_NONNULLS ATTR_CHECKRESULT;
 
 void
-sync_concurr_limit_signal(sync_ctx_t *sctx) ATTR_NONNULLS;
+sync_batch_start(sync_ctx_t *sctx, dns_name_t *zone, ldap_syncreplevent_t *ev) ATTR_NONNULLS;
+
+isc_result_t
+sync_concurr_limit_drain(sync_ctx_t *sctx) ATTR_NONNULLS ATTR_CHECKRESULT;
 
 isc_result_t
 sync_event_send(sync_ctx_t *sctx, isc_task_t *task, ldap_syncreplevent_t **ev,
-		isc_boolean_t synchronous) ATTR_NONNULLS ATTR_CHECKRESULT;
+		isc_boolean_t dependency) ATTR_NONNULLS ATTR_CHECKRESULT;
 
 void
 sync_event_signal(sync_ctx_t *sctx, ldap_syncreplevent_t *ev) ATTR_NONNULLS;
 
+isc_result_t
+sync_event_wait(sync_ctx_t *sctx, dns_name_t *zone) ATTR_NONNULLS ATTR_CHECKRESULT;
+
+isc_result_t
+sync_cookie_set(sync_ctx_t *sctx, unsigned int session,
+		const struct berval *cookie) ATTR_NONNULLS ATTR_CHECKRESULT;
+
+void
+sync_cookie_clear(sync_ctx_t *sctx) ATTR_NONNULLS;
+
+isc_result_t
+sync_cookie_get(sync_ctx_t *sctx, unsigned int session,
+		struct berval *cookie) ATTR_NONNULLS ATTR_CHECKRESULT;
+
+void
+sync_shards_reset(sync_ctx_t *sctx) ATTR_NONNULLS;
+
+void
+sync_shard_done(sync_ctx_t *sctx, isc_boolean_t refreshed) ATTR_NONNULLS;
+
+isc_result_t
+sync_shards_wait(sync_ctx_t *sctx, unsigned int shards) ATTR_NONNULLS ATTR_CHECKRESULT;
+
+void
+sync_shards_release(sync_ctx_t *sctx) ATTR_NONNULLS;
+
+isc_result_t
+sync_shard_release_wait(sync_ctx_t *sctx) ATTR_NONNULLS ATTR_CHECKRESULT;
+
 #endif /* SYNCREPL_H_ */
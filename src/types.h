@@ -35,6 +35,7 @@ typedef struct ldap_instance	ldap_instance_t;
 typedef struct zone_register	zone_register_t;
 typedef struct mldapdb		mldapdb_t;
 typedef struct ldap_entry	ldap_entry_t;
+typedef struct ldap_parserpool	ldap_parserpool_t;
 typedef struct settings_set	settings_set_t;
 
 
@@ -47,7 +48,14 @@ struct ldap_syncreplevent {
 	char *prevdn;
 	int chgtype;
 	ldap_entry_t *entry;
-	isc_uint32_t seqid;
+	size_t size;
+	unsigned int epoch;	/**< see sync_concurr_limit_drain() */
+	isc_boolean_t dispatched; /**< event was sent to task,
+				       see sync_batch_add() */
+	isc_boolean_t applied;	/**< change was applied to the zone,
+				     see update_record() */
+	LINK(ldap_syncreplevent_t) link;
+	LIST(ldap_syncreplevent_t) batch;
 };
 
 #endif /* !_LD_TYPES_H_ */